@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+using namespace std;
+
+namespace voicemaker {
+
+pthread_key_t ConvertArena::arenaKey;
+pthread_once_t ConvertArena::keyOnce = PTHREAD_ONCE_INIT;
+size_t ConvertArena::totalCapacity = 0;
+
+ConvertArena::ConvertArena() {
+    memset(buffers, 0, sizeof(buffers));
+    memset(used, 0, sizeof(used));
+    capacity = 0;
+    windowPeak = 0;
+    windowConversions = 0;
+}
+
+ConvertArena::~ConvertArena() {
+    int i;
+
+    for (i = 0; i < BUFFER_COUNT; i++) {
+        free(buffers[i].data);
+    }
+    __sync_fetch_and_sub(&totalCapacity, capacity);
+}
+
+void ConvertArena::CreateKey() {
+    pthread_key_create(&arenaKey, ConvertArena::DeleteArena);
+}
+
+void ConvertArena::DeleteArena(void *arena) {
+    delete (ConvertArena *)arena;
+}
+
+ConvertArena *ConvertArena::Get() {
+    ConvertArena *arena;
+
+    pthread_once(&keyOnce, ConvertArena::CreateKey);
+    arena = (ConvertArena *)pthread_getspecific(arenaKey);
+    if (arena == NULL) {
+        arena = new ConvertArena();
+        if (pthread_setspecific(arenaKey, arena)) {
+            delete arena;
+            return NULL;
+        }
+    }
+
+    return arena;
+}
+
+size_t ConvertArena::GetTotalCapacity() {
+    return totalCapacity;
+}
+
+ConvertArena::Buffer *ConvertArena::GetBuffer(int buffer) {
+    if (buffer < 0 || buffer >= BUFFER_COUNT) {
+        return NULL;
+    }
+
+    return &buffers[buffer];
+}
+
+FilterMatcher::ReplaceBuffer *ConvertArena::GetReplaceBuffer() {
+    return &replaceBuffer;
+}
+
+TokenStream *ConvertArena::GetTokenStream() {
+    return &tokenStream;
+}
+
+void ConvertArena::Release() {
+    int i;
+
+    for (i = 0; i < BUFFER_COUNT; i++) {
+        free(buffers[i].data);
+        buffers[i].data = NULL;
+        buffers[i].capacity = 0;
+    }
+    vector<FilterMatcher::Match>().swap(replaceBuffer.matches);
+    vector<int>().swap(replaceBuffer.chosen);
+    vector<char>().swap(replaceBuffer.used);
+    vector<int>().swap(replaceBuffer.offsets);
+    tokenStream.Release();
+    UpdateCapacity();
+}
+
+void ConvertArena::Begin() {
+    // one long text must not pin its buffers on this thread for good
+    if (windowConversions >= WINDOW_CONVERSIONS) {
+        if (capacity > RELEASE_MIN_BYTES && capacity > windowPeak * RELEASE_RATIO) {
+            Release();
+        }
+        windowPeak = 0;
+        windowConversions = 0;
+    }
+    memset(used, 0, sizeof(used));
+    // sizes are counted as used, capacities are kept
+    replaceBuffer.matches.clear();
+    replaceBuffer.chosen.clear();
+    replaceBuffer.used.clear();
+    replaceBuffer.offsets.clear();
+    tokenStream.Clear();
+}
+
+void ConvertArena::Use(int buffer, int size) {
+    if (buffer < 0 || buffer >= BUFFER_COUNT) {
+        return;
+    }
+    if (size > used[buffer]) {
+        used[buffer] = size;
+    }
+}
+
+size_t ConvertArena::GetCapacity() {
+    size_t newCapacity = 0;
+    int i;
+
+    for (i = 0; i < BUFFER_COUNT; i++) {
+        newCapacity += buffers[i].capacity;
+    }
+    newCapacity += replaceBuffer.matches.capacity() * sizeof(FilterMatcher::Match);
+    newCapacity += replaceBuffer.chosen.capacity() * sizeof(int);
+    newCapacity += replaceBuffer.used.capacity();
+    newCapacity += replaceBuffer.offsets.capacity() * sizeof(int);
+    newCapacity += (tokenStream.tokens.capacity() + tokenStream.numbers.capacity()) * sizeof(ReadingToken);
+    newCapacity += tokenStream.readingsCapacity + tokenStream.valuesCapacity;
+
+    return newCapacity;
+}
+
+void ConvertArena::UpdateCapacity() {
+    size_t newCapacity = GetCapacity();
+
+    __sync_fetch_and_add(&totalCapacity, newCapacity - capacity);
+    capacity = newCapacity;
+}
+
+size_t ConvertArena::End() {
+    size_t usedBytes = 0;
+    int i;
+
+    // buffers only grow while converting
+    UpdateCapacity();
+    for (i = 0; i < BUFFER_COUNT; i++) {
+        usedBytes += used[i];
+    }
+    usedBytes += replaceBuffer.matches.size() * sizeof(FilterMatcher::Match);
+    usedBytes += replaceBuffer.chosen.size() * sizeof(int);
+    usedBytes += replaceBuffer.used.size();
+    usedBytes += replaceBuffer.offsets.size() * sizeof(int);
+    usedBytes += (tokenStream.tokens.size() + tokenStream.numbers.size()) * sizeof(ReadingToken);
+    usedBytes += tokenStream.readingsLen + tokenStream.valuesLen;
+    if (usedBytes > windowPeak) {
+        windowPeak = usedBytes;
+    }
+    windowConversions++;
+
+    return usedBytes;
+}
+
+} // namespace voicemaker
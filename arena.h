@@ -0,0 +1,70 @@
+#ifndef VOICEMAKER_ARENA_H
+#define VOICEMAKER_ARENA_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "dictionary.h"
+#include "reading.h"
+
+namespace voicemaker {
+
+// buffers of text conversion on a thread, grown to longest text and reused
+class ConvertArena {
+public:
+    const static int PRE_TEXT = 0;
+    // readings before filter
+    const static int SWAP_TEXT = 1;
+    const static int READING_TEXT = 2;
+    // numbers replaced by placeholders, sentence of mecab
+    const static int TAGGER_TEXT = 3;
+    const static int BUFFER_COUNT = 4;
+    // conversions of a window of use, buffers far above peak of last window are released in Begin
+    const static int WINDOW_CONVERSIONS = 64;
+    const static int RELEASE_RATIO = 4;
+    const static size_t RELEASE_MIN_BYTES = 64 * 1024;
+    // grown by realloc
+    struct Buffer {
+        char *data;
+        int capacity;
+    };
+
+    // arena of calling thread, NULL if failed
+    static ConvertArena *Get();
+    // bytes held by arenas of all threads
+    static size_t GetTotalCapacity();
+    Buffer *GetBuffer(int buffer);
+    FilterMatcher::ReplaceBuffer *GetReplaceBuffer();
+    TokenStream *GetTokenStream();
+    // used bytes are counted from Begin, buffers of text longer than recent ones are released here
+    void Begin();
+    void Use(int buffer, int size);
+    // bytes used by conversion since Begin
+    size_t End();
+
+private:
+    Buffer buffers[BUFFER_COUNT];
+    int used[BUFFER_COUNT];
+    FilterMatcher::ReplaceBuffer replaceBuffer;
+    TokenStream tokenStream;
+    size_t capacity;
+    // peak of used bytes in current window
+    size_t windowPeak;
+    int windowConversions;
+
+    static pthread_key_t arenaKey;
+    static pthread_once_t keyOnce;
+    static size_t totalCapacity;
+
+    static void CreateKey();
+    static void DeleteArena(void *arena);
+    size_t GetCapacity();
+    void UpdateCapacity();
+    void Release();
+
+    ConvertArena();
+    ~ConvertArena();
+};
+
+} // namespace voicemaker
+
+#endif
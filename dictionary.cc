@@ -0,0 +1,1697 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "normalizer.h"
+#include "dictionary.h"
+
+using namespace std;
+
+namespace voicemaker {
+
+namespace {
+
+template <class T> const T *GetData(const vector<T> &v) {
+    return v.empty() ? NULL : &v[0];
+}
+
+// layout of compiled dictionary, every section is aligned to 8 bytes
+const char COMPILED_MAGIC[8] = { 'V', 'M', 'D', 'I', 'C', 'T', '\0', '\0' };
+const int COMPILED_VERSION = 2;
+const int COMPILED_BYTE_ORDER = 0x01020304;
+
+struct CompiledHeader {
+    char magic[8];
+    int version;
+    int byteOrder;
+    int fileSize;
+    int preferredExtensionRatio;
+    int filterExtensionRatio;
+    int preferredSlotCount;
+    int preferredSlotOffset;
+    int preferredEntryCount;
+    int preferredEntryOffset;
+    int preferredLiveCount;
+    int preferredArenaSize;
+    int preferredArenaOffset;
+    int filterWordCount;
+    int filterWordOffset;
+    int filterArenaSize;
+    int filterArenaOffset;
+    int filterPatternCount;
+    int filterPatternOffset;
+    int filterNodeCount;
+    int filterRootNextOffset;
+    int filterEdgeStartOffset;
+    int filterFailOffset;
+    int filterOutputOffset;
+    int filterOutputLinkOffset;
+    int filterEdgeCount;
+    int filterEdgeLabelOffset;
+    int filterEdgeNextOffset;
+    int filterFoldFlags;
+};
+
+struct CompiledSection {
+    const void *data;
+    int size;
+    int *offset;
+};
+
+int AlignSection(int offset) {
+    return (offset + 7) & ~7;
+}
+
+int IsValidSection(const CompiledHeader *header, int offset, int count, int elementSize) {
+    if (offset < (int)sizeof(CompiledHeader) ||
+        (offset & 7) != 0 ||
+        count < 0 ||
+        offset > header->fileSize ||
+        (count > 0 && (header->fileSize - offset) / elementSize < count)) {
+        return 0;
+    }
+    return 1;
+}
+
+// fnv-1a of word, length is hashed as separator, mixed so that sums of digests spread
+unsigned long long GetWordDigest(const char *src, int srcLen, const char *dst, int dstLen) {
+    unsigned long long hash = 14695981039346656037ULL;
+    int i;
+
+    for (i = 0; i < srcLen; i++) {
+        hash = (hash ^ (unsigned char)src[i]) * 1099511628211ULL;
+    }
+    hash = (hash ^ (unsigned int)srcLen) * 1099511628211ULL;
+    for (i = 0; i < dstLen; i++) {
+        hash = (hash ^ (unsigned char)dst[i]) * 1099511628211ULL;
+    }
+    hash = (hash ^ (unsigned int)dstLen) * 1099511628211ULL;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+} // namespace
+
+FilterMatcher::FilterMatcher() {
+    attached = 0;
+    refCount = 1;
+    digest = 0;
+    image.foldFlags = TextNormalizer::CASE;
+    Build();
+}
+
+FilterMatcher::~FilterMatcher() {
+}
+
+void FilterMatcher::Ref() {
+    __sync_add_and_fetch(&refCount, 1);
+}
+
+void FilterMatcher::Unref() {
+    if (__sync_sub_and_fetch(&refCount, 1) == 0) {
+        delete this;
+    }
+}
+
+unsigned long long FilterMatcher::GetDigest() {
+    return digest;
+}
+
+void FilterMatcher::UpdateDigest() {
+    unsigned long long hash = 14695981039346656037ULL;
+    int i;
+
+    // registration order is priority of words, so digests are chained
+    for (i = 0; i < image.wordCount; i++) {
+        const Word &word = image.words[i];
+        hash = (hash ^ GetWordDigest(&image.arena[word.srcOffset], word.srcLen, &image.arena[word.dstOffset], word.dstLen)) * 1099511628211ULL;
+    }
+    // same words are matched differently by folding
+    digest = (hash ^ (unsigned int)image.foldFlags) * 1099511628211ULL;
+}
+
+bool FilterMatcher::CompareMatch(const Match &a, const Match &b) {
+    if (a.pattern != b.pattern) {
+        return a.pattern < b.pattern;
+    }
+    return a.start < b.start;
+}
+
+int FilterMatcher::Next(int node, unsigned char c) {
+    int low, high;
+
+    if (node == 0) {
+        return image.rootNext[c];
+    }
+    low = image.edgeStart[node];
+    high = image.edgeStart[node + 1];
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (image.edgeLabel[middle] == c) {
+            return image.edgeNext[middle];
+        } else if (image.edgeLabel[middle] < c) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return -1;
+}
+
+void FilterMatcher::UpdateImage() {
+    image.words = GetData(wordStorage);
+    image.wordCount = wordStorage.size();
+    image.arena = GetData(arenaStorage);
+    image.arenaSize = arenaStorage.size();
+    image.patterns = GetData(patternStorage);
+    image.patternCount = patternStorage.size();
+    image.rootNext = GetData(rootNextStorage);
+    image.edgeStart = GetData(edgeStartStorage);
+    image.fail = GetData(failStorage);
+    image.output = GetData(outputStorage);
+    image.outputLink = GetData(outputLinkStorage);
+    image.nodeCount = failStorage.size();
+    image.edgeLabel = GetData(edgeLabelStorage);
+    image.edgeNext = GetData(edgeNextStorage);
+    image.edgeCount = edgeNextStorage.size();
+}
+
+void FilterMatcher::Detach() {
+    if (!attached) {
+        return;
+    }
+    wordStorage.assign(image.words, image.words + image.wordCount);
+    arenaStorage.assign(image.arena, image.arena + image.arenaSize);
+    patternStorage.assign(image.patterns, image.patterns + image.patternCount);
+    rootNextStorage.assign(image.rootNext, image.rootNext + 256);
+    edgeStartStorage.assign(image.edgeStart, image.edgeStart + image.nodeCount + 1);
+    failStorage.assign(image.fail, image.fail + image.nodeCount);
+    outputStorage.assign(image.output, image.output + image.nodeCount);
+    outputLinkStorage.assign(image.outputLink, image.outputLink + image.nodeCount);
+    edgeLabelStorage.assign(image.edgeLabel, image.edgeLabel + image.edgeCount);
+    edgeNextStorage.assign(image.edgeNext, image.edgeNext + image.edgeCount);
+    attached = 0;
+    UpdateImage();
+}
+
+void FilterMatcher::GetImage(Image *image) {
+    *image = this->image;
+}
+
+void FilterMatcher::Attach(const Image *image) {
+    wordStorage.clear();
+    arenaStorage.clear();
+    patternStorage.clear();
+    rootNextStorage.clear();
+    edgeStartStorage.clear();
+    failStorage.clear();
+    outputStorage.clear();
+    outputLinkStorage.clear();
+    edgeLabelStorage.clear();
+    edgeNextStorage.clear();
+    this->image = *image;
+    attached = 1;
+    UpdateDigest();
+}
+
+int FilterMatcher::Validate(const Image *image) {
+    vector<int> depth(image->nodeCount, -1);
+    int i, j;
+
+    // words are copied with their terminators by Build
+    for (i = 0; i < image->wordCount; i++) {
+        const Word &word = image->words[i];
+        if (word.srcOffset < 0 || word.srcLen <= 0 || word.srcLen >= image->arenaSize - word.srcOffset ||
+            word.dstOffset < 0 || word.dstLen <= 0 || word.dstLen >= image->arenaSize - word.dstOffset) {
+            return 1;
+        }
+    }
+    for (i = 0; i < image->patternCount; i++) {
+        const Pattern &pattern = image->patterns[i];
+        if (pattern.srcLen <= 0 ||
+            pattern.dstOffset < 0 || pattern.dstLen < 0 || pattern.dstLen > image->arenaSize - pattern.dstOffset) {
+            return 1;
+        }
+    }
+    // children have larger index than parent, so depth is known before node is visited
+    depth[0] = 0;
+    for (i = 0; i < image->nodeCount; i++) {
+        if (depth[i] < 0 ||
+            image->edgeStart[i] < 0 ||
+            image->edgeStart[i] > image->edgeStart[i + 1] ||
+            image->edgeStart[i + 1] > image->edgeCount) {
+            return 1;
+        }
+        for (j = image->edgeStart[i]; j < image->edgeStart[i + 1]; j++) {
+            int next = image->edgeNext[j];
+            if (next <= i || next >= image->nodeCount || depth[next] >= 0) {
+                return 1;
+            }
+            depth[next] = depth[i] + 1;
+        }
+    }
+    for (i = 0; i < 256; i++) {
+        if (image->rootNext[i] != -1 &&
+            (image->rootNext[i] < 1 || image->rootNext[i] >= image->nodeCount || depth[image->rootNext[i]] != 1)) {
+            return 1;
+        }
+    }
+    // links go to shorter suffixes, Replace follows them until root and matches never start before text
+    if (image->fail[0] != 0 || image->output[0] != -1 || image->outputLink[0] != 0) {
+        return 1;
+    }
+    for (i = 1; i < image->nodeCount; i++) {
+        int fail = image->fail[i];
+        int output = image->output[i];
+        int outputLink = image->outputLink[i];
+        if (fail < 0 || fail >= image->nodeCount || depth[fail] >= depth[i] ||
+            outputLink < 0 || outputLink >= image->nodeCount || depth[outputLink] >= depth[i] ||
+            (outputLink != 0 && image->output[outputLink] == -1) ||
+            output < -1 || output >= image->patternCount ||
+            (output != -1 && image->patterns[output].srcLen != depth[i])) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int FilterMatcher::Insert(const char *src, int srcLen, const char *dst, int dstLen) {
+    Word word;
+
+    if (src == NULL ||
+        srcLen <= 0 ||
+        dst == NULL ||
+        dstLen <= 0) {
+        return 1;
+    }
+    Detach();
+    word.srcOffset = arenaStorage.size();
+    word.srcLen = srcLen;
+    word.dstOffset = word.srcOffset + srcLen + 1;
+    word.dstLen = dstLen;
+    arenaStorage.insert(arenaStorage.end(), src, src + srcLen);
+    arenaStorage.push_back('\0');
+    arenaStorage.insert(arenaStorage.end(), dst, dst + dstLen);
+    arenaStorage.push_back('\0');
+    wordStorage.push_back(word);
+    UpdateImage();
+
+    return 0;
+}
+
+int FilterMatcher::Delete(const char *src, int srcLen) {
+    if (src == NULL ||
+        srcLen <= 0) {
+        return 1;
+    }
+    Detach();
+    vector<Word>::iterator wordIterator = wordStorage.begin();
+    while (wordIterator != wordStorage.end()) {
+        if (wordIterator->srcLen == srcLen && memcmp(&arenaStorage[wordIterator->srcOffset], src, srcLen) == 0) {
+            wordIterator = wordStorage.erase(wordIterator);
+        } else {
+            wordIterator++;
+        }
+    }
+    UpdateImage();
+
+    return 0;
+}
+
+void FilterMatcher::SetFoldFlags(int flags) {
+    // width is folded when words are inserted, folding must keep length
+    image.foldFlags = TextNormalizer::CASE | (flags & TextNormalizer::KANA);
+}
+
+void FilterMatcher::Clear() {
+    attached = 0;
+    wordStorage.clear();
+    arenaStorage.clear();
+    Build();
+}
+
+int FilterMatcher::GetNext(int *position, const char **src, int *srcLen, const char **dst, int *dstLen) {
+    if (position == NULL ||
+        src == NULL ||
+        srcLen == NULL ||
+        dst == NULL ||
+        dstLen == NULL) {
+        return 1;
+    }
+    if (*position >= image.wordCount) {
+        return -1;
+    }
+    const Word &word = image.words[*position];
+    *src = &image.arena[word.srcOffset];
+    *srcLen = word.srcLen;
+    *dst = &image.arena[word.dstOffset];
+    *dstLen = word.dstLen;
+    (*position)++;
+
+    return 0;
+}
+
+int FilterMatcher::Build() {
+    vector<map<unsigned char, int> > trie(1);
+    vector<int> trieOutput(1, -1);
+    vector<int> order;
+    vector<int> newIndex;
+    vector<int> trieFail;
+    vector<int> trieOutputLink;
+    vector<Word> words;
+    vector<char> arena;
+    char folded[TextNormalizer::MAX_FOLDED];
+    size_t head;
+    int i;
+
+    Detach();
+    // words are compacted, deleted words leave garbage in arena
+    patternStorage.clear();
+    for (i = 0; i < (int)wordStorage.size(); i++) {
+        Word word = wordStorage[i];
+        const char *dicSrc = &arenaStorage[word.srcOffset];
+        const char *dicDst = &arenaStorage[word.dstOffset];
+        int node = 0;
+        int j;
+        Pattern pattern;
+        word.srcOffset = arena.size();
+        arena.insert(arena.end(), dicSrc, dicSrc + word.srcLen + 1);
+        word.dstOffset = arena.size();
+        arena.insert(arena.end(), dicDst, dicDst + word.dstLen + 1);
+        words.push_back(word);
+        if ((*dicSrc >= 0x30 && *dicSrc <= 0x39 && word.srcLen == 1) ||
+            (*dicSrc == ' ' && word.srcLen == 1) ||
+            (*dicSrc == '-' && word.srcLen == 1) ||
+            (*dicSrc == '.' && word.srcLen == 1)) {
+            continue;
+        }
+        for (j = 0; j < word.srcLen;) {
+            int foldedLen = 1;
+            int length = TextNormalizer::Fold(folded, &foldedLen, &dicSrc[j], word.srcLen - j, image.foldFlags);
+            int k;
+            if (length == 0) {
+                folded[0] = dicSrc[j];
+                length = 1;
+            }
+            for (k = 0; k < foldedLen; k++) {
+                unsigned char c = (unsigned char)folded[k];
+                map<unsigned char, int>::iterator child = trie[node].find(c);
+                if (child == trie[node].end()) {
+                    trie[node][c] = trie.size();
+                    node = trie.size();
+                    trie.push_back(map<unsigned char, int>());
+                    trieOutput.push_back(-1);
+                } else {
+                    node = child->second;
+                }
+            }
+            j += length;
+        }
+        if (trieOutput[node] != -1) {
+            continue;
+        }
+        pattern.srcLen = word.srcLen;
+        pattern.dstOffset = word.dstOffset;
+        pattern.dstLen = word.dstLen;
+        trieOutput[node] = patternStorage.size();
+        patternStorage.push_back(pattern);
+    }
+    wordStorage.swap(words);
+    arenaStorage.swap(arena);
+
+    // failure links in breadth first order
+    trieFail.assign(trie.size(), 0);
+    trieOutputLink.assign(trie.size(), 0);
+    order.push_back(0);
+    for (head = 0; head < order.size(); head++) {
+        int node = order[head];
+        map<unsigned char, int>::iterator child;
+        for (child = trie[node].begin(); child != trie[node].end(); child++) {
+            int next = child->second;
+            int f = trieFail[node];
+            order.push_back(next);
+            if (node != 0) {
+                while (f != 0 && trie[f].find(child->first) == trie[f].end()) {
+                    f = trieFail[f];
+                }
+                if (trie[f].find(child->first) != trie[f].end()) {
+                    f = trie[f][child->first];
+                }
+            }
+            trieFail[next] = f;
+            trieOutputLink[next] = (trieOutput[f] != -1) ? f : trieOutputLink[f];
+        }
+    }
+
+    // flatten trie, nodes are renumbered in breadth first order
+    newIndex.assign(trie.size(), 0);
+    for (head = 0; head < order.size(); head++) {
+        newIndex[order[head]] = head;
+    }
+    rootNextStorage.assign(256, -1);
+    edgeStartStorage.assign(order.size() + 1, 0);
+    edgeLabelStorage.clear();
+    edgeNextStorage.clear();
+    failStorage.assign(order.size(), 0);
+    outputStorage.assign(order.size(), -1);
+    outputLinkStorage.assign(order.size(), 0);
+    for (head = 0; head < order.size(); head++) {
+        int node = order[head];
+        map<unsigned char, int>::iterator child;
+        edgeStartStorage[head] = edgeLabelStorage.size();
+        for (child = trie[node].begin(); child != trie[node].end(); child++) {
+            if (head == 0) {
+                rootNextStorage[child->first] = newIndex[child->second];
+            }
+            edgeLabelStorage.push_back(child->first);
+            edgeNextStorage.push_back(newIndex[child->second]);
+        }
+        failStorage[head] = newIndex[trieFail[node]];
+        outputStorage[head] = trieOutput[node];
+        outputLinkStorage[head] = newIndex[trieOutputLink[node]];
+    }
+    edgeStartStorage[order.size()] = edgeLabelStorage.size();
+    UpdateImage();
+    UpdateDigest();
+
+    return 0;
+}
+
+int FilterMatcher::Replace(char **replacedText, int *replacedTextCapacity, const char *text, int textLength, ReplaceBuffer *replaceBuffer) {
+    vector<Match> &matches = replaceBuffer->matches;
+    vector<int> &chosen = replaceBuffer->chosen;
+    vector<char> &used = replaceBuffer->used;
+    vector<int> &offsets = replaceBuffer->offsets;
+    char folded[TextNormalizer::MAX_FOLDED];
+    char *newText;
+    char *newTextPtr;
+    int newTextLength;
+    int foldedLen = 0;
+    int foldedPos = 0;
+    int state = 0;
+    int i, j;
+
+    if (replacedText == NULL ||
+        replacedTextCapacity == NULL ||
+        text == NULL ||
+        replaceBuffer == NULL) {
+        return 1;
+    }
+    matches.clear();
+    offsets.clear();
+    for (i = 0; i < textLength; i++) {
+        unsigned char c;
+        int next;
+        // folded character has same length, its bytes are fed one by one
+        if (foldedPos == foldedLen) {
+            foldedPos = 0;
+            if (TextNormalizer::Fold(folded, &foldedLen, &text[i], textLength - i, image.foldFlags) == 0) {
+                folded[0] = text[i];
+                foldedLen = 1;
+            }
+        }
+        c = (unsigned char)folded[foldedPos++];
+        while ((next = Next(state, c)) < 0 && state != 0) {
+            state = image.fail[state];
+        }
+        state = (next < 0) ? 0 : next;
+        for (j = (image.output[state] != -1) ? state : image.outputLink[state]; j != 0; j = image.outputLink[j]) {
+            Match match;
+            match.start = i + 1 - image.patterns[image.output[j]].srcLen;
+            match.pattern = image.output[j];
+            matches.push_back(match);
+        }
+    }
+    newTextLength = textLength;
+    if (!matches.empty()) {
+        // earlier registered words take text first, same as replacing word by word
+        sort(matches.begin(), matches.end(), FilterMatcher::CompareMatch);
+        chosen.assign(textLength, -1);
+        used.assign(textLength, 0);
+        for (i = 0; i < (int)matches.size(); i++) {
+            const Match &match = matches[i];
+            int srcLen = image.patterns[match.pattern].srcLen;
+            for (j = 0; j < srcLen && !used[match.start + j]; j++);
+            if (j != srcLen) {
+                continue;
+            }
+            memset(&used[match.start], 1, srcLen);
+            chosen[match.start] = match.pattern;
+            newTextLength += image.patterns[match.pattern].dstLen - srcLen;
+        }
+    }
+    if (*replacedTextCapacity < newTextLength + 1) {
+        newText = (char *)realloc(*replacedText, newTextLength + 1);
+        if (newText == NULL) {
+            return 2;
+        }
+        *replacedText = newText;
+        *replacedTextCapacity = newTextLength + 1;
+    }
+    newText = *replacedText;
+    if (matches.empty()) {
+        memcpy(newText, text, textLength);
+    } else {
+        newTextPtr = newText;
+        offsets.resize(textLength + 1);
+        for (i = 0; i < textLength;) {
+            if (chosen[i] == -1) {
+                offsets[i] = newTextPtr - newText;
+                *newTextPtr++ = text[i++];
+                continue;
+            }
+            const Pattern &pattern = image.patterns[chosen[i]];
+            offsets[i] = newTextPtr - newText;
+            memcpy(newTextPtr, &image.arena[pattern.dstOffset], pattern.dstLen);
+            newTextPtr += pattern.dstLen;
+            // bytes inside replaced word are after it
+            for (j = 1; j < pattern.srcLen; j++) {
+                offsets[i + j] = newTextPtr - newText;
+            }
+            i += pattern.srcLen;
+        }
+        offsets[textLength] = newTextLength;
+    }
+    newText[newTextLength] = '\0';
+
+    return 0;
+}
+
+PreferredTable::PreferredTable() {
+    arena = NULL;
+    arenaSize = 0;
+    arenaUsed = 0;
+    entries = NULL;
+    entryCount = 0;
+    entryCapacity = 0;
+    liveCount = 0;
+    slots = NULL;
+    slotMask = -1;
+    slotUsed = 0;
+    attached = 0;
+    refCount = 1;
+    digest = 0;
+}
+
+PreferredTable::~PreferredTable() {
+    Clear();
+}
+
+void PreferredTable::Ref() {
+    __sync_add_and_fetch(&refCount, 1);
+}
+
+void PreferredTable::Unref() {
+    if (__sync_sub_and_fetch(&refCount, 1) == 0) {
+        delete this;
+    }
+}
+
+unsigned long long PreferredTable::GetDigest() {
+    return digest;
+}
+
+unsigned int PreferredTable::GetHashValue(const char *key, int keyLen) {
+    // fnv-1a
+    unsigned int v = 2166136261U;
+
+    for (int i = 0; i < keyLen; i++) {
+        v ^= (unsigned char)key[i];
+        v *= 16777619U;
+    }
+    return v;
+}
+
+int PreferredTable::FindSlot(const char *src, int srcLen, unsigned int hash) {
+    int i;
+
+    if (slots == NULL) {
+        return -1;
+    }
+    for (i = hash & slotMask; slots[i] != EMPTY; i = (i + 1) & slotMask) {
+        if (slots[i] == DELETED) {
+            continue;
+        }
+        const Entry &entry = entries[slots[i]];
+        if (entry.hash == hash &&
+            entry.srcLen == srcLen &&
+            memcmp(&arena[entry.srcOffset], src, srcLen) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int PreferredTable::Rehash(int newSlotCount) {
+    int *newSlots;
+    Entry *newEntries;
+    char *newArena;
+    int newArenaUsed = 0;
+    int newEntryCount = 0;
+    int i, j;
+
+    // live entries are compacted in registration order
+    newSlots = (int *)malloc(sizeof(int) * newSlotCount);
+    newEntries = (Entry *)malloc(sizeof(Entry) * (liveCount > 0 ? liveCount * 2 : 16));
+    newArena = (char *)malloc(arenaUsed > 0 ? arenaUsed * 2 : 256);
+    if (newSlots == NULL || newEntries == NULL || newArena == NULL) {
+        free(newSlots);
+        free(newEntries);
+        free(newArena);
+        return 1;
+    }
+    for (i = 0; i < newSlotCount; i++) {
+        newSlots[i] = EMPTY;
+    }
+    for (i = 0; i < entryCount; i++) {
+        Entry entry = entries[i];
+        if (entry.srcLen == 0) {
+            continue;
+        }
+        memcpy(&newArena[newArenaUsed], &arena[entry.srcOffset], entry.srcLen + entry.dstLen + 1);
+        entry.srcOffset = newArenaUsed;
+        entry.dstOffset = newArenaUsed + entry.srcLen;
+        newArenaUsed += entry.srcLen + entry.dstLen + 1;
+        for (j = entry.hash & (newSlotCount - 1); newSlots[j] != EMPTY; j = (j + 1) & (newSlotCount - 1));
+        newSlots[j] = newEntryCount;
+        newEntries[newEntryCount++] = entry;
+    }
+    if (!attached) {
+        free(slots);
+        free(entries);
+        free(arena);
+    }
+    attached = 0;
+    slots = newSlots;
+    slotMask = newSlotCount - 1;
+    slotUsed = newEntryCount;
+    entries = newEntries;
+    entryCount = newEntryCount;
+    entryCapacity = liveCount > 0 ? liveCount * 2 : 16;
+    arena = newArena;
+    arenaSize = arenaUsed > 0 ? arenaUsed * 2 : 256;
+    arenaUsed = newArenaUsed;
+
+    return 0;
+}
+
+int PreferredTable::Insert(const char *src, int srcLen, const char *dst, int dstLen) {
+    unsigned int hash;
+    int i;
+
+    if (src == NULL ||
+        srcLen <= 0 ||
+        dst == NULL ||
+        dstLen <= 0) {
+        return 1;
+    }
+    hash = GetHashValue(src, srcLen);
+    if (FindSlot(src, srcLen, hash) >= 0) {
+        return 0;
+    }
+    if (slots == NULL || attached || (slotUsed + 1) * 2 > slotMask + 1) {
+        int newSlotCount = 16;
+        while (newSlotCount < (liveCount + 1) * 4) {
+            newSlotCount *= 2;
+        }
+        if (Rehash(newSlotCount)) {
+            return 1;
+        }
+    }
+    if (entryCount == entryCapacity) {
+        Entry *newEntries = (Entry *)realloc(entries, sizeof(Entry) * entryCapacity * 2);
+        if (newEntries == NULL) {
+            return 1;
+        }
+        entries = newEntries;
+        entryCapacity *= 2;
+    }
+    if (arenaUsed + srcLen + dstLen + 1 > arenaSize) {
+        int newArenaSize = arenaSize * 2;
+        while (newArenaSize < arenaUsed + srcLen + dstLen + 1) {
+            newArenaSize *= 2;
+        }
+        char *newArena = (char *)realloc(arena, newArenaSize);
+        if (newArena == NULL) {
+            return 1;
+        }
+        arena = newArena;
+        arenaSize = newArenaSize;
+    }
+    Entry &entry = entries[entryCount];
+    entry.hash = hash;
+    entry.srcOffset = arenaUsed;
+    entry.srcLen = srcLen;
+    entry.dstOffset = arenaUsed + srcLen;
+    entry.dstLen = dstLen;
+    memcpy(&arena[entry.srcOffset], src, srcLen);
+    memcpy(&arena[entry.dstOffset], dst, dstLen);
+    arena[entry.dstOffset + dstLen] = '\0';
+    arenaUsed += srcLen + dstLen + 1;
+    for (i = hash & slotMask; slots[i] >= 0; i = (i + 1) & slotMask);
+    if (slots[i] == EMPTY) {
+        slotUsed++;
+    }
+    slots[i] = entryCount++;
+    liveCount++;
+    digest += GetWordDigest(src, srcLen, dst, dstLen);
+
+    return 0;
+}
+
+int PreferredTable::Delete(const char *src, int srcLen) {
+    int slot;
+
+    if (src == NULL ||
+        srcLen <= 0) {
+        return 1;
+    }
+    slot = FindSlot(src, srcLen, GetHashValue(src, srcLen));
+    if (slot < 0) {
+        return 0;
+    }
+    if (attached) {
+        if (Rehash(slotMask + 1)) {
+            return 1;
+        }
+        slot = FindSlot(src, srcLen, GetHashValue(src, srcLen));
+    }
+    // deleted entries keep their arena until next rehash
+    Entry &entry = entries[slots[slot]];
+    digest -= GetWordDigest(&arena[entry.srcOffset], entry.srcLen, &arena[entry.dstOffset], entry.dstLen);
+    entry.srcLen = 0;
+    slots[slot] = DELETED;
+    liveCount--;
+
+    return 0;
+}
+
+int PreferredTable::Find(const char **dst, int *dstLen, const char *src, int srcLen) {
+    int slot;
+
+    if (dst == NULL ||
+        dstLen == NULL ||
+        src == NULL ||
+        srcLen <= 0) {
+        return 1;
+    }
+    slot = FindSlot(src, srcLen, GetHashValue(src, srcLen));
+    if (slot < 0) {
+        return 1;
+    }
+    const Entry &entry = entries[slots[slot]];
+    *dst = &arena[entry.dstOffset];
+    *dstLen = entry.dstLen;
+
+    return 0;
+}
+
+int PreferredTable::GetNext(int *position, const char **src, int *srcLen, const char **dst, int *dstLen) {
+    if (position == NULL ||
+        src == NULL ||
+        srcLen == NULL ||
+        dst == NULL ||
+        dstLen == NULL) {
+        return 1;
+    }
+    while (*position < entryCount && entries[*position].srcLen == 0) {
+        (*position)++;
+    }
+    if (*position >= entryCount) {
+        return -1;
+    }
+    const Entry &entry = entries[*position];
+    *src = &arena[entry.srcOffset];
+    *srcLen = entry.srcLen;
+    *dst = &arena[entry.dstOffset];
+    *dstLen = entry.dstLen;
+    (*position)++;
+
+    return 0;
+}
+
+void PreferredTable::Clear() {
+    if (!attached) {
+        free(arena);
+        free(entries);
+        free(slots);
+    }
+    attached = 0;
+    arena = NULL;
+    arenaSize = 0;
+    arenaUsed = 0;
+    entries = NULL;
+    entryCount = 0;
+    entryCapacity = 0;
+    liveCount = 0;
+    slots = NULL;
+    slotMask = -1;
+    slotUsed = 0;
+    digest = 0;
+}
+
+void PreferredTable::GetImage(Image *image) {
+    image->slots = slots;
+    image->slotCount = slotMask + 1;
+    image->entries = entries;
+    image->entryCount = entryCount;
+    image->liveCount = liveCount;
+    image->arena = arena;
+    image->arenaSize = arenaUsed;
+}
+
+void PreferredTable::Attach(const Image *image) {
+    Clear();
+    if (image->slotCount < 1) {
+        return;
+    }
+    attached = 1;
+    slots = (int *)image->slots;
+    slotMask = image->slotCount - 1;
+    entries = (Entry *)image->entries;
+    entryCount = image->entryCount;
+    entryCapacity = image->entryCount;
+    liveCount = image->liveCount;
+    slotUsed = image->entryCount;
+    arena = (char *)image->arena;
+    arenaSize = image->arenaSize;
+    arenaUsed = image->arenaSize;
+    for (int i = 0; i < entryCount; i++) {
+        if (entries[i].srcLen != 0) {
+            digest += GetWordDigest(&arena[entries[i].srcOffset], entries[i].srcLen, &arena[entries[i].dstOffset], entries[i].dstLen);
+        }
+    }
+}
+
+int PreferredTable::Validate(const Image *image) {
+    int empty = 0;
+    int live = 0;
+    int end = 0;
+    int i;
+
+    if (image->slotCount < 1) {
+        return 0;
+    }
+    // live entries are contiguous in registration order, Rehash copies them by liveCount and arena size
+    for (i = 0; i < image->entryCount; i++) {
+        const Entry &entry = image->entries[i];
+        if (entry.srcLen == 0) {
+            continue;
+        }
+        if (entry.srcOffset < end || entry.srcLen < 0 || entry.srcLen > image->arenaSize - entry.srcOffset ||
+            entry.dstOffset != entry.srcOffset + entry.srcLen ||
+            entry.dstLen <= 0 || entry.dstLen >= image->arenaSize - entry.dstOffset ||
+            image->arena[entry.dstOffset + entry.dstLen] != '\0') {
+            return 1;
+        }
+        end = entry.dstOffset + entry.dstLen + 1;
+        live++;
+    }
+    if (live != image->liveCount) {
+        return 1;
+    }
+    // probing stops at empty slot
+    for (i = 0; i < image->slotCount; i++) {
+        if (image->slots[i] == EMPTY) {
+            empty++;
+        } else if (image->slots[i] != DELETED && (image->slots[i] < 0 || image->slots[i] >= image->entryCount)) {
+            return 1;
+        }
+    }
+    if (empty == 0 || image->liveCount >= image->slotCount) {
+        return 1;
+    }
+
+    return 0;
+}
+
+DictionarySnapshot::DictionarySnapshot() {
+    refCount = 1;
+    preferredDictionary = new PreferredTable();
+    filterDictionary = new FilterMatcher();
+    preferredExtensionRatio = 2;
+    filterExtensionRatio = 2;
+    version = 0;
+    mapping = NULL;
+}
+
+DictionarySnapshot::~DictionarySnapshot() {
+    // tables must be released before unmap, snapshots sharing attached table share mapping too
+    preferredDictionary->Unref();
+    filterDictionary->Unref();
+    if (mapping && __sync_sub_and_fetch(&mapping->refCount, 1) == 0) {
+        munmap(mapping->data, mapping->size);
+        delete mapping;
+    }
+}
+
+void DictionarySnapshot::Ref() {
+    __sync_add_and_fetch(&refCount, 1);
+}
+
+void DictionarySnapshot::Unref() {
+    if (__sync_sub_and_fetch(&refCount, 1) == 0) {
+        delete this;
+    }
+}
+
+int DictionarySnapshot::Copy(DictionarySnapshot **snapshot) {
+    DictionarySnapshot *newSnapshot;
+
+    // tables and mapping are shared until CopyTable
+    newSnapshot = new DictionarySnapshot();
+    newSnapshot->preferredExtensionRatio = preferredExtensionRatio;
+    newSnapshot->filterExtensionRatio = filterExtensionRatio;
+    if (mapping) {
+        __sync_add_and_fetch(&mapping->refCount, 1);
+        newSnapshot->mapping = mapping;
+    }
+    newSnapshot->preferredDictionary->Unref();
+    preferredDictionary->Ref();
+    newSnapshot->preferredDictionary = preferredDictionary;
+    newSnapshot->filterDictionary->Unref();
+    filterDictionary->Ref();
+    newSnapshot->filterDictionary = filterDictionary;
+    *snapshot = newSnapshot;
+
+    return 0;
+}
+
+int DictionarySnapshot::CopyTable(int dictType) {
+    PreferredTable *newPreferred;
+    FilterMatcher *newFilter;
+    FilterMatcher::Image filterImage;
+    int position;
+    int result;
+    const char *dicSrc;
+    int dicSrcLen;
+    const char *dicDst;
+    int dicDstLen;
+
+    // words are copied in registration order
+    position = 0;
+    if (dictType == Dictionary::PREFERRED) {
+        newPreferred = new PreferredTable();
+        while ((result = preferredDictionary->GetNext(&position, &dicSrc, &dicSrcLen, &dicDst, &dicDstLen)) != -1) {
+            if (result || newPreferred->Insert(dicSrc, dicSrcLen, dicDst, dicDstLen)) {
+                newPreferred->Unref();
+                return 1;
+            }
+        }
+        preferredDictionary->Unref();
+        preferredDictionary = newPreferred;
+    } else {
+        newFilter = new FilterMatcher();
+        filterDictionary->GetImage(&filterImage);
+        newFilter->SetFoldFlags(filterImage.foldFlags);
+        while ((result = filterDictionary->GetNext(&position, &dicSrc, &dicSrcLen, &dicDst, &dicDstLen)) != -1) {
+            if (result || newFilter->Insert(dicSrc, dicSrcLen, dicDst, dicDstLen)) {
+                newFilter->Unref();
+                return 1;
+            }
+        }
+        filterDictionary->Unref();
+        filterDictionary = newFilter;
+    }
+
+    return 0;
+}
+
+int DictionarySnapshot::InsertWordPair(const char *src, int srcLen, const char *dst, int dstLen, int dictType) {
+    char *key = NULL;
+    int keyCapacity = 0;
+    int keyLen;
+    int error = 0;
+
+    if (src == NULL ||
+        srcLen <= 0 ||
+        dst == NULL ||
+        dstLen <= 0 ||
+        (dictType != Dictionary::PREFERRED && dictType != Dictionary::FILTER)) {
+        return 1;
+    }
+    // keys are folded like input text, full width and half width words are one word
+    if (TextNormalizer::Normalize(&key, &keyCapacity, &keyLen, src, srcLen, TextNormalizer::WIDTH)) {
+        return 1;
+    }
+    if (dictType == Dictionary::PREFERRED) {
+        if (preferredDictionary->Insert(key, keyLen, dst, dstLen)) {
+            error = 1;
+        } else if (dstLen / keyLen > preferredExtensionRatio) {
+            preferredExtensionRatio = (dstLen / keyLen) + 1;
+        }
+    } else if (dictType == Dictionary::FILTER) {
+        if (filterDictionary->Insert(key, keyLen, dst, dstLen)) {
+            error = 1;
+        } else if (dstLen / keyLen > filterExtensionRatio) {
+            filterExtensionRatio = (dstLen / keyLen) + 1;
+        }
+    }
+    free(key);
+
+    return error;
+}
+
+int DictionarySnapshot::GetDstWord(const char *src, int srcLen, const char **dst, int *dstLen) {
+    if (src == NULL ||
+        srcLen <= 0 ||
+        dst == NULL ||
+        dstLen == NULL) {
+        return 1;
+    }
+
+    return preferredDictionary->Find(dst, dstLen, src, srcLen);
+}
+
+int DictionarySnapshot::GetFilterMatcher(FilterMatcher **matcher) {
+    if (matcher == NULL) {
+        return 1;
+    }
+    *matcher = filterDictionary;
+
+    return 0;
+}
+
+int DictionarySnapshot::GetExtensionRatio(int *ratio, int dictType) {
+    if (dictType != Dictionary::PREFERRED && dictType != Dictionary::FILTER) {
+        return 1;
+    }
+    if (dictType == Dictionary::PREFERRED) {
+        *ratio = preferredExtensionRatio;
+    } else if (dictType == Dictionary::FILTER) {
+        *ratio = filterExtensionRatio;
+    }
+
+    return 0;
+}
+
+unsigned long long DictionarySnapshot::GetVersion() {
+    return version;
+}
+
+void DictionarySnapshot::UpdateVersion() {
+    unsigned long long hash = 14695981039346656037ULL;
+
+    // tables keep their digests up to date, so changed word does not rehash others
+    hash = (hash ^ preferredDictionary->GetDigest()) * 1099511628211ULL;
+    hash = (hash ^ (unsigned int)Dictionary::PREFERRED) * 1099511628211ULL;
+    hash = (hash ^ filterDictionary->GetDigest()) * 1099511628211ULL;
+    hash = (hash ^ (unsigned int)Dictionary::FILTER) * 1099511628211ULL;
+    version = hash;
+}
+
+Dictionary::Dictionary() {
+    preferredDictionaryPath = NULL;
+    filterDictionaryPath = NULL;
+    compiledDictionaryPath = NULL;
+    kanaFolding = 0;
+    current = new DictionarySnapshot();
+    current->UpdateVersion();
+    working = NULL;
+    workingTables = 0;
+    changed = 0;
+    publishCallback = NULL;
+    publishData = NULL;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_mutex_init(&writeMutex, NULL);
+}
+
+Dictionary::~Dictionary() {
+    current->Unref();
+    if (working) {
+        working->Unref();
+    }
+    free(preferredDictionaryPath);
+    free(filterDictionaryPath);
+    free(compiledDictionaryPath);
+    pthread_mutex_destroy(&mutex);
+    pthread_mutex_destroy(&writeMutex);
+}
+
+int Dictionary::Acquire(DictionarySnapshot **snapshot) {
+    if (snapshot == NULL) {
+        return 1;
+    }
+    // first reader after changes publishes them, words added in bulk are published once
+    if (changed) {
+        pthread_mutex_lock(&writeMutex);
+        PublishWorking();
+        pthread_mutex_unlock(&writeMutex);
+    }
+    pthread_mutex_lock(&mutex);
+    current->Ref();
+    *snapshot = current;
+    pthread_mutex_unlock(&mutex);
+
+    return 0;
+}
+
+void Dictionary::Publish(DictionarySnapshot *snapshot) {
+    DictionarySnapshot *oldSnapshot;
+
+    // old snapshot is freed by last user
+    snapshot->UpdateVersion();
+    pthread_mutex_lock(&mutex);
+    oldSnapshot = current;
+    current = snapshot;
+    pthread_mutex_unlock(&mutex);
+    oldSnapshot->Unref();
+    // writeMutex is held, so callbacks of two publishes never interleave
+    if (publishCallback) {
+        publishCallback(publishData, snapshot->GetVersion());
+    }
+}
+
+void Dictionary::SetPublishCallback(PublishCallback callback, void *data) {
+    pthread_mutex_lock(&writeMutex);
+    publishCallback = callback;
+    publishData = data;
+    if (publishCallback) {
+        publishCallback(publishData, current->GetVersion());
+    }
+    pthread_mutex_unlock(&writeMutex);
+}
+
+int Dictionary::PrepareWorking(int dictType) {
+    // tables are copied once per publish, not once per word
+    if (working == NULL) {
+        if (current->Copy(&working)) {
+            return 1;
+        }
+        workingTables = 0;
+    }
+    if (!(workingTables & dictType)) {
+        if (working->CopyTable(dictType)) {
+            return 1;
+        }
+        workingTables |= dictType;
+    }
+
+    return 0;
+}
+
+void Dictionary::PublishWorking() {
+    if (!changed) {
+        return;
+    }
+    // automaton is built once for all changed filter words
+    if ((workingTables & FILTER) && working->filterDictionary->Build()) {
+        return;
+    }
+    Publish(working);
+    working = NULL;
+    workingTables = 0;
+    changed = 0;
+}
+
+void Dictionary::DropWorking() {
+    if (working) {
+        working->Unref();
+    }
+    working = NULL;
+    workingTables = 0;
+    changed = 0;
+}
+
+int Dictionary::CopyPaths(char **preferredPath, char **filterPath, char **compiledPath) {
+    int error = 0;
+
+    pthread_mutex_lock(&mutex);
+    *preferredPath = strdup(preferredDictionaryPath ? preferredDictionaryPath : "./voicemaker_preferred.dict");
+    *filterPath = strdup(filterDictionaryPath ? filterDictionaryPath : "./voicemaker_filter.dict");
+    *compiledPath = compiledDictionaryPath ? strdup(compiledDictionaryPath) : NULL;
+    if (*preferredPath == NULL || *filterPath == NULL || (compiledDictionaryPath && *compiledPath == NULL)) {
+        error = 1;
+    }
+    pthread_mutex_unlock(&mutex);
+    if (error) {
+        free(*preferredPath);
+        free(*filterPath);
+        free(*compiledPath);
+    }
+
+    return error;
+}
+
+int Dictionary::LoadDictionary() {
+    int error;
+    DictionarySnapshot *snapshot;
+    char *preferredPath;
+    char *filterPath;
+    char *compiledPath;
+    int foldFlags;
+
+    if (CopyPaths(&preferredPath, &filterPath, &compiledPath)) {
+        return 1;
+    }
+    pthread_mutex_lock(&mutex);
+    foldFlags = kanaFolding ? TextNormalizer::KANA : 0;
+    pthread_mutex_unlock(&mutex);
+    // conversions keep using current snapshot while loading
+    snapshot = new DictionarySnapshot();
+    if (compiledPath) {
+        error = LoadCompiledDictionary(snapshot, compiledPath);
+    } else {
+        error = LoadTextDictionary(snapshot, preferredPath, filterPath, foldFlags);
+    }
+    free(preferredPath);
+    free(filterPath);
+    free(compiledPath);
+    if (error) {
+        snapshot->Unref();
+        return error;
+    }
+    // words added since last publish are replaced by loaded ones
+    pthread_mutex_lock(&writeMutex);
+    DropWorking();
+    Publish(snapshot);
+    pthread_mutex_unlock(&writeMutex);
+
+    return 0;
+}
+
+int Dictionary::LoadTextDictionary(DictionarySnapshot *snapshot, const char *preferredPath, const char *filterPath, int foldFlags) {
+    int error = 0;
+    FILE *fp;
+    char line[(WORD_MAX_LENGTH * 2) + 2];
+    int dictTypes[] = { PREFERRED, FILTER };
+    int i;
+
+    for (i = 0; i < sizeof(dictTypes)/sizeof(dictTypes[0]) && !error; i++) {
+        if (dictTypes[i] == PREFERRED) {
+            fp = fopen(preferredPath, "r");
+        } else if (dictTypes[i] == FILTER) {
+            fp = fopen(filterPath, "r");
+        }
+        if (fp == NULL) {
+            return 2;
+        }
+        while(fgets(line, sizeof(line), fp)) {
+            char *srcStartPtr = NULL;
+            char *dstStartPtr = NULL;
+            char *endPtr = NULL;
+            if (*line == '\0') {
+                continue;
+            }
+            srcStartPtr = line;
+            dstStartPtr = strchr(line, ' ');
+            if (!dstStartPtr) {
+                continue;
+            }
+            *dstStartPtr = '\0';
+            dstStartPtr++;
+            endPtr = strchr(dstStartPtr, '\n');
+            if (endPtr) {
+                *endPtr = '\0';
+            }
+            if (*srcStartPtr == '\0' || *dstStartPtr == '\0') {
+                continue;
+            }
+            if (snapshot->InsertWordPair(srcStartPtr, strlen(srcStartPtr), dstStartPtr, strlen(dstStartPtr), dictTypes[i])) {
+                error = 3;
+            }
+        }
+        fclose(fp);
+    }
+    snapshot->filterDictionary->SetFoldFlags(foldFlags);
+    if (snapshot->filterDictionary->Build()) {
+        error = 3;
+    }
+
+    return error;
+}
+
+int Dictionary::LoadCompiledDictionary(DictionarySnapshot *snapshot, const char *compiledPath) {
+    struct stat st;
+    int fd;
+    void *data;
+    const char *base;
+    const CompiledHeader *header;
+    PreferredTable::Image preferredImage;
+    FilterMatcher::Image filterImage;
+
+    if ((fd = open(compiledPath, O_RDONLY)) < 0) {
+        return 2;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CompiledHeader)) {
+        close(fd);
+        return 4;
+    }
+    // shared mapping, every process uses same page cache
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 2;
+    }
+    base = (const char *)data;
+    header = (const CompiledHeader *)data;
+    if (memcmp(header->magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC)) != 0 ||
+        header->version != COMPILED_VERSION ||
+        header->byteOrder != COMPILED_BYTE_ORDER ||
+        header->fileSize != st.st_size ||
+        // empty preferred table has no slots, sign is checked before power of two
+        header->preferredSlotCount < 0 ||
+        (header->preferredSlotCount & (header->preferredSlotCount - 1)) != 0 ||
+        header->preferredLiveCount < 0 ||
+        header->preferredLiveCount > header->preferredEntryCount ||
+        header->filterNodeCount < 1 ||
+        (header->filterFoldFlags & ~(TextNormalizer::CASE | TextNormalizer::KANA)) != 0 ||
+        !IsValidSection(header, header->preferredSlotOffset, header->preferredSlotCount, sizeof(int)) ||
+        !IsValidSection(header, header->preferredEntryOffset, header->preferredEntryCount, sizeof(PreferredTable::Entry)) ||
+        !IsValidSection(header, header->preferredArenaOffset, header->preferredArenaSize, 1) ||
+        !IsValidSection(header, header->filterWordOffset, header->filterWordCount, sizeof(FilterMatcher::Word)) ||
+        !IsValidSection(header, header->filterArenaOffset, header->filterArenaSize, 1) ||
+        !IsValidSection(header, header->filterPatternOffset, header->filterPatternCount, sizeof(FilterMatcher::Pattern)) ||
+        !IsValidSection(header, header->filterRootNextOffset, 256, sizeof(int)) ||
+        !IsValidSection(header, header->filterEdgeStartOffset, header->filterNodeCount + 1, sizeof(int)) ||
+        !IsValidSection(header, header->filterFailOffset, header->filterNodeCount, sizeof(int)) ||
+        !IsValidSection(header, header->filterOutputOffset, header->filterNodeCount, sizeof(int)) ||
+        !IsValidSection(header, header->filterOutputLinkOffset, header->filterNodeCount, sizeof(int)) ||
+        !IsValidSection(header, header->filterEdgeLabelOffset, header->filterEdgeCount, 1) ||
+        !IsValidSection(header, header->filterEdgeNextOffset, header->filterEdgeCount, sizeof(int))) {
+        munmap(data, (size_t)st.st_size);
+        return 4;
+    }
+
+    preferredImage.slots = (const int *)(base + header->preferredSlotOffset);
+    preferredImage.slotCount = header->preferredSlotCount;
+    preferredImage.entries = (const PreferredTable::Entry *)(base + header->preferredEntryOffset);
+    preferredImage.entryCount = header->preferredEntryCount;
+    preferredImage.liveCount = header->preferredLiveCount;
+    preferredImage.arena = base + header->preferredArenaOffset;
+    preferredImage.arenaSize = header->preferredArenaSize;
+
+    filterImage.words = (const FilterMatcher::Word *)(base + header->filterWordOffset);
+    filterImage.wordCount = header->filterWordCount;
+    filterImage.arena = base + header->filterArenaOffset;
+    filterImage.arenaSize = header->filterArenaSize;
+    filterImage.patterns = (const FilterMatcher::Pattern *)(base + header->filterPatternOffset);
+    filterImage.patternCount = header->filterPatternCount;
+    filterImage.rootNext = (const int *)(base + header->filterRootNextOffset);
+    filterImage.edgeStart = (const int *)(base + header->filterEdgeStartOffset);
+    filterImage.fail = (const int *)(base + header->filterFailOffset);
+    filterImage.output = (const int *)(base + header->filterOutputOffset);
+    filterImage.outputLink = (const int *)(base + header->filterOutputLinkOffset);
+    filterImage.nodeCount = header->filterNodeCount;
+    filterImage.edgeLabel = (const unsigned char *)(base + header->filterEdgeLabelOffset);
+    filterImage.edgeNext = (const int *)(base + header->filterEdgeNextOffset);
+    filterImage.edgeCount = header->filterEdgeCount;
+    filterImage.foldFlags = header->filterFoldFlags;
+
+    // offsets and indices are checked here once, lookups trust them
+    if (PreferredTable::Validate(&preferredImage) || FilterMatcher::Validate(&filterImage)) {
+        munmap(data, (size_t)st.st_size);
+        return 4;
+    }
+    snapshot->mapping = new DictionarySnapshot::Mapping();
+    snapshot->mapping->refCount = 1;
+    snapshot->mapping->data = data;
+    snapshot->mapping->size = (size_t)st.st_size;
+    snapshot->preferredExtensionRatio = header->preferredExtensionRatio;
+    snapshot->filterExtensionRatio = header->filterExtensionRatio;
+    snapshot->preferredDictionary->Attach(&preferredImage);
+    snapshot->filterDictionary->Attach(&filterImage);
+
+    return 0;
+}
+
+int Dictionary::SaveDictionary() {
+    int error;
+    DictionarySnapshot *snapshot;
+    char *preferredPath;
+    char *filterPath;
+    char *compiledPath;
+
+    if (CopyPaths(&preferredPath, &filterPath, &compiledPath)) {
+        return 1;
+    }
+    Acquire(&snapshot);
+    if (compiledPath) {
+        error = SaveCompiledDictionary(snapshot, compiledPath);
+    } else {
+        error = SaveTextDictionary(snapshot, preferredPath, filterPath);
+    }
+    snapshot->Unref();
+    free(preferredPath);
+    free(filterPath);
+    free(compiledPath);
+
+    return error;
+}
+
+int Dictionary::SaveTextDictionary(DictionarySnapshot *snapshot, const char *preferredPath, const char *filterPath) {
+    int error = 0;
+    FILE *fp;
+    int position;
+    int result;
+    const char *dicSrc;
+    int dicSrcLen;
+    const char *dicDst;
+    int dicDstLen;
+
+    // preferred dictionary
+    fp = fopen(preferredPath, "w+");
+    if (fp == NULL) {
+        return 1;
+    }
+    position = 0;
+    while ((result = snapshot->preferredDictionary->GetNext(&position, &dicSrc, &dicSrcLen, &dicDst, &dicDstLen)) != -1) {
+        if (result) {
+            error = 2;
+            break;
+        }
+        fwrite(dicSrc, (size_t)dicSrcLen, 1, fp);
+        fwrite(" ", 1, 1, fp);
+        fwrite(dicDst,(size_t) dicDstLen, 1, fp);
+        fwrite("\n", 1, 1, fp);
+    }
+    fclose(fp);
+
+    // filter dictionary
+    fp = fopen(filterPath, "w+");
+    if (fp == NULL) {
+        return 1;
+    }
+    position = 0;
+    while ((result = snapshot->filterDictionary->GetNext(&position, &dicSrc, &dicSrcLen, &dicDst, &dicDstLen)) != -1) {
+        if (result) {
+            error = 2;
+            break;
+        }
+        fwrite(dicSrc, (size_t)dicSrcLen, 1, fp);
+        fwrite(" ", 1, 1, fp);
+        fwrite(dicDst,(size_t) dicDstLen, 1, fp);
+        fwrite("\n", 1, 1, fp);
+    }
+    fclose(fp);
+
+    return error;
+}
+
+int Dictionary::SaveCompiledDictionary(const char *path) {
+    int error;
+    DictionarySnapshot *snapshot;
+
+    Acquire(&snapshot);
+    error = SaveCompiledDictionary(snapshot, path);
+    snapshot->Unref();
+
+    return error;
+}
+
+int Dictionary::SaveCompiledDictionary(DictionarySnapshot *snapshot, const char *path) {
+    CompiledHeader header;
+    PreferredTable::Image preferredImage;
+    FilterMatcher::Image filterImage;
+    char *tmpPath;
+    FILE *fp;
+    int offset;
+    int i;
+    static const char padding[8] = { 0 };
+
+    if (path == NULL) {
+        return 1;
+    }
+    snapshot->preferredDictionary->GetImage(&preferredImage);
+    snapshot->filterDictionary->GetImage(&filterImage);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC));
+    header.version = COMPILED_VERSION;
+    header.byteOrder = COMPILED_BYTE_ORDER;
+    header.preferredExtensionRatio = snapshot->preferredExtensionRatio;
+    header.filterExtensionRatio = snapshot->filterExtensionRatio;
+    header.preferredSlotCount = preferredImage.slotCount;
+    header.preferredEntryCount = preferredImage.entryCount;
+    header.preferredLiveCount = preferredImage.liveCount;
+    header.preferredArenaSize = preferredImage.arenaSize;
+    header.filterWordCount = filterImage.wordCount;
+    header.filterArenaSize = filterImage.arenaSize;
+    header.filterPatternCount = filterImage.patternCount;
+    header.filterNodeCount = filterImage.nodeCount;
+    header.filterEdgeCount = filterImage.edgeCount;
+    header.filterFoldFlags = filterImage.foldFlags;
+    CompiledSection sections[] = {
+        { preferredImage.slots, preferredImage.slotCount * (int)sizeof(int), &header.preferredSlotOffset },
+        { preferredImage.entries, preferredImage.entryCount * (int)sizeof(PreferredTable::Entry), &header.preferredEntryOffset },
+        { preferredImage.arena, preferredImage.arenaSize, &header.preferredArenaOffset },
+        { filterImage.words, filterImage.wordCount * (int)sizeof(FilterMatcher::Word), &header.filterWordOffset },
+        { filterImage.arena, filterImage.arenaSize, &header.filterArenaOffset },
+        { filterImage.patterns, filterImage.patternCount * (int)sizeof(FilterMatcher::Pattern), &header.filterPatternOffset },
+        { filterImage.rootNext, 256 * (int)sizeof(int), &header.filterRootNextOffset },
+        { filterImage.edgeStart, (filterImage.nodeCount + 1) * (int)sizeof(int), &header.filterEdgeStartOffset },
+        { filterImage.fail, filterImage.nodeCount * (int)sizeof(int), &header.filterFailOffset },
+        { filterImage.output, filterImage.nodeCount * (int)sizeof(int), &header.filterOutputOffset },
+        { filterImage.outputLink, filterImage.nodeCount * (int)sizeof(int), &header.filterOutputLinkOffset },
+        { filterImage.edgeLabel, filterImage.edgeCount, &header.filterEdgeLabelOffset },
+        { filterImage.edgeNext, filterImage.edgeCount * (int)sizeof(int), &header.filterEdgeNextOffset },
+    };
+    offset = AlignSection(sizeof(header));
+    for (i = 0; i < (int)(sizeof(sections) / sizeof(sections[0])); i++) {
+        *sections[i].offset = offset;
+        offset = AlignSection(offset + sections[i].size);
+    }
+    header.fileSize = offset;
+
+    // replace by rename, processes mapping old dictionary are not affected
+    tmpPath = (char *)malloc(strlen(path) + 32);
+    if (tmpPath == NULL) {
+        return 3;
+    }
+    sprintf(tmpPath, "%s.%d.tmp", path, (int)getpid());
+    fp = fopen(tmpPath, "w");
+    if (fp == NULL) {
+        free(tmpPath);
+        return 1;
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(padding, AlignSection(sizeof(header)) - sizeof(header), 1, fp);
+    for (i = 0; i < (int)(sizeof(sections) / sizeof(sections[0])); i++) {
+        if (sections[i].size > 0) {
+            fwrite(sections[i].data, sections[i].size, 1, fp);
+        }
+        fwrite(padding, AlignSection(sections[i].size) - sections[i].size, 1, fp);
+    }
+    if (ferror(fp) || fclose(fp) != 0 || rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
+        free(tmpPath);
+        return 3;
+    }
+    free(tmpPath);
+
+    return 0;
+}
+
+int Dictionary::SetDictionaryPath(const char* preferredDictionaryPath, const char* filterDictionaryPath) {
+    if (preferredDictionaryPath == NULL ||
+        filterDictionaryPath == NULL) {
+        return 1;
+    }
+    pthread_mutex_lock(&mutex);
+    free(this->preferredDictionaryPath);
+    this->preferredDictionaryPath = strdup(preferredDictionaryPath);
+    if (this->preferredDictionaryPath == NULL) {
+        pthread_mutex_unlock(&mutex);
+        return 2;
+    }
+    free(this->filterDictionaryPath);
+    this->filterDictionaryPath = strdup(filterDictionaryPath);
+    if (this->filterDictionaryPath == NULL) {
+        pthread_mutex_unlock(&mutex);
+        return 3;
+    }
+    free(compiledDictionaryPath);
+    compiledDictionaryPath = NULL;
+    pthread_mutex_unlock(&mutex);
+
+    return 0;
+}
+
+int Dictionary::SetCompiledDictionaryPath(const char* compiledDictionaryPath) {
+    if (compiledDictionaryPath == NULL) {
+        return 1;
+    }
+    pthread_mutex_lock(&mutex);
+    free(this->compiledDictionaryPath);
+    this->compiledDictionaryPath = strdup(compiledDictionaryPath);
+    if (this->compiledDictionaryPath == NULL) {
+        pthread_mutex_unlock(&mutex);
+        return 2;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return 0;
+}
+
+void Dictionary::SetKanaFolding(int kanaFolding) {
+    pthread_mutex_lock(&mutex);
+    this->kanaFolding = kanaFolding;
+    pthread_mutex_unlock(&mutex);
+}
+
+int Dictionary::AddWordPair(const char *src, int srcLen, const char *dst, int dstLen, int dictType) {
+    if (src == NULL ||
+        srcLen <= 0 ||
+        dst == NULL ||
+        dstLen <= 0 ||
+        (dictType != PREFERRED && dictType != FILTER)) {
+        return 1;
+    }
+    // working snapshot is changed in place, published snapshot is never changed
+    pthread_mutex_lock(&writeMutex);
+    if (PrepareWorking(dictType) ||
+        working->InsertWordPair(src, srcLen, dst, dstLen, dictType)) {
+        pthread_mutex_unlock(&writeMutex);
+        return 1;
+    }
+    changed = 1;
+    pthread_mutex_unlock(&writeMutex);
+
+    return 0;
+}
+
+int Dictionary::DelWordPair(const char *src, int srcLen, int dictType) {
+    char *key = NULL;
+    int keyCapacity = 0;
+    int keyLen;
+    int result = 0;
+
+    if (src == NULL ||
+        srcLen <= 0 ||
+        (dictType != PREFERRED && dictType != FILTER)) {
+        return 1;
+    }
+    // same key as inserted word
+    if (TextNormalizer::Normalize(&key, &keyCapacity, &keyLen, src, srcLen, TextNormalizer::WIDTH)) {
+        return 1;
+    }
+    pthread_mutex_lock(&writeMutex);
+    if (PrepareWorking(dictType)) {
+        result = 1;
+    } else if (dictType == PREFERRED) {
+        result = working->preferredDictionary->Delete(key, keyLen);
+    } else if (dictType == FILTER) {
+        result = working->filterDictionary->Delete(key, keyLen);
+    }
+    if (result == 0) {
+        changed = 1;
+    }
+    pthread_mutex_unlock(&writeMutex);
+    free(key);
+
+    return result ? 1 : 0;
+}
+
+} // namespace voicemaker
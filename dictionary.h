@@ -0,0 +1,269 @@
+#ifndef VOICEMAKER_DICTIONARY_H
+#define VOICEMAKER_DICTIONARY_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <vector>
+
+namespace voicemaker {
+
+class FilterMatcher {
+public:
+    struct Word {
+        int srcOffset;
+        int srcLen;
+        int dstOffset;
+        int dstLen;
+    };
+    struct Pattern {
+        int srcLen;
+        int dstOffset;
+        int dstLen;
+    };
+    // arrays of words and automaton, may point into compiled dictionary
+    struct Image {
+        const Word *words;
+        int wordCount;
+        const char *arena;
+        int arenaSize;
+        const Pattern *patterns;
+        int patternCount;
+        const int *rootNext;
+        const int *edgeStart;
+        const int *fail;
+        const int *output;
+        const int *outputLink;
+        int nodeCount;
+        const unsigned char *edgeLabel;
+        const int *edgeNext;
+        int edgeCount;
+        // TextNormalizer flags of words and text
+        int foldFlags;
+    };
+    struct Match {
+        int start;
+        int pattern;
+    };
+    // work vectors of Replace, kept by caller to reuse their memory
+    struct ReplaceBuffer {
+        std::vector<Match> matches;
+        std::vector<int> chosen;
+        std::vector<char> used;
+        // position in replaced text of each byte and end of text, empty if nothing replaced
+        std::vector<int> offsets;
+    };
+
+    // words are kept in registration order, call Build after changing words
+    int Insert(const char *src, int srcLen, const char *dst, int dstLen);
+    int Delete(const char *src, int srcLen);
+    void Clear();
+    // case is always folded, call Build after changing flags
+    void SetFoldFlags(int flags);
+    int Build();
+    // iterate in registration order, returns -1 at end
+    int GetNext(int *position, const char **src, int *srcLen, const char **dst, int *dstLen);
+    // replacedText is grown by realloc to fit, free with free
+    int Replace(char **replacedText, int *replacedTextCapacity, const char *text, int textLength, ReplaceBuffer *replaceBuffer);
+    void GetImage(Image *image);
+    // image must be alive until Clear or next change
+    void Attach(const Image *image);
+    // returns 1 if offsets or node indices of image are out of range, checked once before Attach
+    static int Validate(const Image *image);
+    // digest of words in registration order and folding, updated by Build and Attach
+    unsigned long long GetDigest();
+    // shared by snapshots until one of them changes words
+    void Ref();
+    void Unref();
+
+    FilterMatcher();
+    ~FilterMatcher();
+private:
+    std::vector<Word> wordStorage;
+    std::vector<char> arenaStorage;
+    std::vector<Pattern> patternStorage;
+    std::vector<int> rootNextStorage;
+    std::vector<int> edgeStartStorage;
+    std::vector<int> failStorage;
+    std::vector<int> outputStorage;
+    std::vector<int> outputLinkStorage;
+    std::vector<unsigned char> edgeLabelStorage;
+    std::vector<int> edgeNextStorage;
+    // index of pattern is priority, first registered word wins
+    Image image;
+    int attached;
+    int refCount;
+    unsigned long long digest;
+
+    static bool CompareMatch(const Match &a, const Match &b);
+    int Next(int node, unsigned char c);
+    void Detach();
+    void UpdateImage();
+    void UpdateDigest();
+};
+
+class PreferredTable {
+public:
+    struct Entry {
+        unsigned int hash;
+        int srcOffset;
+        int srcLen;
+        int dstOffset;
+        int dstLen;
+    };
+    // arrays of table, may point into compiled dictionary
+    struct Image {
+        const int *slots;
+        int slotCount;
+        const Entry *entries;
+        int entryCount;
+        int liveCount;
+        const char *arena;
+        int arenaSize;
+    };
+
+    // first registered word wins, returns 0 when key already exists
+    int Insert(const char *src, int srcLen, const char *dst, int dstLen);
+    int Delete(const char *src, int srcLen);
+    // dst points into table until next modification
+    int Find(const char **dst, int *dstLen, const char *src, int srcLen);
+    // iterate in registration order, returns -1 at end
+    int GetNext(int *position, const char **src, int *srcLen, const char **dst, int *dstLen);
+    void Clear();
+    void GetImage(Image *image);
+    // image must be alive until Clear or next change
+    void Attach(const Image *image);
+    // returns 1 if offsets or entry indices of image are out of range, checked once before Attach
+    static int Validate(const Image *image);
+    // sum of digests of live words, order of words does not change lookups
+    unsigned long long GetDigest();
+    // shared by snapshots until one of them changes words
+    void Ref();
+    void Unref();
+
+    PreferredTable();
+    ~PreferredTable();
+private:
+    const static int EMPTY = -1;
+    const static int DELETED = -2;
+    // keys and readings are stored contiguously in arena
+    char *arena;
+    int arenaSize;
+    int arenaUsed;
+    Entry *entries;
+    int entryCount;
+    int entryCapacity;
+    int liveCount;
+    // open addressing with linear probing, value is index of entries
+    int *slots;
+    int slotMask;
+    int slotUsed;
+    // arrays are not owned when attached
+    int attached;
+    int refCount;
+    unsigned long long digest;
+
+    static unsigned int GetHashValue(const char *key, int keyLen);
+    int FindSlot(const char *src, int srcLen, unsigned int hash);
+    int Rehash(int newSlotCount);
+};
+
+// immutable after published, released by Unref
+class DictionarySnapshot {
+public:
+    // preferred dictionary only
+    int GetDstWord(const char *src, int srcLen, const char **dst, int *dstLen);
+    // filter dictionary only
+    int GetFilterMatcher(FilterMatcher **matcher);
+    // preferred dictionary or filter dictionary
+    int GetExtensionRatio(int *ratio, int dictType);
+    // digest of words and folding, same words give same version
+    unsigned long long GetVersion();
+    void Ref();
+    void Unref();
+
+private:
+    friend class Dictionary;
+    int refCount;
+    PreferredTable *preferredDictionary;
+    FilterMatcher *filterDictionary;
+    int preferredExtensionRatio;
+    int filterExtensionRatio;
+    unsigned long long version;
+    // tables may point into mapped compiled dictionary, unmapped by last snapshot sharing it
+    struct Mapping {
+        int refCount;
+        void *data;
+        size_t size;
+    };
+    Mapping *mapping;
+
+    DictionarySnapshot();
+    ~DictionarySnapshot();
+    // tables are shared with copy
+    int Copy(DictionarySnapshot **snapshot);
+    // shared table of dictType is replaced by own copy
+    int CopyTable(int dictType);
+    int InsertWordPair(const char *src, int srcLen, const char *dst, int dstLen, int dictType);
+    void UpdateVersion();
+};
+
+class Dictionary  {
+public:
+    const static int PREFERRED = 1;
+    const static int FILTER = 2;
+    const static int WORD_MAX_LENGTH = 512;
+    int SetDictionaryPath(const char *preferredDictionaryPath, const char *filterDictionary);
+    int SetCompiledDictionaryPath(const char *compiledDictionaryPath);
+    // builds new snapshot and publishes it, current snapshot is kept on error
+    int LoadDictionary();
+    int SaveDictionary();
+    int SaveCompiledDictionary(const char *path);
+    // preferred dictionary or filter dictionary
+    int AddWordPair(const char *src, int srcLen, const char *dst, int dstLen, int dictType);
+    // preferred dictionary or filter dictionary
+    int DelWordPair(const char *src, int srcLen, int dictType);
+    // hiragana and katakana of filter words are same from next load
+    void SetKanaFolding(int kanaFolding);
+    // current snapshot, release with DictionarySnapshot::Unref, words changed since last call are published here
+    int Acquire(DictionarySnapshot **snapshot);
+    // called in publish order with version of each published snapshot, on thread which publishes it
+    typedef void (*PublishCallback)(void *data, unsigned long long version);
+    // callback is called with current version at once
+    void SetPublishCallback(PublishCallback callback, void *data);
+
+    Dictionary();
+    ~Dictionary();
+private:
+    char *preferredDictionaryPath;
+    char *filterDictionaryPath;
+    char *compiledDictionaryPath;
+    int kanaFolding;
+    DictionarySnapshot *current;
+    // changed in place by AddWordPair and DelWordPair until published, guarded by writeMutex
+    DictionarySnapshot *working;
+    // tables of working not shared with current, PREFERRED and FILTER bits
+    int workingTables;
+    // working has unpublished changes, read by Acquire without lock
+    volatile int changed;
+    PublishCallback publishCallback;
+    void *publishData;
+    // guards paths, kanaFolding and current, held only to copy them
+    pthread_mutex_t mutex;
+    // serializes builders of snapshot
+    pthread_mutex_t writeMutex;
+
+    void Publish(DictionarySnapshot *snapshot);
+    // called with writeMutex
+    int PrepareWorking(int dictType);
+    void PublishWorking();
+    void DropWorking();
+    int CopyPaths(char **preferredPath, char **filterPath, char **compiledPath);
+    int LoadTextDictionary(DictionarySnapshot *snapshot, const char *preferredPath, const char *filterPath, int foldFlags);
+    int LoadCompiledDictionary(DictionarySnapshot *snapshot, const char *compiledPath);
+    int SaveTextDictionary(DictionarySnapshot *snapshot, const char *preferredPath, const char *filterPath);
+    int SaveCompiledDictionary(DictionarySnapshot *snapshot, const char *path);
+};
+
+} // namespace voicemaker
+
+#endif
@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include "normalizer.h"
+
+namespace voicemaker {
+
+namespace {
+
+// half width katakana from U+FF61, voiced sound marks are combining marks
+const unsigned short halfwidthKana[] = {
+    0x3002, 0x300c, 0x300d, 0x3001, 0x30fb, 0x30f2, 0x30a1, 0x30a3,
+    0x30a5, 0x30a7, 0x30a9, 0x30e3, 0x30e5, 0x30e7, 0x30c3, 0x30fc,
+    0x30a2, 0x30a4, 0x30a6, 0x30a8, 0x30aa, 0x30ab, 0x30ad, 0x30af,
+    0x30b1, 0x30b3, 0x30b5, 0x30b7, 0x30b9, 0x30bb, 0x30bd, 0x30bf,
+    0x30c1, 0x30c4, 0x30c6, 0x30c8, 0x30ca, 0x30cb, 0x30cc, 0x30cd,
+    0x30ce, 0x30cf, 0x30d2, 0x30d5, 0x30d8, 0x30db, 0x30de, 0x30df,
+    0x30e0, 0x30e1, 0x30e2, 0x30e4, 0x30e6, 0x30e8, 0x30e9, 0x30ea,
+    0x30eb, 0x30ec, 0x30ed, 0x30ef, 0x30f3, 0x3099, 0x309a
+};
+
+// full width signs from U+FFE0
+const unsigned short fullwidthSigns[] = {
+    0x00a2, 0x00a3, 0x00ac, 0x00af, 0x00a6, 0x00a5, 0x20a9
+};
+
+// ranges moved by delta, length of utf-8 is same in and out
+const struct {
+    unsigned int first;
+    unsigned int last;
+    unsigned int delta;
+    int flag;
+} foldRanges[] = {
+    { 0x0041, 0x005a, 0x20, TextNormalizer::CASE },
+    { 0x00c0, 0x00d6, 0x20, TextNormalizer::CASE },
+    { 0x00d8, 0x00de, 0x20, TextNormalizer::CASE },
+    { 0x0391, 0x03a1, 0x20, TextNormalizer::CASE },
+    { 0x03a3, 0x03a9, 0x20, TextNormalizer::CASE },
+    { 0x0400, 0x040f, 0x50, TextNormalizer::CASE },
+    { 0x0410, 0x042f, 0x20, TextNormalizer::CASE },
+    { 0xff21, 0xff3a, 0x20, TextNormalizer::CASE },
+    { 0x3041, 0x3096, 0x60, TextNormalizer::KANA },
+    { 0x309d, 0x309e, 0x60, TextNormalizer::KANA },
+    { 0, 0, 0, 0 }
+};
+
+// flags which may fold character starting with byte
+int GetLeadFlags(unsigned char c) {
+    switch (c) {
+    case 0xc3:
+    case 0xce:
+    case 0xd0:
+        return TextNormalizer::CASE;
+    case 0xe3:
+        return TextNormalizer::KANA;
+    case 0xef:
+        return TextNormalizer::WIDTH | TextNormalizer::CASE;
+    default:
+        return (c >= 'A' && c <= 'Z') ? TextNormalizer::CASE : 0;
+    }
+}
+
+} // namespace
+
+int TextNormalizer::Decode(unsigned int *codePoint, const unsigned char *text, int textLength) {
+    int length;
+    int i;
+
+    if (textLength <= 0) {
+        return 0;
+    }
+    if (text[0] < 0x80) {
+        *codePoint = text[0];
+        return 1;
+    } else if (text[0] >= 0xc2 && text[0] < 0xe0) {
+        *codePoint = text[0] & 0x1f;
+        length = 2;
+    } else if (text[0] >= 0xe0 && text[0] < 0xf0) {
+        *codePoint = text[0] & 0x0f;
+        length = 3;
+    } else if (text[0] >= 0xf0 && text[0] < 0xf5) {
+        *codePoint = text[0] & 0x07;
+        length = 4;
+    } else {
+        return 0;
+    }
+    if (textLength < length) {
+        return 0;
+    }
+    for (i = 1; i < length; i++) {
+        if ((text[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        *codePoint = (*codePoint << 6) | (text[i] & 0x3f);
+    }
+
+    return length;
+}
+
+int TextNormalizer::Encode(char *out, unsigned int codePoint) {
+    if (codePoint < 0x80) {
+        out[0] = codePoint;
+        return 1;
+    } else if (codePoint < 0x800) {
+        out[0] = 0xc0 | (codePoint >> 6);
+        out[1] = 0x80 | (codePoint & 0x3f);
+        return 2;
+    }
+    out[0] = 0xe0 | (codePoint >> 12);
+    out[1] = 0x80 | ((codePoint >> 6) & 0x3f);
+    out[2] = 0x80 | (codePoint & 0x3f);
+
+    return 3;
+}
+
+unsigned int TextNormalizer::FoldWidth(unsigned int codePoint) {
+    if (codePoint >= 0xff01 && codePoint <= 0xff5e) {
+        return codePoint - 0xfee0;
+    } else if (codePoint >= 0xff61 && codePoint <= 0xff9f) {
+        return halfwidthKana[codePoint - 0xff61];
+    } else if (codePoint >= 0xffe0 && codePoint <= 0xffe6) {
+        return fullwidthSigns[codePoint - 0xffe0];
+    }
+
+    return codePoint;
+}
+
+unsigned int TextNormalizer::FoldRange(unsigned int codePoint, int flags) {
+    int i;
+
+    for (i = 0; foldRanges[i].flag; i++) {
+        if ((foldRanges[i].flag & flags) &&
+            codePoint >= foldRanges[i].first &&
+            codePoint <= foldRanges[i].last) {
+            return codePoint + foldRanges[i].delta;
+        }
+    }
+
+    return codePoint;
+}
+
+unsigned int TextNormalizer::Compose(unsigned int codePoint, unsigned int mark) {
+    int handakuten = (codePoint >= 0x30cf && codePoint <= 0x30db && (codePoint - 0x30cf) % 3 == 0);
+
+    // ka to chi, tsu, te, to, ha to ho, u, wa and wo
+    if (mark == 0xff9e) {
+        if ((codePoint >= 0x30ab && codePoint <= 0x30c1 && (codePoint - 0x30ab) % 2 == 0) ||
+            codePoint == 0x30c4 || codePoint == 0x30c6 || codePoint == 0x30c8 || handakuten) {
+            return codePoint + 1;
+        } else if (codePoint == 0x30a6) {
+            return 0x30f4;
+        } else if (codePoint == 0x30ef || codePoint == 0x30f2) {
+            return codePoint + 8;
+        }
+    } else if (mark == 0xff9f && handakuten) {
+        return codePoint + 2;
+    }
+
+    return codePoint;
+}
+
+int TextNormalizer::Fold(char *out, int *outLen, const char *text, int textLength, int flags) {
+    const unsigned char *ptr = (const unsigned char *)text;
+    unsigned int codePoint;
+    unsigned int folded;
+    unsigned int mark;
+    int length;
+    int markLength;
+
+    // most characters are passed by first byte
+    if (textLength <= 0 || !(GetLeadFlags(*ptr) & flags)) {
+        return 0;
+    }
+    if (*ptr < 0x80) {
+        *out = *ptr + ('a' - 'A');
+        *outLen = 1;
+        return 1;
+    }
+    if ((length = Decode(&codePoint, ptr, textLength)) == 0) {
+        return 0;
+    }
+    folded = codePoint;
+    if (flags & WIDTH) {
+        folded = FoldWidth(codePoint);
+        // voiced sound mark after half width katakana is joined to it
+        if (codePoint >= 0xff66 && codePoint <= 0xff9d &&
+            (markLength = Decode(&mark, ptr + length, textLength - length)) > 0 &&
+            Compose(folded, mark) != folded) {
+            folded = Compose(folded, mark);
+            length += markLength;
+        }
+    }
+    folded = FoldRange(folded, flags);
+    if (folded == codePoint) {
+        return 0;
+    }
+    *outLen = Encode(out, folded);
+
+    return length;
+}
+
+int TextNormalizer::Normalize(char **out, int *outCapacity, int *outLen, const char *text, int textLength, int flags) {
+    char *newText;
+    char *newTextPtr;
+    int foldedLen;
+    int length;
+    int i;
+
+    // folded text is never longer than text
+    if (*outCapacity < textLength + 1) {
+        newText = (char *)realloc(*out, textLength + 1);
+        if (newText == NULL) {
+            return 1;
+        }
+        *out = newText;
+        *outCapacity = textLength + 1;
+    }
+    newTextPtr = *out;
+    for (i = 0; i < textLength;) {
+        if ((length = Fold(newTextPtr, &foldedLen, &text[i], textLength - i, flags)) > 0) {
+            newTextPtr += foldedLen;
+            i += length;
+        } else {
+            *newTextPtr++ = text[i++];
+        }
+    }
+    *newTextPtr = '\0';
+    *outLen = newTextPtr - *out;
+
+    return 0;
+}
+
+} // namespace voicemaker
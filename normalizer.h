@@ -0,0 +1,35 @@
+#ifndef VOICEMAKER_NORMALIZER_H
+#define VOICEMAKER_NORMALIZER_H
+
+namespace voicemaker {
+
+// folding of utf-8 characters by tables, independent of node
+class TextNormalizer {
+public:
+    // full width ascii and signs and half width katakana to their NFKC forms
+    // full width space is kept, it is read as pause
+    const static int WIDTH = 1;
+    // upper case of latin, greek and cyrillic to lower case
+    const static int CASE = 2;
+    // hiragana to katakana
+    const static int KANA = 4;
+    // bytes written by Fold at most
+    const static int MAX_FOLDED = 4;
+
+    // character at text is written to out, returns bytes read from text, 0 if not folded
+    // CASE and KANA keep length of bytes, WIDTH never makes text longer
+    static int Fold(char *out, int *outLen, const char *text, int textLength, int flags);
+    // out is grown by realloc, free with free, outLen excludes terminator
+    static int Normalize(char **out, int *outCapacity, int *outLen, const char *text, int textLength, int flags);
+
+private:
+    static int Decode(unsigned int *codePoint, const unsigned char *text, int textLength);
+    static int Encode(char *out, unsigned int codePoint);
+    static unsigned int FoldWidth(unsigned int codePoint);
+    static unsigned int FoldRange(unsigned int codePoint, int flags);
+    static unsigned int Compose(unsigned int codePoint, unsigned int mark);
+};
+
+} // namespace voicemaker
+
+#endif
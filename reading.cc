@@ -0,0 +1,794 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "stats.h"
+#include "normalizer.h"
+#include "textscan.h"
+#include "reading.h"
+
+using namespace std;
+
+namespace voicemaker {
+
+static const char base64char[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// units written after placeholders, read as counters by mecab
+// nen, gatsu, nichi
+static const char *const dateUnits[] = { "\xe5\xb9\xb4", "\xe6\x9c\x88", "\xe6\x97\xa5" };
+// ji, fun, byou
+static const char *const timeUnits[] = { "\xe6\x99\x82", "\xe5\x88\x86", "\xe7\xa7\x92" };
+
+// symbols written before amount are read after it
+static const struct {
+    const char *symbol;
+    int symbolLen;
+    const char *unit;
+} currencies[] = {
+    // $ and full width, doru
+    { "$", 1, "\xe3\x83\x89\xe3\x83\xab" },
+    { "\xef\xbc\x84", 3, "\xe3\x83\x89\xe3\x83\xab" },
+    // yen sign and full width, en
+    { "\xc2\xa5", 2, "\xe5\x86\x86" },
+    { "\xef\xbf\xa5", 3, "\xe5\x86\x86" },
+    // euro sign, yu-ro
+    { "\xe2\x82\xac", 3, "\xe3\x83\xa6\xe3\x83\xbc\xe3\x83\xad" },
+    // pound sign, pondo
+    { "\xc2\xa3", 2, "\xe3\x83\x9d\xe3\x83\xb3\xe3\x83\x89" },
+    { NULL, 0, NULL }
+};
+
+int ReadingConverter::Grow(char **buffer, int *capacity, int size) {
+    char *newBuffer;
+    int newCapacity;
+
+    if (size <= *capacity) {
+        return 0;
+    }
+    // doubled to keep growth of text written piece by piece linear
+    newCapacity = *capacity * 2 > size ? *capacity * 2 : size;
+    newBuffer = (char *)realloc(*buffer, newCapacity);
+    if (newBuffer == NULL) {
+        return 1;
+    }
+    *buffer = newBuffer;
+    *capacity = newCapacity;
+
+    return 0;
+}
+
+int ReadingConverter::GrowAt(char **buffer, int *capacity, char **ptr, int size) {
+    int used = *ptr - *buffer;
+
+    if (Grow(buffer, capacity, used + size)) {
+        return 1;
+    }
+    *ptr = *buffer + used;
+
+    return 0;
+}
+
+int ReadingConverter::Preprocess(const char **preText, int *preTextLen, char **buffer, int *bufferCapacity, const char *text, int textLength) {
+    TextScanner::State state;
+    unsigned long long stops;
+    unsigned long long rest;
+    char *newText = NULL;
+    char folded[TextNormalizer::MAX_FOLDED];
+    const char *unit;
+    int unitLen;
+    int newTextLen = 0;
+    int prevAlpha = 0;
+    char prev = '\0';
+    int blockLen;
+    int block;
+    int next;
+    int length;
+    int i = 0;
+    int j;
+
+    // separates alphabet from other words for mecab
+    TextScanner::Begin(&state);
+    for (block = 0; block < textLength; block += TextScanner::BLOCK) {
+        blockLen = (textLength - block < TextScanner::BLOCK) ? textLength - block : TextScanner::BLOCK;
+        if (TextScanner::Scan(&stops, &state, &text[block], blockLen)) {
+            return 2;
+        }
+        if (newText == NULL) {
+            // text is passed through until first letter or full width form
+            if (stops == 0) {
+                continue;
+            }
+            if (Grow(buffer, bufferCapacity, textLength * 2 + 1)) {
+                return 1;
+            }
+            newText = *buffer;
+            memcpy(newText, text, block);
+            newTextLen = block;
+            prev = (block > 0) ? text[block - 1] : '\0';
+            i = block;
+        }
+        while (i < block + blockLen) {
+            rest = stops >> (i - block);
+            if (!(rest & 1) && prevAlpha == TextScanner::IsLetter(text[i])) {
+                // nothing is inserted or folded until next stop
+                next = rest ? i + TextScanner::LowestBit(rest) : block + blockLen;
+                memcpy(&newText[newTextLen], &text[i], next - i);
+                newTextLen += next - i;
+                i = next;
+                prev = text[i - 1];
+                continue;
+            }
+            // full width forms and half width katakana are folded in same pass
+            if ((length = TextNormalizer::Fold(folded, &unitLen, &text[i], textLength - i, TextNormalizer::WIDTH)) > 0) {
+                unit = folded;
+            } else {
+                unit = &text[i];
+                unitLen = 1;
+                length = 1;
+            }
+            for (j = 0; j < unitLen; j++) {
+                if (TextScanner::IsLetter(unit[j])) {
+                    if (newTextLen > 0 && prev != ' ' && !prevAlpha) {
+                        newText[newTextLen++] = ',';
+                    }
+                    newText[newTextLen++] = unit[j];
+                    prevAlpha = 1;
+                } else {
+                    if (unit[j] != ' ' && prevAlpha) {
+                        newText[newTextLen++] = ',';
+                    }
+                    newText[newTextLen++] = unit[j];
+                    prevAlpha = 0;
+                }
+                prev = unit[j];
+            }
+            i += length;
+        }
+    }
+    if (TextScanner::End(&state)) {
+        return 2;
+    }
+    if (newText == NULL) {
+        *preText = text;
+        *preTextLen = textLength;
+        return 0;
+    }
+    newText[newTextLen] = '\0';
+    *preText = newText;
+    *preTextLen = newTextLen;
+
+    return 0;
+}
+
+TokenStream::TokenStream() {
+    readings = NULL;
+    readingsLen = 0;
+    readingsCapacity = 0;
+    values = NULL;
+    valuesLen = 0;
+    valuesCapacity = 0;
+}
+
+TokenStream::~TokenStream() {
+    free(readings);
+    free(values);
+}
+
+void TokenStream::Clear() {
+    tokens.clear();
+    numbers.clear();
+    readingsLen = 0;
+    valuesLen = 0;
+}
+
+void TokenStream::Release() {
+    Clear();
+    vector<ReadingToken>().swap(tokens);
+    vector<ReadingToken>().swap(numbers);
+    free(readings);
+    readings = NULL;
+    readingsCapacity = 0;
+    free(values);
+    values = NULL;
+    valuesCapacity = 0;
+}
+
+int ReadingConverter::Append(char **buffer, int *capacity, int *length, const char *data, int dataLen) {
+    if (Grow(buffer, capacity, *length + dataLen)) {
+        return 1;
+    }
+    memcpy(*buffer + *length, data, dataLen);
+    *length += dataLen;
+
+    return 0;
+}
+
+int ReadingConverter::CountDigits(const char *ptr, const char *end) {
+    const char *start = ptr;
+
+    while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+        ptr++;
+    }
+
+    return ptr - start;
+}
+
+int ReadingConverter::ToInt(const char *ptr, int length) {
+    int value = 0;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        value = value * 10 + ptr[i] - '0';
+    }
+
+    return value;
+}
+
+const char *ReadingConverter::ScanDateTime(const char *ptr, const char *end, const char **parts, int *partLens, int *partCount, const char *const **units) {
+    const char *next;
+    char separator;
+    int count = 1;
+    int i;
+
+    // up to three fields joined by same separator
+    parts[0] = ptr;
+    partLens[0] = CountDigits(ptr, end);
+    next = ptr + partLens[0];
+    if (next + 1 >= end) {
+        return NULL;
+    }
+    separator = *next;
+    if (separator != '/' && separator != '-' && separator != ':') {
+        return NULL;
+    }
+    while (next + 1 < end && *next == separator && next[1] >= '0' && next[1] <= '9') {
+        if (count == 3) {
+            return NULL;
+        }
+        parts[count] = next + 1;
+        partLens[count] = CountDigits(parts[count], end);
+        next = parts[count] + partLens[count];
+        count++;
+    }
+    if (separator == ':') {
+        // h:mm and h:mm:ss
+        if (count < 2 || partLens[0] > 2 || ToInt(parts[0], partLens[0]) > 29) {
+            return NULL;
+        }
+        for (i = 1; i < count; i++) {
+            if (partLens[i] != 2 || ToInt(parts[i], 2) > 59) {
+                return NULL;
+            }
+        }
+        // zero minutes of o'clock are not read
+        if (count == 2 && ToInt(parts[1], 2) == 0) {
+            count = 1;
+        }
+        *units = timeUnits;
+    } else if (count == 3) {
+        // yyyy/m/d and yyyy-mm-dd, hyphens of phone numbers start with zero
+        if (partLens[0] != 4 || *parts[0] == '0' ||
+            partLens[1] > 2 || partLens[2] > 2 ||
+            (separator == '-' && (partLens[1] != 2 || partLens[2] != 2)) ||
+            ToInt(parts[1], partLens[1]) < 1 || ToInt(parts[1], partLens[1]) > 12 ||
+            ToInt(parts[2], partLens[2]) < 1 || ToInt(parts[2], partLens[2]) > 31) {
+            return NULL;
+        }
+        *units = dateUnits;
+    } else if (count == 2 && separator == '/') {
+        // m/d
+        if (partLens[0] > 2 || partLens[1] > 2 ||
+            ToInt(parts[0], partLens[0]) < 1 || ToInt(parts[0], partLens[0]) > 12 ||
+            ToInt(parts[1], partLens[1]) < 1 || ToInt(parts[1], partLens[1]) > 31) {
+            return NULL;
+        }
+        *units = dateUnits + 1;
+    } else {
+        return NULL;
+    }
+    *partCount = count;
+
+    return next;
+}
+
+const char *ReadingConverter::ScanAmount(const char *ptr, const char *end) {
+    int digits = CountDigits(ptr, end);
+
+    ptr += digits;
+    // phone numbers and addresses are read digit by digit
+    if (ptr + 1 < end && *ptr == '-' && ptr[1] >= '0' && ptr[1] <= '9') {
+        while (ptr + 1 < end && *ptr == '-' && ptr[1] >= '0' && ptr[1] <= '9') {
+            ptr += 1 + CountDigits(ptr + 1, end);
+        }
+        return ptr;
+    }
+    // groups of three digits
+    if (digits <= 3) {
+        while (ptr + 3 < end && *ptr == ',' && CountDigits(ptr + 1, end) == 3) {
+            ptr += 4;
+        }
+    }
+    // decimals and versions
+    while (ptr + 1 < end && *ptr == '.' && ptr[1] >= '0' && ptr[1] <= '9') {
+        ptr += 1 + CountDigits(ptr + 1, end);
+    }
+
+    return ptr;
+}
+
+int ReadingConverter::AddNumber(TokenStream *stream, const char *surface, int surfaceLen, int trimZero) {
+    ReadingToken token;
+    int i;
+
+    token.type = ReadingToken::NUMBER;
+    token.surface = surface;
+    token.surfaceLen = surfaceLen;
+    token.reading = 0;
+    token.readingLen = 0;
+    token.value = stream->valuesLen;
+    token.counter = -1;
+    if (Grow(&stream->values, &stream->valuesCapacity, stream->valuesLen + surfaceLen)) {
+        return 1;
+    }
+    // commas of groups are dropped
+    for (i = 0; i < surfaceLen; i++) {
+        if (surface[i] == ',' ||
+            (trimZero && surface[i] == '0' && stream->valuesLen == token.value && i + 1 < surfaceLen)) {
+            continue;
+        }
+        stream->values[stream->valuesLen++] = surface[i];
+    }
+    token.valueLen = stream->valuesLen - token.value;
+    stream->numbers.push_back(token);
+
+    return 0;
+}
+
+int ReadingConverter::ScanNumbers(char **taggerText, int *taggerTextCapacity, int *taggerTextLen, TokenStream *stream, const char *text, int textLength) {
+    const char *end = text + textLength;
+    const char *run = text;
+    const char *ptr = text;
+    char *newTextPtr;
+
+    if (stream == NULL) {
+        return 1;
+    }
+    stream->Clear();
+    if (Grow(taggerText, taggerTextCapacity, 1)) {
+        return 1;
+    }
+    newTextPtr = *taggerText;
+    // each byte is read once, fields are looked ahead at most once more
+    while (ptr < end) {
+        const char *parts[3];
+        int partLens[3];
+        int partCount = 0;
+        const char *const *units = NULL;
+        const char *currency = NULL;
+        const char *spanEnd;
+        int symbolLen = 0;
+        int i;
+
+        if (*ptr < '0' || *ptr > '9') {
+            ptr++;
+            continue;
+        }
+        if ((spanEnd = ScanDateTime(ptr, end, parts, partLens, &partCount, &units)) == NULL) {
+            spanEnd = ScanAmount(ptr, end);
+            parts[0] = ptr;
+            partLens[0] = spanEnd - ptr;
+            partCount = 1;
+            for (i = 0; currencies[i].symbol && !memchr(ptr, '-', partLens[0]); i++) {
+                symbolLen = currencies[i].symbolLen;
+                if (ptr - run >= symbolLen && memcmp(ptr - symbolLen, currencies[i].symbol, symbolLen) == 0) {
+                    currency = currencies[i].unit;
+                    break;
+                }
+                symbolLen = 0;
+            }
+        }
+        // placeholder and unit are at most 10 bytes
+        if (Reserve(taggerText, taggerTextCapacity, &newTextPtr, (ptr - run) + partCount * 10)) {
+            return 1;
+        }
+        memcpy(newTextPtr, run, (ptr - run) - symbolLen);
+        newTextPtr += (ptr - run) - symbolLen;
+        for (i = 0; i < partCount; i++) {
+            const char *unit = units ? units[i] : currency;
+            if (AddNumber(stream, parts[i], partLens[i], units != NULL)) {
+                return 1;
+            }
+            *newTextPtr++ = '0';
+            if (unit) {
+                memcpy(newTextPtr, unit, strlen(unit));
+                newTextPtr += strlen(unit);
+            }
+        }
+        ptr = run = spanEnd;
+    }
+    if (Reserve(taggerText, taggerTextCapacity, &newTextPtr, (end - run) + 1)) {
+        return 1;
+    }
+    memcpy(newTextPtr, run, end - run);
+    newTextPtr += end - run;
+    *newTextPtr++ = '\0';
+    *taggerTextLen = newTextPtr - *taggerText;
+
+    return 0;
+}
+
+int ReadingConverter::EndSegment(TokenStream *stream) {
+    // words on both sides of number are not matched by one filter word
+    if (stream->readingsLen == 0 || stream->readings[stream->readingsLen - 1] == '\0') {
+        return 0;
+    }
+
+    return Append(&stream->readings, &stream->readingsCapacity, &stream->readingsLen, "", 1);
+}
+
+int ReadingConverter::ReadWord(TokenStream *stream, const mecab_node_t *node, DictionarySnapshot *snapshot) {
+    ReadingToken token;
+    const char *startPtr = NULL;
+    const char *endPtr = NULL;
+    const char *currentPtr = node->feature;
+    const char *dst;
+    int dstLen;
+    int delimiter = 0;
+    int length = 0;
+
+    token.type = ReadingToken::WORD;
+    token.surface = node->surface;
+    token.surfaceLen = node->length;
+    token.reading = stream->readingsLen;
+    token.value = 0;
+    token.valueLen = 0;
+    token.counter = -1;
+    if (snapshot->GetDstWord(node->surface, node->length, &dst, &dstLen) == 0) {
+        startPtr = dst;
+        length = dstLen;
+    } else {
+        // pronunciation is 9th feature
+        while (*currentPtr != '\0') {
+            if (*currentPtr == ',') {
+                delimiter++;
+                if (delimiter == 8) {
+                    startPtr = currentPtr;
+                    startPtr++;
+                } else if (delimiter == 9) {
+                    endPtr = currentPtr;
+                    break;
+                }
+            }
+            currentPtr++;
+        }
+        if (!startPtr && !endPtr && delimiter < 7) {
+            // unknown word
+            startPtr = node->surface;
+            length = node->length;
+        } else if (startPtr && endPtr) {
+            if (*startPtr == '"' && *(endPtr - 1) == '"') {
+                startPtr += 1;
+                endPtr -= 1;
+            }
+            length = endPtr - startPtr;
+            if (length < 0) {
+                length = 0;
+            }
+        } else {
+            length = 0;
+        }
+    }
+    if (length > 0 && Append(&stream->readings, &stream->readingsCapacity, &stream->readingsLen, startPtr, length)) {
+        return 1;
+    }
+    token.readingLen = length;
+    stream->tokens.push_back(token);
+
+    return 0;
+}
+
+int ReadingConverter::LinkCounter(TokenStream *stream, int number) {
+    const ReadingToken &word = stream->tokens.back();
+
+    // word just after number is counter, ascii is not read as counter
+    if (word.readingLen == 0 || isascii(stream->readings[word.reading])) {
+        return 0;
+    }
+    stream->tokens[number].counter = stream->tokens.size() - 1;
+
+    return EndSegment(stream);
+}
+
+int ReadingConverter::ReadPlaceholders(TokenStream *stream, const mecab_node_t *node, int *nextNumber, int *number) {
+    const char *ptr = node->surface;
+    const char *end = node->surface + node->length;
+    int numberCount = stream->numbers.size();
+
+    while (ptr < end) {
+        ReadingToken token;
+        if (*ptr >= '0' && *ptr <= '9' && *nextNumber < numberCount) {
+            if (EndSegment(stream)) {
+                return 1;
+            }
+            *number = stream->tokens.size();
+            stream->tokens.push_back(stream->numbers[(*nextNumber)++]);
+            ptr++;
+            continue;
+        }
+        // text joined to placeholder by mecab is read as it is
+        token.type = ReadingToken::WORD;
+        token.surface = ptr;
+        while (ptr < end && !(*ptr >= '0' && *ptr <= '9' && *nextNumber < numberCount)) {
+            ptr++;
+        }
+        token.surfaceLen = ptr - token.surface;
+        token.reading = stream->readingsLen;
+        token.readingLen = token.surfaceLen;
+        token.value = 0;
+        token.valueLen = 0;
+        token.counter = -1;
+        if (Append(&stream->readings, &stream->readingsCapacity, &stream->readingsLen, token.surface, token.surfaceLen)) {
+            return 1;
+        }
+        stream->tokens.push_back(token);
+        if (*number >= 0 && LinkCounter(stream, *number)) {
+            return 1;
+        }
+        *number = -1;
+    }
+
+    return 0;
+}
+
+int ReadingConverter::ReadTokens(TokenStream *stream, const mecab_node_t *node, DictionarySnapshot *snapshot, TraceBuffer *trace) {
+    int number = -1;
+    int nextNumber = 0;
+    int nodeCount = 0;
+    int i;
+    unsigned long long nodeStart = trace && trace->IsEnabled() ? ConvertStats::Now() : 0;
+
+    if (stream == NULL) {
+        return 1;
+    }
+    // numbers of ScanNumbers are kept
+    stream->tokens.clear();
+    stream->readingsLen = 0;
+    for (; node; node = node->next) {
+        if (++nodeCount == NODE_BATCH && trace && trace->IsEnabled()) {
+            unsigned long long now = ConvertStats::Now();
+            trace->Add("mecab_nodes", nodeStart, now - nodeStart, nodeCount);
+            nodeStart = now;
+            nodeCount = 0;
+        }
+
+        // digits in sentence are placeholders of numbers
+        for (i = 0; i < node->length; i++) {
+            if (node->surface[i] >= '0' && node->surface[i] <= '9') {
+                break;
+            }
+        }
+        if (i < node->length) {
+            if (ReadPlaceholders(stream, node, &nextNumber, &number)) {
+                return 1;
+            }
+            continue;
+        }
+        if (ReadWord(stream, node, snapshot)) {
+            return 1;
+        }
+        if (number >= 0 && LinkCounter(stream, number)) {
+            return 1;
+        }
+        number = -1;
+    }
+    if (nodeCount && trace && trace->IsEnabled()) {
+        trace->Add("mecab_nodes", nodeStart, ConvertStats::Now() - nodeStart, nodeCount);
+    }
+
+    return 0;
+}
+
+int ReadingConverter::FilterTokens(TokenStream *stream, char **swapText, int *swapTextCapacity, DictionarySnapshot *snapshot, FilterMatcher::ReplaceBuffer *replaceBuffer) {
+    FilterMatcher *matcher;
+    char *swap;
+    int swapCapacity;
+    int hasText = 0;
+    int i;
+
+    if (stream == NULL ||
+        swapText == NULL ||
+        swapTextCapacity == NULL ||
+        replaceBuffer == NULL) {
+        return 1;
+    }
+    for (i = 0; i < (int)stream->tokens.size() && !hasText; i++) {
+        hasText = stream->tokens[i].type == ReadingToken::NUMBER || stream->tokens[i].readingLen > 0;
+    }
+    if (!hasText) {
+        return 2;
+    }
+    if (snapshot->GetFilterMatcher(&matcher)) {
+        return 3;
+    }
+    if (stream->readingsLen == 0) {
+        return 0;
+    }
+    if (matcher->Replace(swapText, swapTextCapacity, stream->readings, stream->readingsLen, replaceBuffer)) {
+        return 4;
+    }
+    // replaced word belongs to token of its first byte
+    if (!replaceBuffer->offsets.empty()) {
+        const vector<int> &offsets = replaceBuffer->offsets;
+        for (i = 0; i < (int)stream->tokens.size(); i++) {
+            ReadingToken &token = stream->tokens[i];
+            int end;
+            if (token.type != ReadingToken::WORD) {
+                continue;
+            }
+            end = offsets[token.reading + token.readingLen];
+            token.reading = offsets[token.reading];
+            token.readingLen = end - token.reading;
+        }
+        stream->readingsLen = offsets[stream->readingsLen];
+    }
+    swap = stream->readings;
+    stream->readings = *swapText;
+    *swapText = swap;
+    swapCapacity = stream->readingsCapacity;
+    stream->readingsCapacity = *swapTextCapacity;
+    *swapTextCapacity = swapCapacity;
+
+    return 0;
+}
+
+int ReadingConverter::WriteReading(char **readingText, int *readingTextCapacity, int *readingTextLen, const TokenStream *stream) {
+    char *newTextPtr;
+    int i;
+    int j;
+
+    if (readingText == NULL ||
+        readingTextCapacity == NULL ||
+        readingTextLen == NULL ||
+        stream == NULL) {
+        return 1;
+    }
+    if (Grow(readingText, readingTextCapacity, 1)) {
+        return 3;
+    }
+    newTextPtr = *readingText;
+    for (i = 0; i < (int)stream->tokens.size(); i++) {
+        const ReadingToken &token = stream->tokens[i];
+        const ReadingToken *counter = token.counter >= 0 ? &stream->tokens[token.counter] : NULL;
+        const char *value = &stream->values[token.value];
+        const char *counterReading = counter ? &stream->readings[counter->reading] : NULL;
+        int headZeroPadding = 1;
+        int numk = 1;
+
+        if (token.type == ReadingToken::WORD) {
+            if (Reserve(readingText, readingTextCapacity, &newTextPtr, token.readingLen)) {
+                return 3;
+            }
+            memcpy(newTextPtr, &stream->readings[token.reading], token.readingLen);
+            newTextPtr += token.readingLen;
+            continue;
+        }
+        // <NUMK VAL=value COUNTER=counter> or <NUM VAL=value>counter
+        if (Reserve(readingText, readingTextCapacity, &newTextPtr, sizeof("<NUMK VAL= COUNTER=>") + token.valueLen + (counter ? counter->readingLen : 0))) {
+            return 3;
+        }
+        for (j = 0; j < token.valueLen; j++) {
+            if (value[j] == '-') {
+                numk = 0;
+            }
+        }
+        if (numk) {
+            memcpy(newTextPtr, "<NUMK VAL=", sizeof("<NUMK VAL=") - 1);
+            newTextPtr += sizeof("<NUMK VAL=") - 1;
+        } else {
+            memcpy(newTextPtr, "<NUM VAL=", sizeof("<NUM VAL=") - 1);
+            newTextPtr += sizeof("<NUM VAL=") - 1;
+        }
+        // zeros at head are written as one zero
+        for (j = 0; j < token.valueLen; j++) {
+            if (value[j] != '0') {
+                headZeroPadding = 0;
+            }
+            if (headZeroPadding && j + 1 < token.valueLen && value[j + 1] == '0') {
+                continue;
+            }
+            *newTextPtr++ = value[j];
+        }
+        if (counter && numk) {
+            memcpy(newTextPtr, " COUNTER=", sizeof(" COUNTER=") - 1);
+            newTextPtr += sizeof(" COUNTER=") - 1;
+            for (j = 0; j < counter->readingLen; j++) {
+                if (!isascii(counterReading[j])) {
+                    *newTextPtr++ = counterReading[j];
+                }
+            }
+            *newTextPtr++ = '>';
+        } else {
+            *newTextPtr++ = '>';
+            if (counter) {
+                memcpy(newTextPtr, counterReading, counter->readingLen);
+                newTextPtr += counter->readingLen;
+            }
+        }
+        if (counter) {
+            i = token.counter;
+        }
+    }
+    if (newTextPtr == *readingText) {
+        return 2;
+    }
+    if (Reserve(readingText, readingTextCapacity, &newTextPtr, 1)) {
+        return 3;
+    }
+    *newTextPtr = '\0';
+    *readingTextLen = newTextPtr - *readingText;
+
+    return 0;
+}
+
+void ReadingConverter::DumpTokens(string *out, const TokenStream *stream) {
+    int i;
+
+    for (i = 0; i < (int)stream->tokens.size(); i++) {
+        const ReadingToken &token = stream->tokens[i];
+        if (token.type == ReadingToken::WORD && token.readingLen == 0) {
+            continue;
+        }
+        if (!out->empty()) {
+            out->push_back('|');
+        }
+        if (token.type == ReadingToken::NUMBER) {
+            out->push_back('#');
+            out->append(&stream->values[token.value], token.valueLen);
+        } else {
+            out->append(&stream->readings[token.reading], token.readingLen);
+        }
+    }
+}
+
+int ReadingConverter::Base64Encode(char **out, int *outLen, const unsigned char *in, int inSize) {
+    char *encoded;
+    const unsigned char *inp;
+    char *outp;
+    int inLen;
+
+    encoded = (char *)malloc(inSize * 4 / 3 + 4);
+    if (encoded == NULL) {
+            return 1;
+    }
+    outp = encoded;
+    inp = in;
+    inLen = inSize;
+
+    while (inLen >= 3) {
+        *outp++ = base64char[(inp[0] >> 2) & 0x3f];
+        *outp++ = base64char[((inp[0] & 0x03) << 4) | ((inp[1] >> 4) & 0x0f)];
+        *outp++ = base64char[((inp[1] & 0x0f) << 2) | ((inp[2] >> 6) & 0x03)];
+        *outp++ = base64char[inp[2] & 0x3f];
+        inp += 3;
+        inLen -= 3;
+    }
+    if (inLen > 0) {
+        *outp++ = base64char[(inp[0] >> 2) & 0x3f];
+        if (inLen == 1) {
+            *outp++ = base64char[(inp[0] & 0x03) << 4];
+            *outp++ = '=';
+        } else {
+            *outp++ = base64char[((inp[0] & 0x03) << 4) | ((inp[1] >> 4) & 0x0f)];
+            *outp++ = base64char[((inp[1] & 0x0f) << 2)];
+        }
+        *outp++ = '=';
+    }
+    *outp = '\0';
+    *out = encoded;
+    if (outLen) {
+        *outLen = outp - encoded;
+    }
+
+    return 0;
+}
+
+} // namespace voicemaker
@@ -0,0 +1,105 @@
+#ifndef VOICEMAKER_READING_H
+#define VOICEMAKER_READING_H
+
+#include <mecab.h>
+#include <string>
+#include <vector>
+#include "dictionary.h"
+#include "trace.h"
+
+namespace voicemaker {
+
+// word read from mecab nodes or number found before tagging
+struct ReadingToken {
+    const static int WORD = 0;
+    // found by ScanNumbers, placeholder in sentence of mecab
+    const static int NUMBER = 1;
+    int type;
+    // in sentence of mecab, valid until lattice is parsed again
+    // NUMBER is in text given to ScanNumbers
+    const char *surface;
+    int surfaceLen;
+    // offset in readings of stream, WORD only
+    int reading;
+    int readingLen;
+    // offset in values of stream, NUMBER only
+    int value;
+    int valueLen;
+    // index of word read as counter of NUMBER, -1 if none
+    int counter;
+};
+
+// tokens of a text, buffers are kept for next text
+class TokenStream {
+public:
+    std::vector<ReadingToken> tokens;
+    // numbers in order of placeholders, kept by ReadTokens
+    std::vector<ReadingToken> numbers;
+    // readings of words in order, '\0' ends text matched by filter at numbers
+    char *readings;
+    int readingsLen;
+    int readingsCapacity;
+    char *values;
+    int valuesLen;
+    int valuesCapacity;
+
+    void Clear();
+    // buffers are freed, Clear keeps them
+    void Release();
+
+    TokenStream();
+    ~TokenStream();
+};
+
+// stages of converting text to reading text, independent of node
+class ReadingConverter {
+public:
+    // mecab nodes of one trace event
+    const static int NODE_BATCH = 64;
+
+    // text buffers are grown by realloc and reused by caller, free with free
+    // preText is text itself if nothing is changed, or buffer ended by terminator not in preTextLen
+    // width of text is folded, returns 2 if text is not valid utf-8
+    static int Preprocess(const char **preText, int *preTextLen, char **buffer, int *bufferCapacity, const char *text, int textLength);
+    // numbers, dates, times and amounts of text are added to numbers of stream in one pass
+    // taggerText is text for mecab, each number is a placeholder digit followed by its unit
+    static int ScanNumbers(char **taggerText, int *taggerTextCapacity, int *taggerTextLen, TokenStream *stream, const char *text, int textLength);
+    // preferred words and readings of nodes, trace may be NULL
+    static int ReadTokens(TokenStream *stream, const mecab_node_t *node, DictionarySnapshot *snapshot, TraceBuffer *trace);
+    // readings of words are replaced by filter dictionary, swapText is work buffer
+    static int FilterTokens(TokenStream *stream, char **swapText, int *swapTextCapacity, DictionarySnapshot *snapshot, FilterMatcher::ReplaceBuffer *replaceBuffer);
+    // text for synthesizer, numbers are written as NUM and NUMK tags
+    static int WriteReading(char **readingText, int *readingTextCapacity, int *readingTextLen, const TokenStream *stream);
+    // words and #numbers separated by '|', for logs
+    static void DumpTokens(std::string *out, const TokenStream *stream);
+    static int Base64Encode(char **out, int *outLen, const unsigned char *in, int inSize);
+
+private:
+    // capacity of buffer to at least size
+    static int Grow(char **buffer, int *capacity, int size);
+    // room of size bytes after ptr, ptr is moved with buffer
+    static int Reserve(char **buffer, int *capacity, char **ptr, int size) {
+        // checked on every write of tokens, grown rarely
+        if (*ptr - *buffer + size <= *capacity) {
+            return 0;
+        }
+        return GrowAt(buffer, capacity, ptr, size);
+    }
+    static int GrowAt(char **buffer, int *capacity, char **ptr, int size);
+    static int Append(char **buffer, int *capacity, int *length, const char *data, int dataLen);
+    static int CountDigits(const char *ptr, const char *end);
+    static int ToInt(const char *ptr, int length);
+    // end of date or time at ptr, NULL if not matched
+    static const char *ScanDateTime(const char *ptr, const char *end, const char **parts, int *partLens, int *partCount, const char *const **units);
+    // end of number with groups, decimals or hyphens at ptr
+    static const char *ScanAmount(const char *ptr, const char *end);
+    static int AddNumber(TokenStream *stream, const char *surface, int surfaceLen, int trimZero);
+    static int ReadWord(TokenStream *stream, const mecab_node_t *node, DictionarySnapshot *snapshot);
+    static int ReadPlaceholders(TokenStream *stream, const mecab_node_t *node, int *nextNumber, int *number);
+    static int LinkCounter(TokenStream *stream, int number);
+    static int EndSegment(TokenStream *stream);
+};
+
+} // namespace voicemaker
+
+#endif
@@ -0,0 +1,456 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shared_cache.h"
+
+namespace voicemaker {
+
+namespace {
+
+const char SHARED_CACHE_MAGIC[8] = { 'V', 'M', 'C', 'A', 'C', 'H', 'E', '\0' };
+const int SHARED_CACHE_VERSION = 1;
+// smallest log of shard
+const size_t SHARED_CACHE_MIN_LOG_SIZE = 64 * 1024;
+
+size_t AlignSize(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+// layout of file: header, then shards of slots and log of records
+struct SharedCache::Header {
+    char magic[8];
+    int version;
+    int shardCount;
+    int slotCount;
+    int shardStructSize;
+    unsigned long long shardSize;
+    unsigned long long logSize;
+    unsigned long long fileSize;
+};
+
+struct SharedCache::Shard {
+    pthread_mutex_t mutex;
+    // bytes written to log since initialized, offset in log is modulo of log size
+    unsigned long long writePosition;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+};
+
+struct SharedCache::Slot {
+    unsigned long long hash;
+    unsigned long long position;
+    int recordSize;
+    int used;
+};
+
+// followed by text and wave
+struct SharedCache::Record {
+    unsigned long long hash;
+    unsigned long long phontId;
+    unsigned long long version;
+    int textLength;
+    int speed;
+    int waveLen;
+    int reserved;
+};
+
+SharedCache::SharedCache() {
+    data = NULL;
+    size = 0;
+    shardCount = 0;
+    slotCount = 0;
+    shardSize = 0;
+    logSize = 0;
+    pthread_rwlock_init(&lock, NULL);
+}
+
+SharedCache::~SharedCache() {
+    Unmap();
+    pthread_rwlock_destroy(&lock);
+}
+
+unsigned long long SharedCache::GetHashValue(const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version) {
+    unsigned long long hash = 14695981039346656037ULL;
+    int i;
+
+    // fnv-1a
+    for (i = 0; i < textLength; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
+    }
+    hash = (hash ^ (unsigned int)speed) * 1099511628211ULL;
+    hash = (hash ^ phontId) * 1099511628211ULL;
+    hash = (hash ^ version) * 1099511628211ULL;
+
+    return hash;
+}
+
+int SharedCache::GetLayout(size_t size, int *slotCount, size_t *shardSize, size_t *logSize) {
+    size_t headerSize = AlignSize(sizeof(Header), 64);
+    size_t slotsSize;
+    int count;
+
+    if (size < headerSize + SHARD_COUNT * (sizeof(Shard) + SHARED_CACHE_MIN_LOG_SIZE)) {
+        return 1;
+    }
+    *shardSize = ((size - headerSize) / SHARD_COUNT) & ~(size_t)63;
+    // one slot for each 8KB of log, waves are rarely smaller
+    count = (int)(*shardSize / 8192);
+    if (count < SLOT_WAYS * 16) {
+        count = SLOT_WAYS * 16;
+    }
+    count -= count % SLOT_WAYS;
+    slotsSize = AlignSize(sizeof(Shard), 8) + count * sizeof(Slot);
+    if (*shardSize < slotsSize + SHARED_CACHE_MIN_LOG_SIZE) {
+        return 1;
+    }
+    *slotCount = count;
+    *logSize = (*shardSize - slotsSize) & ~(size_t)7;
+
+    return 0;
+}
+
+SharedCache::Shard *SharedCache::GetShard(int index) {
+    return (Shard *)((char *)data + AlignSize(sizeof(Header), 64) + index * shardSize);
+}
+
+SharedCache::Slot *SharedCache::GetSlots(Shard *shard) {
+    return (Slot *)((char *)shard + AlignSize(sizeof(Shard), 8));
+}
+
+char *SharedCache::GetLog(Shard *shard) {
+    return (char *)(GetSlots(shard) + slotCount);
+}
+
+int SharedCache::LockShard(Shard *shard) {
+    int result;
+
+    result = pthread_mutex_lock(&shard->mutex);
+    if (result == EOWNERDEAD) {
+        // owner died while writing, slots may point to broken records
+        memset(GetSlots(shard), 0, slotCount * sizeof(Slot));
+        pthread_mutex_consistent(&shard->mutex);
+        return 0;
+    }
+
+    return result ? 1 : 0;
+}
+
+int SharedCache::Initialize() {
+    Header *header = (Header *)data;
+    pthread_mutexattr_t attr;
+    int i;
+
+    if (pthread_mutexattr_init(&attr) ||
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) ||
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST)) {
+        return 1;
+    }
+    for (i = 0; i < shardCount; i++) {
+        Shard *shard = GetShard(i);
+        memset(shard, 0, sizeof(Shard));
+        if (pthread_mutex_init(&shard->mutex, &attr)) {
+            pthread_mutexattr_destroy(&attr);
+            return 1;
+        }
+        memset(GetSlots(shard), 0, slotCount * sizeof(Slot));
+    }
+    pthread_mutexattr_destroy(&attr);
+    header->version = SHARED_CACHE_VERSION;
+    header->shardCount = shardCount;
+    header->slotCount = slotCount;
+    header->shardStructSize = sizeof(Shard);
+    header->shardSize = shardSize;
+    header->logSize = logSize;
+    header->fileSize = size;
+    // magic is written last, file without magic is initialized again
+    msync(data, size, MS_SYNC);
+    memcpy(header->magic, SHARED_CACHE_MAGIC, sizeof(header->magic));
+
+    return 0;
+}
+
+int SharedCache::IsValid() {
+    Header *header = (Header *)data;
+
+    if (size < sizeof(Header) ||
+        memcmp(header->magic, SHARED_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SHARED_CACHE_VERSION ||
+        header->shardCount != SHARD_COUNT ||
+        header->shardStructSize != (int)sizeof(Shard) ||
+        header->slotCount < SLOT_WAYS ||
+        header->slotCount % SLOT_WAYS != 0 ||
+        header->fileSize != size ||
+        header->logSize < SHARED_CACHE_MIN_LOG_SIZE ||
+        header->shardSize < AlignSize(sizeof(Shard), 8) + header->slotCount * sizeof(Slot) + header->logSize ||
+        (size - AlignSize(sizeof(Header), 64)) / SHARD_COUNT < header->shardSize) {
+        return 0;
+    }
+    shardCount = header->shardCount;
+    slotCount = header->slotCount;
+    shardSize = header->shardSize;
+    logSize = header->logSize;
+
+    return 1;
+}
+
+void SharedCache::Unmap() {
+    if (data) {
+        munmap(data, size);
+    }
+    data = NULL;
+    size = 0;
+}
+
+int SharedCache::Open(const char *path, size_t newSize) {
+    struct stat st;
+    int fd;
+    int result = 0;
+
+    if (path == NULL) {
+        return 1;
+    }
+    pthread_rwlock_wrlock(&lock);
+    Unmap();
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+        pthread_rwlock_unlock(&lock);
+        return 2;
+    }
+    // serializes initializers among processes
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0) {
+        close(fd);
+        pthread_rwlock_unlock(&lock);
+        return 3;
+    }
+    if (st.st_size > 0) {
+        // size of existing file wins, other processes may be using it
+        size = (size_t)st.st_size;
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+            result = 4;
+        } else if (!IsValid()) {
+            // initializer died before writing magic, nobody uses the file
+            if (size >= sizeof(Header) && memcmp(data, "\0\0\0\0\0\0\0\0", 8) == 0 && ftruncate(fd, 0) == 0) {
+                st.st_size = 0;
+            } else {
+                result = 5;
+            }
+            Unmap();
+        }
+    }
+    if (result == 0 && st.st_size == 0) {
+        shardCount = SHARD_COUNT;
+        if (GetLayout(newSize, &slotCount, &shardSize, &logSize)) {
+            result = 1;
+        } else if (ftruncate(fd, newSize) != 0) {
+            result = 3;
+        } else {
+            size = newSize;
+            data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                data = NULL;
+                result = 4;
+            } else if (Initialize()) {
+                Unmap();
+                ftruncate(fd, 0);
+                result = 6;
+            }
+        }
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    pthread_rwlock_unlock(&lock);
+
+    return result;
+}
+
+void SharedCache::Close() {
+    pthread_rwlock_wrlock(&lock);
+    Unmap();
+    pthread_rwlock_unlock(&lock);
+}
+
+int SharedCache::Get(unsigned char **wave, int *waveLen, const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version) {
+    unsigned long long hash;
+    Shard *shard;
+    Slot *slots;
+    Record *record;
+    unsigned char *newWave;
+    int bucket;
+    int i;
+
+    if (wave == NULL ||
+        waveLen == NULL ||
+        text == NULL) {
+        return 1;
+    }
+    hash = GetHashValue(text, textLength, speed, phontId, version);
+    pthread_rwlock_rdlock(&lock);
+    if (data == NULL) {
+        pthread_rwlock_unlock(&lock);
+        return 2;
+    }
+    shard = GetShard(hash % shardCount);
+    slots = GetSlots(shard);
+    bucket = (int)((hash / shardCount) % (slotCount / SLOT_WAYS)) * SLOT_WAYS;
+    if (LockShard(shard)) {
+        pthread_rwlock_unlock(&lock);
+        return 3;
+    }
+    for (i = bucket; i < bucket + SLOT_WAYS; i++) {
+        // record is valid until log is written over it
+        if (!slots[i].used ||
+            slots[i].hash != hash ||
+            shard->writePosition - slots[i].position > logSize ||
+            slots[i].recordSize < (int)sizeof(Record) ||
+            slots[i].position % logSize + slots[i].recordSize > logSize) {
+            continue;
+        }
+        record = (Record *)(GetLog(shard) + slots[i].position % logSize);
+        if (record->hash != hash ||
+            record->textLength != textLength ||
+            record->speed != speed ||
+            record->phontId != phontId ||
+            record->version != version ||
+            record->waveLen < 1 ||
+            sizeof(Record) + (size_t)textLength + record->waveLen > (size_t)slots[i].recordSize ||
+            memcmp((char *)(record + 1), text, textLength) != 0) {
+            continue;
+        }
+        newWave = (unsigned char *)malloc(record->waveLen);
+        if (newWave == NULL) {
+            pthread_mutex_unlock(&shard->mutex);
+            pthread_rwlock_unlock(&lock);
+            return 4;
+        }
+        memcpy(newWave, (char *)(record + 1) + textLength, record->waveLen);
+        *wave = newWave;
+        *waveLen = record->waveLen;
+        shard->hits++;
+        pthread_mutex_unlock(&shard->mutex);
+        pthread_rwlock_unlock(&lock);
+        return 0;
+    }
+    shard->misses++;
+    pthread_mutex_unlock(&shard->mutex);
+    pthread_rwlock_unlock(&lock);
+
+    return 2;
+}
+
+void SharedCache::Put(const unsigned char *wave, int waveLen, const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version) {
+    unsigned long long hash;
+    Shard *shard;
+    Slot *slots;
+    Slot *slot;
+    Record *record;
+    size_t recordSize;
+    size_t offset;
+    int bucket;
+    int i;
+
+    if (wave == NULL ||
+        waveLen < 1 ||
+        text == NULL ||
+        textLength < 0) {
+        return;
+    }
+    hash = GetHashValue(text, textLength, speed, phontId, version);
+    recordSize = AlignSize(sizeof(Record) + textLength + waveLen, 8);
+    pthread_rwlock_rdlock(&lock);
+    // too large record would evict most of shard
+    if (data == NULL || recordSize > logSize / 4) {
+        pthread_rwlock_unlock(&lock);
+        return;
+    }
+    shard = GetShard(hash % shardCount);
+    slots = GetSlots(shard);
+    bucket = (int)((hash / shardCount) % (slotCount / SLOT_WAYS)) * SLOT_WAYS;
+    if (LockShard(shard)) {
+        pthread_rwlock_unlock(&lock);
+        return;
+    }
+    // same key, then free slot, then oldest record
+    slot = NULL;
+    for (i = bucket; i < bucket + SLOT_WAYS; i++) {
+        if (slots[i].used && slots[i].hash == hash) {
+            slot = &slots[i];
+            break;
+        }
+    }
+    for (i = bucket; slot == NULL && i < bucket + SLOT_WAYS; i++) {
+        if (!slots[i].used || shard->writePosition - slots[i].position > logSize) {
+            slot = &slots[i];
+        }
+    }
+    if (slot == NULL) {
+        slot = &slots[bucket];
+        for (i = bucket + 1; i < bucket + SLOT_WAYS; i++) {
+            if (slots[i].position < slot->position) {
+                slot = &slots[i];
+            }
+        }
+        shard->evictions++;
+    }
+    // record is not wrapped around end of log
+    offset = shard->writePosition % logSize;
+    if (offset + recordSize > logSize) {
+        shard->writePosition += logSize - offset;
+        offset = 0;
+    }
+    record = (Record *)(GetLog(shard) + offset);
+    record->hash = hash;
+    record->phontId = phontId;
+    record->version = version;
+    record->textLength = textLength;
+    record->speed = speed;
+    record->waveLen = waveLen;
+    record->reserved = 0;
+    memcpy((char *)(record + 1), text, textLength);
+    memcpy((char *)(record + 1) + textLength, wave, waveLen);
+    slot->hash = hash;
+    slot->position = shard->writePosition;
+    slot->recordSize = (int)recordSize;
+    slot->used = 1;
+    shard->writePosition += recordSize;
+    pthread_mutex_unlock(&shard->mutex);
+    pthread_rwlock_unlock(&lock);
+}
+
+int SharedCache::GetStats(Stats *stats) {
+    int i;
+
+    pthread_rwlock_rdlock(&lock);
+    if (data == NULL) {
+        pthread_rwlock_unlock(&lock);
+        return 1;
+    }
+    stats->size = size;
+    stats->hits = 0;
+    stats->misses = 0;
+    stats->evictions = 0;
+    for (i = 0; i < shardCount; i++) {
+        Shard *shard = GetShard(i);
+        if (LockShard(shard)) {
+            continue;
+        }
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    pthread_rwlock_unlock(&lock);
+
+    return 0;
+}
+
+} // namespace voicemaker
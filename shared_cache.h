@@ -0,0 +1,61 @@
+#ifndef VOICEMAKER_SHARED_CACHE_H
+#define VOICEMAKER_SHARED_CACHE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+namespace voicemaker {
+
+// cache of waves in a file mapped by every process on the host
+class SharedCache {
+public:
+    // counters are shared by all processes
+    struct Stats {
+        size_t size;
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long evictions;
+    };
+
+    // empty file and file left by dead initializer are initialized, valid file is reused with its size
+    // file with other header is not overwritten, returns 5 and it must be removed by hand
+    int Open(const char *path, size_t size);
+    void Close();
+    // wave is copied, free with free
+    int Get(unsigned char **wave, int *waveLen, const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version);
+    void Put(const unsigned char *wave, int waveLen, const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version);
+    // returns 1 when not opened
+    int GetStats(Stats *stats);
+
+    SharedCache();
+    ~SharedCache();
+private:
+    const static int SHARD_COUNT = 16;
+    const static int SLOT_WAYS = 4;
+    struct Header;
+    struct Shard;
+    struct Slot;
+    struct Record;
+    void *data;
+    size_t size;
+    int shardCount;
+    int slotCount;
+    size_t shardSize;
+    size_t logSize;
+    // guards mapping against Open and Close
+    pthread_rwlock_t lock;
+
+    static unsigned long long GetHashValue(const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version);
+    static int GetLayout(size_t size, int *slotCount, size_t *shardSize, size_t *logSize);
+    Shard *GetShard(int index);
+    Slot *GetSlots(Shard *shard);
+    char *GetLog(Shard *shard);
+    int LockShard(Shard *shard);
+    int Initialize();
+    int IsValid();
+    void Unmap();
+};
+
+} // namespace voicemaker
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+#include "slowlog.h"
+
+using namespace std;
+
+namespace voicemaker {
+
+pthread_key_t SlowLog::pendingKey;
+pthread_once_t SlowLog::keyOnce = PTHREAD_ONCE_INIT;
+
+SlowLog::SlowLog() {
+    threshold = 0;
+    capacity = 0;
+    pthread_mutex_init(&lock, NULL);
+    pthread_once(&keyOnce, SlowLog::CreateKey);
+}
+
+SlowLog::~SlowLog() {
+    pthread_mutex_destroy(&lock);
+}
+
+void SlowLog::CreateKey() {
+    pthread_key_create(&pendingKey, SlowLog::DeletePending);
+}
+
+void SlowLog::DeletePending(void *pending) {
+    delete (Pending *)pending;
+}
+
+SlowLog::Pending *SlowLog::GetPending() {
+    Pending *pending = (Pending *)pthread_getspecific(pendingKey);
+
+    if (pending == NULL) {
+        pending = new Pending();
+        pending->owner = NULL;
+        pthread_setspecific(pendingKey, pending);
+    }
+
+    return pending;
+}
+
+int SlowLog::Set(unsigned long long newThreshold, int newCapacity) {
+    if (newCapacity < 0) {
+        return 1;
+    }
+    pthread_mutex_lock(&lock);
+    threshold = newThreshold;
+    capacity = newCapacity;
+    entries.clear();
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+int SlowLog::IsEnabled() {
+    return capacity > 0;
+}
+
+void SlowLog::Begin(const char *text, int textLength) {
+    Pending *pending;
+    int i;
+
+    if (!IsEnabled()) {
+        return;
+    }
+    pending = GetPending();
+    pending->owner = this;
+    pending->start = ConvertStats::Now();
+    // strings of pending entry keep their buffers between conversions
+    pending->entry.text.assign(text, textLength);
+    for (i = 0; i < TEXT_COUNT; i++) {
+        pending->entry.texts[i].clear();
+    }
+    memset(pending->entry.stages, 0, sizeof(pending->entry.stages));
+    pending->entry.memoryBytes = 0;
+}
+
+void SlowLog::SetStage(int stage, unsigned long long elapsed) {
+    Pending *pending;
+
+    if (!IsEnabled() || stage < 0 || stage >= ConvertStats::STAGE_COUNT) {
+        return;
+    }
+    pending = GetPending();
+    if (pending->owner != this) {
+        return;
+    }
+    pending->entry.stages[stage] += elapsed;
+}
+
+void SlowLog::SetText(int kind, const char *text) {
+    Pending *pending;
+
+    if (!IsEnabled() || kind < 0 || kind >= TEXT_COUNT) {
+        return;
+    }
+    pending = GetPending();
+    if (pending->owner != this) {
+        return;
+    }
+    pending->entry.texts[kind].assign(text);
+}
+
+void SlowLog::SetMemory(unsigned long long bytes) {
+    Pending *pending;
+
+    if (!IsEnabled()) {
+        return;
+    }
+    pending = GetPending();
+    if (pending->owner != this) {
+        return;
+    }
+    pending->entry.memoryBytes = bytes;
+}
+
+void SlowLog::End(int outputBytes, const char *error) {
+    Pending *pending;
+
+    if (!IsEnabled()) {
+        return;
+    }
+    pending = GetPending();
+    if (pending->owner != this) {
+        return;
+    }
+    pending->owner = NULL;
+    pending->entry.total = ConvertStats::Now() - pending->start;
+    if (pending->entry.total < threshold) {
+        return;
+    }
+    pending->entry.time = time(NULL);
+    pending->entry.outputBytes = outputBytes;
+    pending->entry.error = error;
+    pthread_mutex_lock(&lock);
+    if (capacity > 0) {
+        // oldest entry is dropped
+        while ((int)entries.size() >= capacity) {
+            entries.pop_front();
+        }
+        entries.push_back(pending->entry);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void SlowLog::GetEntries(deque<Entry> *newEntries) {
+    pthread_mutex_lock(&lock);
+    *newEntries = entries;
+    pthread_mutex_unlock(&lock);
+}
+
+void SlowLog::AppendEscaped(string *out, const char *text, int length) {
+    char escaped[8];
+    int i;
+
+    for (i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            out->push_back('\\');
+            out->push_back(c);
+        } else if (c < 0x20) {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out->append(escaped);
+        } else {
+            out->push_back(c);
+        }
+    }
+}
+
+int SlowLog::Write(const char *path) {
+    static const char *textNames[TEXT_COUNT] = { "tagged", "filtered", "fixedup" };
+    deque<Entry> logEntries;
+    string out;
+    char line[192];
+    FILE *fp;
+    int i;
+    int j;
+
+    GetEntries(&logEntries);
+    for (i = 0; i < (int)logEntries.size(); i++) {
+        const Entry &entry = logEntries[i];
+        snprintf(line, sizeof(line), "{\"time\":%ld,\"total\":%llu,\"outputBytes\":%d,\"memoryBytes\":%llu,\"text\":\"",
+                 (long)entry.time, entry.total, entry.outputBytes, entry.memoryBytes);
+        out.append(line);
+        AppendEscaped(&out, entry.text.data(), entry.text.size());
+        for (j = 0; j < TEXT_COUNT; j++) {
+            snprintf(line, sizeof(line), "\",\"%s\":\"", textNames[j]);
+            out.append(line);
+            AppendEscaped(&out, entry.texts[j].data(), entry.texts[j].size());
+        }
+        out.append("\",\"error\":");
+        if (entry.error) {
+            out.push_back('"');
+            AppendEscaped(&out, entry.error, strlen(entry.error));
+            out.push_back('"');
+        } else {
+            out.append("null");
+        }
+        out.append(",\"stages\":{");
+        for (j = 0; j < ConvertStats::STAGE_COUNT; j++) {
+            snprintf(line, sizeof(line), "%s\"%s\":%llu", j ? "," : "", ConvertStats::GetStageName(j), entry.stages[j]);
+            out.append(line);
+        }
+        out.append("}}\n");
+    }
+    if ((fp = fopen(path, "a")) == NULL) {
+        return 1;
+    }
+    if (fwrite(out.data(), 1, out.size(), fp) != out.size()) {
+        fclose(fp);
+        return 2;
+    }
+    if (fclose(fp)) {
+        return 2;
+    }
+
+    return 0;
+}
+
+} // namespace voicemaker
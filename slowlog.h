@@ -0,0 +1,74 @@
+#ifndef VOICEMAKER_SLOWLOG_H
+#define VOICEMAKER_SLOWLOG_H
+
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <deque>
+#include "stats.h"
+
+namespace voicemaker {
+
+// conversions slower than threshold with their intermediate texts
+class SlowLog {
+public:
+    const static int TAGGED = 0;
+    const static int FILTERED = 1;
+    const static int FIXEDUP = 2;
+    const static int TEXT_COUNT = 3;
+    struct Entry {
+        time_t time;
+        std::string text;
+        // reading text after mecab, filter and fixup
+        std::string texts[TEXT_COUNT];
+        // nanoseconds of each stage, 0 if not run
+        unsigned long long stages[ConvertStats::STAGE_COUNT];
+        unsigned long long total;
+        int outputBytes;
+        // bytes of buffers used by conversion of text, 0 if cached
+        unsigned long long memoryBytes;
+        // NULL if succeeded
+        const char *error;
+    };
+
+    // 0 capacity disables log
+    int Set(unsigned long long threshold, int capacity);
+    int IsEnabled();
+    // called by converting thread, ignored while disabled
+    void Begin(const char *text, int textLength);
+    void SetStage(int stage, unsigned long long elapsed);
+    void SetText(int kind, const char *text);
+    void SetMemory(unsigned long long bytes);
+    void End(int outputBytes, const char *error);
+    // oldest first
+    void GetEntries(std::deque<Entry> *entries);
+    // one json object per line, appended to file
+    int Write(const char *path);
+
+    SlowLog();
+    ~SlowLog();
+private:
+    struct Pending {
+        // log of conversion in progress, NULL if none
+        SlowLog *owner;
+        unsigned long long start;
+        Entry entry;
+    };
+    unsigned long long threshold;
+    int capacity;
+    std::deque<Entry> entries;
+    pthread_mutex_t lock;
+
+    // one conversion at a time on each thread
+    static pthread_key_t pendingKey;
+    static pthread_once_t keyOnce;
+
+    Pending *GetPending();
+    static void CreateKey();
+    static void DeletePending(void *pending);
+    static void AppendEscaped(std::string *out, const char *text, int length);
+};
+
+} // namespace voicemaker
+
+#endif
@@ -0,0 +1,229 @@
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+
+using namespace std;
+
+namespace voicemaker {
+
+ConvertStats::ConvertStats() {
+    memset(histograms, 0, sizeof(histograms));
+    memset(&memory, 0, sizeof(memory));
+    memset(&counters, 0, sizeof(counters));
+}
+
+unsigned long long ConvertStats::Now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+const char *ConvertStats::GetStageName(int stage) {
+    switch (stage) {
+    case PREPROCESS:
+        return "preprocess";
+    case TAGGING:
+        return "tagging";
+    case PREFERRED:
+        return "preferred";
+    case FILTER:
+        return "filter";
+    case FIXUP:
+        return "fixup";
+    case MODEL_LOAD:
+        return "model_load";
+    case SYNTHESIS:
+        return "synthesis";
+    case ENCODING:
+        return "encoding";
+    case TOTAL:
+        return "total";
+    default:
+        return "unknown";
+    }
+}
+
+int ConvertStats::GetBucket(unsigned long long value) {
+    int exponent = 63;
+
+    if (value < (unsigned long long)SUB_BUCKET_COUNT) {
+        return (int)value;
+    }
+    while (!(value >> exponent)) {
+        exponent--;
+    }
+
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + (int)((value >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT);
+}
+
+unsigned long long ConvertStats::GetBucketValue(int bucket) {
+    int exponent;
+    unsigned long long low;
+
+    if (bucket < SUB_BUCKET_COUNT) {
+        return bucket;
+    }
+    exponent = bucket / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+    low = (unsigned long long)(SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << (exponent - SUB_BUCKET_BITS);
+
+    return low + (1ULL << (exponent - SUB_BUCKET_BITS)) - 1;
+}
+
+void ConvertStats::Add(Histogram *histogram, unsigned long long value) {
+    unsigned long long max;
+
+    __sync_fetch_and_add(&histogram->counts[GetBucket(value)], 1);
+    __sync_fetch_and_add(&histogram->count, 1);
+    __sync_fetch_and_add(&histogram->sum, value);
+    while ((max = histogram->max) < value &&
+           !__sync_bool_compare_and_swap(&histogram->max, max, value)) {
+    }
+}
+
+void ConvertStats::Record(int stage, unsigned long long elapsed) {
+    if (stage < 0 || stage >= STAGE_COUNT) {
+        return;
+    }
+    Add(&histograms[stage], elapsed);
+}
+
+void ConvertStats::RecordError(int stage) {
+    if (stage < 0 || stage >= STAGE_COUNT) {
+        return;
+    }
+    __sync_fetch_and_add(&histograms[stage].errors, 1);
+}
+
+void ConvertStats::RecordRequest(int inputBytes, int outputBytes) {
+    __sync_fetch_and_add(&counters.requests, 1);
+    __sync_fetch_and_add(&counters.inputBytes, (unsigned long long)inputBytes);
+    __sync_fetch_and_add(&counters.outputBytes, (unsigned long long)outputBytes);
+}
+
+void ConvertStats::RecordMemory(unsigned long long bytes) {
+    Add(&memory, bytes);
+}
+
+unsigned long long ConvertStats::GetPercentile(const Histogram *histogram, unsigned long long count, double percentile) {
+    unsigned long long target;
+    unsigned long long seen = 0;
+    int i;
+
+    if (count == 0) {
+        return 0;
+    }
+    target = (unsigned long long)(count * percentile / 100.0);
+    if (target < 1) {
+        target = 1;
+    }
+    for (i = 0; i < BUCKET_COUNT; i++) {
+        seen += histogram->counts[i];
+        if (seen >= target) {
+            return GetBucketValue(i);
+        }
+    }
+
+    return histogram->max;
+}
+
+void ConvertStats::Summarize(Summary *summary, const Histogram *histogram) {
+    unsigned long long count = 0;
+    int i;
+
+    // buckets may move while reading, percentiles use sum of buckets
+    for (i = 0; i < BUCKET_COUNT; i++) {
+        count += histogram->counts[i];
+    }
+    summary->count = histogram->count;
+    summary->sum = histogram->sum;
+    summary->max = histogram->max;
+    summary->errors = histogram->errors;
+    summary->p50 = GetPercentile(histogram, count, 50.0);
+    summary->p90 = GetPercentile(histogram, count, 90.0);
+    summary->p99 = GetPercentile(histogram, count, 99.0);
+    summary->p999 = GetPercentile(histogram, count, 99.9);
+}
+
+int ConvertStats::GetSummary(Summary *summary, int stage) {
+    if (summary == NULL || stage < 0 || stage >= STAGE_COUNT) {
+        return 1;
+    }
+    Summarize(summary, &histograms[stage]);
+
+    return 0;
+}
+
+void ConvertStats::GetMemorySummary(Summary *summary) {
+    Summarize(summary, &memory);
+}
+
+void ConvertStats::GetCounters(Counters *newCounters) {
+    newCounters->requests = counters.requests;
+    newCounters->inputBytes = counters.inputBytes;
+    newCounters->outputBytes = counters.outputBytes;
+}
+
+void ConvertStats::WritePrometheus(string *out) {
+    char line[256];
+    Summary summary;
+    int stage;
+
+    out->append("# HELP voicemaker_requests_total Conversions of text.\n");
+    out->append("# TYPE voicemaker_requests_total counter\n");
+    snprintf(line, sizeof(line), "voicemaker_requests_total %llu\n", counters.requests);
+    out->append(line);
+    out->append("# HELP voicemaker_input_bytes_total Bytes of converted text.\n");
+    out->append("# TYPE voicemaker_input_bytes_total counter\n");
+    snprintf(line, sizeof(line), "voicemaker_input_bytes_total %llu\n", counters.inputBytes);
+    out->append(line);
+    out->append("# HELP voicemaker_output_bytes_total Bytes of converted wave.\n");
+    out->append("# TYPE voicemaker_output_bytes_total counter\n");
+    snprintf(line, sizeof(line), "voicemaker_output_bytes_total %llu\n", counters.outputBytes);
+    out->append(line);
+    out->append("# HELP voicemaker_errors_total Failed conversions by stage.\n");
+    out->append("# TYPE voicemaker_errors_total counter\n");
+    for (stage = 0; stage < STAGE_COUNT; stage++) {
+        GetSummary(&summary, stage);
+        snprintf(line, sizeof(line), "voicemaker_errors_total{stage=\"%s\"} %llu\n", GetStageName(stage), summary.errors);
+        out->append(line);
+    }
+    out->append("# HELP voicemaker_stage_seconds Latency of stage of conversion.\n");
+    out->append("# TYPE voicemaker_stage_seconds summary\n");
+    for (stage = 0; stage < STAGE_COUNT; stage++) {
+        const char *name = GetStageName(stage);
+        GetSummary(&summary, stage);
+        snprintf(line, sizeof(line), "voicemaker_stage_seconds{stage=\"%s\",quantile=\"0.5\"} %.9f\n", name, summary.p50 / 1e9);
+        out->append(line);
+        snprintf(line, sizeof(line), "voicemaker_stage_seconds{stage=\"%s\",quantile=\"0.9\"} %.9f\n", name, summary.p90 / 1e9);
+        out->append(line);
+        snprintf(line, sizeof(line), "voicemaker_stage_seconds{stage=\"%s\",quantile=\"0.99\"} %.9f\n", name, summary.p99 / 1e9);
+        out->append(line);
+        snprintf(line, sizeof(line), "voicemaker_stage_seconds{stage=\"%s\",quantile=\"0.999\"} %.9f\n", name, summary.p999 / 1e9);
+        out->append(line);
+        snprintf(line, sizeof(line), "voicemaker_stage_seconds_sum{stage=\"%s\"} %.9f\n", name, summary.sum / 1e9);
+        out->append(line);
+        snprintf(line, sizeof(line), "voicemaker_stage_seconds_count{stage=\"%s\"} %llu\n", name, summary.count);
+        out->append(line);
+    }
+
+    out->append("# HELP voicemaker_conversion_memory_bytes Bytes of buffers used by conversion of text.\n");
+    out->append("# TYPE voicemaker_conversion_memory_bytes summary\n");
+    GetMemorySummary(&summary);
+    snprintf(line, sizeof(line), "voicemaker_conversion_memory_bytes{quantile=\"0.5\"} %llu\n", summary.p50);
+    out->append(line);
+    snprintf(line, sizeof(line), "voicemaker_conversion_memory_bytes{quantile=\"0.9\"} %llu\n", summary.p90);
+    out->append(line);
+    snprintf(line, sizeof(line), "voicemaker_conversion_memory_bytes{quantile=\"0.99\"} %llu\n", summary.p99);
+    out->append(line);
+    snprintf(line, sizeof(line), "voicemaker_conversion_memory_bytes{quantile=\"0.999\"} %llu\n", summary.p999);
+    out->append(line);
+    snprintf(line, sizeof(line), "voicemaker_conversion_memory_bytes_sum %llu\n", summary.sum);
+    out->append(line);
+    snprintf(line, sizeof(line), "voicemaker_conversion_memory_bytes_count %llu\n", summary.count);
+    out->append(line);
+}
+
+} // namespace voicemaker
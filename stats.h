@@ -0,0 +1,81 @@
+#ifndef VOICEMAKER_STATS_H
+#define VOICEMAKER_STATS_H
+
+#include <string>
+
+namespace voicemaker {
+
+// always on counters and latency histograms of convert, updated without lock
+class ConvertStats {
+public:
+    const static int PREPROCESS = 0;
+    const static int TAGGING = 1;
+    // walk of mecab nodes, includes preferred lookup and parsing of features
+    const static int PREFERRED = 2;
+    const static int FILTER = 3;
+    const static int FIXUP = 4;
+    const static int MODEL_LOAD = 5;
+    const static int SYNTHESIS = 6;
+    const static int ENCODING = 7;
+    // whole conversion of a text, cache hits included
+    const static int TOTAL = 8;
+    const static int STAGE_COUNT = 9;
+    struct Summary {
+        unsigned long long count;
+        unsigned long long sum;
+        unsigned long long max;
+        unsigned long long errors;
+        // nanoseconds, highest value of bucket
+        unsigned long long p50;
+        unsigned long long p90;
+        unsigned long long p99;
+        unsigned long long p999;
+    };
+    struct Counters {
+        unsigned long long requests;
+        unsigned long long inputBytes;
+        unsigned long long outputBytes;
+    };
+
+    // monotonic nanoseconds
+    static unsigned long long Now();
+    static const char *GetStageName(int stage);
+    void Record(int stage, unsigned long long elapsed);
+    void RecordError(int stage);
+    void RecordRequest(int inputBytes, int outputBytes);
+    // bytes of buffers used by a conversion of text
+    void RecordMemory(unsigned long long bytes);
+    int GetSummary(Summary *summary, int stage);
+    // bytes instead of nanoseconds, errors are not counted
+    void GetMemorySummary(Summary *summary);
+    void GetCounters(Counters *counters);
+    // prometheus text exposition format
+    void WritePrometheus(std::string *out);
+
+    ConvertStats();
+private:
+    // values under 16 have own bucket, then 16 buckets for each power of two
+    const static int SUB_BUCKET_BITS = 4;
+    const static int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    const static int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+    struct Histogram {
+        unsigned long long counts[BUCKET_COUNT];
+        unsigned long long count;
+        unsigned long long sum;
+        unsigned long long max;
+        unsigned long long errors;
+    };
+    Histogram histograms[STAGE_COUNT];
+    Histogram memory;
+    Counters counters;
+
+    static void Add(Histogram *histogram, unsigned long long value);
+    static int GetBucket(unsigned long long value);
+    static unsigned long long GetBucketValue(int bucket);
+    unsigned long long GetPercentile(const Histogram *histogram, unsigned long long count, double percentile);
+    void Summarize(Summary *summary, const Histogram *histogram);
+};
+
+} // namespace voicemaker
+
+#endif
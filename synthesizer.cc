@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+#ifndef VOICEMAKER_WITHOUT_AQUESTALK
+#include <AquesTalk2.h>
+#endif
+#include "synthesizer.h"
+
+namespace voicemaker {
+
+namespace {
+
+#ifndef VOICEMAKER_WITHOUT_AQUESTALK
+class AquesTalkSynthesizer : public Synthesizer {
+public:
+    int Synthesize(unsigned char **wave, int *waveLen, const char *readingText, int speed, void *phontData);
+    void FreeWave(unsigned char *wave);
+    const char *GetName();
+    unsigned long long GetId();
+};
+
+int AquesTalkSynthesizer::Synthesize(unsigned char **wave, int *waveLen, const char *readingText, int speed, void *phontData) {
+    int size;
+
+    *wave = AquesTalk2_Synthe_Utf8(readingText, speed, &size, phontData);
+    if (*wave == NULL) {
+        // size is error code of aquestalk
+        *waveLen = 0;
+        return 1;
+    }
+    *waveLen = size;
+
+    return 0;
+}
+
+void AquesTalkSynthesizer::FreeWave(unsigned char *wave) {
+    AquesTalk2_FreeWave(wave);
+}
+
+const char *AquesTalkSynthesizer::GetName() {
+    return "aquestalk";
+}
+
+unsigned long long AquesTalkSynthesizer::GetId() {
+    // waves of aquestalk are cached without id
+    return 0;
+}
+
+AquesTalkSynthesizer aquesTalkSynthesizer;
+#endif
+
+// deterministic wave of 8kHz 16bit mono like aquestalk, for machines without aquestalk
+class StubSynthesizer : public Synthesizer {
+public:
+    int Synthesize(unsigned char **wave, int *waveLen, const char *readingText, int speed, void *phontData);
+    void FreeWave(unsigned char *wave);
+    const char *GetName();
+    unsigned long long GetId();
+
+private:
+    const static int SAMPLE_RATE = 8000;
+    // samples of one character at speed 100
+    const static int UNIT_SAMPLES = 960;
+    const static int RAMP_SAMPLES = 80;
+    const static int HEADER_SIZE = 44;
+
+    static int CountUnits(const char *readingText);
+    static void SetLittleEndian(unsigned char *ptr, unsigned int value, int size);
+};
+
+// coefficients of resonators of first and second formants of a, i, u, e and o, q14
+static const int formants[5][2] = {
+    { 25184, 18298 }, { 30269, -7267 }, { 29961, 16265 }, { 28760, 2442 }, { 28760, 23671 }
+};
+// third formant is same for all vowels
+static const int thirdFormant = -11913;
+static const int formantDamping = 14787;
+
+int StubSynthesizer::CountUnits(const char *readingText) {
+    const unsigned char *ptr = (const unsigned char *)readingText;
+    int units = 0;
+
+    for (; *ptr; ptr++) {
+        // first byte of each character
+        if ((*ptr & 0xc0) != 0x80) {
+            units++;
+        }
+    }
+
+    return units;
+}
+
+void StubSynthesizer::SetLittleEndian(unsigned char *ptr, unsigned int value, int size) {
+    int i;
+
+    for (i = 0; i < size; i++) {
+        ptr[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+
+int StubSynthesizer::Synthesize(unsigned char **wave, int *waveLen, const char *readingText, int speed, void * /* phontData */) {
+    const unsigned char *ptr;
+    unsigned char *newWave;
+    unsigned char *out;
+    int units;
+    int unitSamples;
+    int dataSize;
+    unsigned int seed;
+    int i;
+
+    *wave = NULL;
+    *waveLen = 0;
+    if (readingText == NULL || speed < 1) {
+        return 1;
+    }
+    if ((units = CountUnits(readingText)) == 0) {
+        return 2;
+    }
+    unitSamples = UNIT_SAMPLES * 100 / speed;
+    dataSize = units * unitSamples * 2;
+    newWave = (unsigned char *)malloc(HEADER_SIZE + dataSize);
+    if (newWave == NULL) {
+        return 3;
+    }
+    memcpy(newWave, "RIFF", 4);
+    SetLittleEndian(newWave + 4, HEADER_SIZE - 8 + dataSize, 4);
+    memcpy(newWave + 8, "WAVEfmt ", 8);
+    SetLittleEndian(newWave + 16, 16, 4);
+    SetLittleEndian(newWave + 20, 1, 2);
+    SetLittleEndian(newWave + 22, 1, 2);
+    SetLittleEndian(newWave + 24, SAMPLE_RATE, 4);
+    SetLittleEndian(newWave + 28, SAMPLE_RATE * 2, 4);
+    SetLittleEndian(newWave + 32, 2, 2);
+    SetLittleEndian(newWave + 34, 16, 2);
+    memcpy(newWave + 36, "data", 4);
+    SetLittleEndian(newWave + 40, dataSize, 4);
+    out = newWave + HEADER_SIZE;
+    ptr = (const unsigned char *)readingText;
+    while (*ptr) {
+        unsigned int code = *ptr++;
+        int pitch;
+        const int *formant;
+        int silent;
+        int phase = 0;
+        int y[3][2] = { { 0, 0 }, { 0, 0 }, { 0, 0 } };
+
+        while ((*ptr & 0xc0) == 0x80) {
+            code = (code << 6) | (*ptr++ & 0x3f);
+        }
+        // pulse train through parallel resonators of formants, ascii punctuation is pause
+        silent = code < 0x80 && !((code | 0x20) >= 'a' && (code | 0x20) <= 'z') && !(code >= '0' && code <= '9');
+        pitch = 100 + (code % 64) * 2;
+        formant = formants[code % 5];
+        seed = code;
+        for (i = 0; i < unitSamples; i++) {
+            int x = 0;
+            int sample;
+            int gain;
+            int f1;
+            int f2;
+            int f3;
+            phase += pitch;
+            if (phase >= SAMPLE_RATE) {
+                phase -= SAMPLE_RATE;
+                x = 600;
+            }
+            seed = seed * 1103515245 + 12345;
+            x += (int)((seed >> 16) & 0x7f) - 64;
+            f1 = ((formant[0] * y[0][0] - formantDamping * y[0][1]) >> 14) + x;
+            f2 = ((formant[1] * y[1][0] - formantDamping * y[1][1]) >> 14) + x;
+            f3 = ((thirdFormant * y[2][0] - formantDamping * y[2][1]) >> 14) + x;
+            y[0][1] = y[0][0];
+            y[0][0] = f1;
+            y[1][1] = y[1][0];
+            y[1][0] = f2;
+            y[2][1] = y[2][0];
+            y[2][0] = f3;
+            sample = (f1 + f2 / 2 + f3 / 4) / 2;
+            // fade in and out each character
+            gain = i < RAMP_SAMPLES ? i : unitSamples - i < RAMP_SAMPLES ? unitSamples - i : RAMP_SAMPLES;
+            sample = silent ? 0 : sample * gain / RAMP_SAMPLES;
+            if (sample > 32767) {
+                sample = 32767;
+            } else if (sample < -32768) {
+                sample = -32768;
+            }
+            SetLittleEndian(out, (unsigned int)sample, 2);
+            out += 2;
+        }
+    }
+    *wave = newWave;
+    *waveLen = HEADER_SIZE + dataSize;
+
+    return 0;
+}
+
+void StubSynthesizer::FreeWave(unsigned char *wave) {
+    free(wave);
+}
+
+const char *StubSynthesizer::GetName() {
+    return "stub";
+}
+
+unsigned long long StubSynthesizer::GetId() {
+    return 0x5354554253594e54ULL;
+}
+
+StubSynthesizer stubSynthesizer;
+
+} // namespace
+
+Synthesizer *Synthesizer::Get(const char *name) {
+    if (name == NULL) {
+        return NULL;
+    }
+#ifndef VOICEMAKER_WITHOUT_AQUESTALK
+    if (strcmp(name, aquesTalkSynthesizer.GetName()) == 0) {
+        return &aquesTalkSynthesizer;
+    }
+#endif
+    if (strcmp(name, stubSynthesizer.GetName()) == 0) {
+        return &stubSynthesizer;
+    }
+
+    return NULL;
+}
+
+Synthesizer *Synthesizer::GetDefault() {
+#ifndef VOICEMAKER_WITHOUT_AQUESTALK
+    return &aquesTalkSynthesizer;
+#else
+    return &stubSynthesizer;
+#endif
+}
+
+} // namespace voicemaker
@@ -0,0 +1,26 @@
+#ifndef VOICEMAKER_SYNTHESIZER_H
+#define VOICEMAKER_SYNTHESIZER_H
+
+namespace voicemaker {
+
+// makes wave of reading text, shared by threads without lock
+class Synthesizer {
+public:
+    // wave is freed by FreeWave of same synthesizer
+    virtual int Synthesize(unsigned char **wave, int *waveLen, const char *readingText, int speed, void *phontData) = 0;
+    virtual void FreeWave(unsigned char *wave) = 0;
+    virtual const char *GetName() = 0;
+    // mixed in key of cached waves
+    virtual unsigned long long GetId() = 0;
+    virtual ~Synthesizer() {}
+
+    // "aquestalk" or "stub", NULL if unknown or not built
+    // instances are static and live until exit, so swapped one can still free its waves
+    static Synthesizer *Get(const char *name);
+    // aquestalk unless built without it
+    static Synthesizer *GetDefault();
+};
+
+} // namespace voicemaker
+
+#endif
@@ -0,0 +1,351 @@
+// open-loop load generator
+// node test/load.js [--rate 50] [--duration 10] [--concurrency 16] [--mode async] [--corpus test/corpus.txt] ...
+var fs = require('fs');
+var VoiceMaker = require('../build/default/voicemaker').VoiceMaker;
+
+var options = {
+    rate: 50,
+    duration: 10,
+    concurrency: 16,
+    mode: 'async',
+    batch: 8,
+    speed: 100,
+    model: null,
+    corpus: './test/corpus.txt',
+    preferred: './voicemaker_preferred.dic',
+    filter: './voicemaker_filter.dic',
+    cache: 0,
+    interval: 1,
+    json: false
+};
+var modes = [ 'convert', 'async', 'wave', 'waveAsync', 'batch', 'waveBatch' ];
+
+function usage(message) {
+    if (message) {
+        console.error(message);
+    }
+    console.error('usage: node test/load.js [--rate requests/s] [--duration seconds] [--concurrency requests]');
+    console.error('                        [--mode ' + modes.join('|') + '] [--batch texts] [--speed speed] [--model phont]');
+    console.error('                        [--corpus path] [--preferred path] [--filter path] [--cache bytes]');
+    console.error('                        [--interval seconds] [--json]');
+    process.exit(1);
+}
+
+function parseArguments(argv) {
+    var i;
+    var name;
+
+    for (i = 0; i < argv.length; i++) {
+        if (argv[i].substr(0, 2) != '--') {
+            usage('unknown argument ' + argv[i]);
+        }
+        name = argv[i].substr(2);
+        if (!(name in options)) {
+            usage('unknown option ' + argv[i]);
+        }
+        if (typeof options[name] == 'boolean') {
+            options[name] = true;
+            continue;
+        }
+        if (i + 1 >= argv.length) {
+            usage('no value of ' + argv[i]);
+        }
+        i++;
+        if (typeof options[name] == 'number') {
+            options[name] = Number(argv[i]);
+            if (isNaN(options[name]) || options[name] < 0) {
+                usage('bad value of --' + name);
+            }
+        } else {
+            options[name] = argv[i];
+        }
+    }
+    if (modes.indexOf(options.mode) < 0) {
+        usage('unknown mode ' + options.mode);
+    }
+    if (options.rate <= 0 || options.duration <= 0 || options.concurrency < 1 || options.batch < 1 || options.interval <= 0) {
+        usage('rate, duration, concurrency, batch and interval must be positive');
+    }
+}
+
+// lines of text, or json lines with text (and speed) such as writeSlowLog output
+function loadCorpus(path) {
+    var items = [];
+
+    fs.readFileSync(path, 'utf8').split('\n').forEach(function(line) {
+        var item;
+
+        if (line.replace(/\s+$/, '') == '') {
+            return;
+        }
+        if (line.charAt(0) == '{') {
+            try {
+                item = JSON.parse(line);
+            } catch (e) {
+                item = null;
+            }
+            if (item && typeof item.text == 'string') {
+                items.push({ text: item.text, speed: typeof item.speed == 'number' ? item.speed : options.speed });
+                return;
+            }
+        }
+        items.push({ text: line.replace(/\s+$/, ''), speed: options.speed });
+    });
+    if (items.length == 0) {
+        usage('no text in ' + path);
+    }
+
+    return items;
+}
+
+// milliseconds, process.hrtime is not in old node
+var now = process.hrtime ? function() {
+    var time = process.hrtime();
+    return time[0] * 1e3 + time[1] / 1e6;
+} : function() {
+    return Date.now();
+};
+
+function percentile(sorted, p) {
+    if (sorted.length == 0) {
+        return 0;
+    }
+    return sorted[Math.min(sorted.length - 1, Math.ceil(sorted.length * p / 100) - 1)];
+}
+
+function summarize(values) {
+    var sorted = values.slice().sort(function(a, b) { return a - b; });
+
+    return {
+        count: sorted.length,
+        p50: percentile(sorted, 50),
+        p90: percentile(sorted, 90),
+        p99: percentile(sorted, 99),
+        p999: percentile(sorted, 99.9),
+        max: sorted.length ? sorted[sorted.length - 1] : 0
+    };
+}
+
+function format(value) {
+    return value.toFixed(2);
+}
+
+parseArguments(process.argv.slice(2));
+var corpus = loadCorpus(options.corpus);
+var voicemaker = new VoiceMaker();
+voicemaker.setDictionary(options.preferred, options.filter);
+voicemaker.loadDictionary();
+if (options.cache) {
+    voicemaker.setCacheSize(options.cache);
+}
+
+var next = 0;
+var inFlight = 0;
+var waiting = [];
+var latencies = [];
+var intervalLatencies = [];
+var lags = [];
+var intervalLags = [];
+var samples = [];
+var errors = 0;
+var completed = 0;
+var texts = 0;
+var intervalCompleted = 0;
+var start;
+var lastReport;
+var arrivals = 0;
+var stopped = false;
+
+function nextItem() {
+    var item = corpus[next];
+
+    next = (next + 1) % corpus.length;
+
+    return item;
+}
+
+// text, speed and model if given
+function convertArguments(item) {
+    return options.model ? [ item.text, item.speed, options.model ] : [ item.text, item.speed ];
+}
+
+function done(scheduled, error, count) {
+    var latency = now() - scheduled;
+
+    inFlight--;
+    latencies.push(latency);
+    intervalLatencies.push(latency);
+    completed++;
+    intervalCompleted++;
+    texts += count;
+    if (error) {
+        errors++;
+    }
+    if (waiting.length > 0) {
+        send(waiting.shift());
+    } else if (stopped && inFlight == 0) {
+        finish();
+    }
+}
+
+// latency is measured from scheduled arrival, waiting for concurrency included
+function send(scheduled) {
+    var item;
+    var items;
+    var i;
+
+    inFlight++;
+    switch (options.mode) {
+    case 'convert':
+    case 'wave':
+        item = nextItem();
+        try {
+            voicemaker[options.mode == 'convert' ? 'convert' : 'convertWave'].apply(voicemaker, convertArguments(item));
+            done(scheduled, null, 1);
+        } catch (e) {
+            done(scheduled, e, 1);
+        }
+        break;
+    case 'async':
+    case 'waveAsync':
+        item = nextItem();
+        voicemaker[options.mode == 'async' ? 'convertAsync' : 'convertWaveAsync'].apply(voicemaker, convertArguments(item).concat(function(err) {
+            done(scheduled, err, 1);
+        }));
+        break;
+    default:
+        items = [];
+        for (i = 0; i < options.batch; i++) {
+            item = nextItem();
+            items.push(options.model ? { text: item.text, speed: item.speed, model: options.model } : { text: item.text, speed: item.speed });
+        }
+        voicemaker[options.mode == 'batch' ? 'convertBatch' : 'convertWaveBatch'](items, function(err, results) {
+            var failed = err;
+            if (results) {
+                results.forEach(function(result) {
+                    if (result instanceof Error) {
+                        failed = result;
+                    }
+                });
+            }
+            done(scheduled, failed, items.length);
+        });
+        break;
+    }
+}
+
+function arrive() {
+    var elapsed = now() - start;
+    var scheduled;
+
+    if (elapsed >= options.duration * 1000) {
+        stopped = true;
+        clearInterval(arrivalTimer);
+        if (inFlight == 0) {
+            finish();
+        }
+        return;
+    }
+    // arrivals are not delayed by slow responses
+    while (arrivals < elapsed * options.rate / 1000) {
+        scheduled = start + arrivals * 1000 / options.rate;
+        arrivals++;
+        if (inFlight < options.concurrency) {
+            send(scheduled);
+        } else {
+            waiting.push(scheduled);
+        }
+    }
+}
+
+function report() {
+    var time = now();
+    var summary = summarize(intervalLatencies);
+    var lag = summarize(intervalLags);
+    var sample = {
+        time: (time - start) / 1000,
+        throughput: intervalCompleted * 1000 / (time - lastReport),
+        p50: summary.p50,
+        p99: summary.p99,
+        lagMax: lag.max,
+        waiting: waiting.length,
+        inFlight: inFlight,
+        rss: process.memoryUsage().rss
+    };
+
+    samples.push(sample);
+    if (!options.json) {
+        console.log([
+            format(sample.time) + 's',
+            format(sample.throughput) + ' req/s',
+            'p50 ' + format(sample.p50) + 'ms',
+            'p99 ' + format(sample.p99) + 'ms',
+            'lag ' + format(sample.lagMax) + 'ms',
+            'waiting ' + sample.waiting,
+            'rss ' + format(sample.rss / 1024 / 1024) + 'MB'
+        ].join('  '));
+    }
+    intervalLatencies = [];
+    intervalLags = [];
+    intervalCompleted = 0;
+    lastReport = time;
+}
+
+var lagInterval = 10;
+var lagExpected;
+function checkLag() {
+    var time = now();
+    var lag = Math.max(0, time - lagExpected);
+
+    lags.push(lag);
+    intervalLags.push(lag);
+    lagExpected = time + lagInterval;
+}
+
+function finish() {
+    var elapsed = (now() - start) / 1000;
+    var latency;
+    var lag;
+    var result;
+
+    if (finish.called) {
+        return;
+    }
+    finish.called = true;
+    clearInterval(lagTimer);
+    clearInterval(reportTimer);
+    if (intervalCompleted > 0) {
+        report();
+    }
+    latency = summarize(latencies);
+    lag = summarize(lags);
+    result = {
+        options: options,
+        requests: completed,
+        texts: texts,
+        errors: errors,
+        seconds: elapsed,
+        throughput: completed / elapsed,
+        latency: latency,
+        lag: lag,
+        maxRss: Math.max.apply(null, samples.map(function(sample) { return sample.rss; })),
+        samples: samples,
+        stats: voicemaker.getStats()
+    };
+    if (options.json) {
+        console.log(JSON.stringify(result));
+        return;
+    }
+    console.log('requests ' + completed + ', texts ' + texts + ', errors ' + errors + ' in ' + format(elapsed) + 's, ' + format(result.throughput) + ' req/s');
+    console.log('latency ms  p50 ' + format(latency.p50) + '  p90 ' + format(latency.p90) + '  p99 ' + format(latency.p99) +
+                '  p99.9 ' + format(latency.p999) + '  max ' + format(latency.max));
+    console.log('event loop lag ms  p50 ' + format(lag.p50) + '  p99 ' + format(lag.p99) + '  max ' + format(lag.max));
+    console.log('max rss ' + format(result.maxRss / 1024 / 1024) + 'MB');
+}
+
+start = now();
+lastReport = start;
+lagExpected = start + lagInterval;
+var lagTimer = setInterval(checkLag, lagInterval);
+var reportTimer = setInterval(report, options.interval * 1000);
+var arrivalTimer = setInterval(arrive, 1);
@@ -9,31 +9,20 @@ voicemaker.addPreferredWord('-','ハイフン')
 voicemaker.addPreferredWord('＋','プラス')
 voicemaker.addPreferredWord('／','スラ')
 voicemaker.addPreferredWord('@','アット')
-voicemaker.addPreferredWord('＠','アット')
 voicemaker.addPreferredWord('.','ドット')
-voicemaker.addPreferredWord('．','ドット')
 voicemaker.addPreferredWord('#','シャープ')
-voicemaker.addPreferredWord('＃','シャープ')
 voicemaker.addPreferredWord('$','ドル')
-voicemaker.addPreferredWord('＄','ドル')
 voicemaker.addPreferredWord('%','パーセント')
-voicemaker.addPreferredWord('％','パーセント')
 voicemaker.addPreferredWord('&','アンド')
-voicemaker.addPreferredWord('＆','アンド')
 voicemaker.addPreferredWord('=','イコール')
-voicemaker.addPreferredWord('＝','イコール')
 voicemaker.addPreferredWord('_','アンスコ')
-voicemaker.addPreferredWord('＿','アンスコ')
 voicemaker.addPreferredWord('＊','コメ')
 voicemaker.addPreferredWord('*','コメ')
-voicemaker.addPreferredWord('＊','コメ')
 voicemaker.addPreferredWord('\\',',')
 voicemaker.addPreferredWord('￥','エン')
 voicemaker.addPreferredWord('○','マル')
 voicemaker.addPreferredWord('|',',')
-voicemaker.addPreferredWord('｜',',')
 voicemaker.addPreferredWord('`',',')
-voicemaker.addPreferredWord('｀',',')
 voicemaker.addPreferredWord('"',',')
 voicemaker.addPreferredWord('”',',')
 voicemaker.addPreferredWord('“',',')
@@ -41,9 +30,7 @@ voicemaker.addPreferredWord('\'',',')
 voicemaker.addPreferredWord('’',',')
 voicemaker.addPreferredWord('‘',',')
 voicemaker.addPreferredWord(':',',')
-voicemaker.addPreferredWord('：',',')
 voicemaker.addPreferredWord('!', ',')
-voicemaker.addPreferredWord('！',',')
 voicemaker.addPreferredWord('・',',')
 voicemaker.addPreferredWord('　',',')
 voicemaker.addPreferredWord('≪', '、')
@@ -119,30 +106,19 @@ voicemaker.addFilterWord('；',',')
 voicemaker.addFilterWord('＋','プラス')
 voicemaker.addFilterWord('／','スラ')
 voicemaker.addFilterWord('@','アット')
-voicemaker.addFilterWord('＠','アット')
 voicemaker.addFilterWord('.','ドット')
-voicemaker.addFilterWord('．','ドット')
 voicemaker.addFilterWord('#','シャープ')
-voicemaker.addFilterWord('＃','シャープ')
 voicemaker.addFilterWord('$','ドル')
-voicemaker.addFilterWord('＄','ドル')
 voicemaker.addFilterWord('%','パーセント')
-voicemaker.addFilterWord('％','パーセント')
 voicemaker.addFilterWord('&','アンド')
-voicemaker.addFilterWord('＆','アンド')
 voicemaker.addFilterWord('=','イコール')
-voicemaker.addFilterWord('＝','イコール')
 voicemaker.addFilterWord('_','アンスコ')
-voicemaker.addFilterWord('＿','アンスコ')
 voicemaker.addFilterWord('＊','コメ')
 voicemaker.addFilterWord('*','コメ')
-voicemaker.addFilterWord('＊','コメ')
 voicemaker.addFilterWord('\\',',')
 voicemaker.addFilterWord('￥','エン')
 voicemaker.addFilterWord('|',',')
-voicemaker.addFilterWord('｜',',')
 voicemaker.addFilterWord('`',',')
-voicemaker.addFilterWord('｀',',')
 voicemaker.addFilterWord('"',',')
 voicemaker.addFilterWord('”',',')
 voicemaker.addFilterWord('“',',')
@@ -150,9 +126,7 @@ voicemaker.addFilterWord('\'',',')
 voicemaker.addFilterWord('’',',')
 voicemaker.addFilterWord('‘',',')
 voicemaker.addFilterWord(':',',')
-voicemaker.addFilterWord('：',',')
 voicemaker.addFilterWord('!', ',')
-voicemaker.addFilterWord('！',',')
 voicemaker.addFilterWord('・',',')
 voicemaker.addFilterWord('　',',')
 voicemaker.addFilterWord('≪', '、')
@@ -218,6 +192,9 @@ var voicemaker = new VoiceMaker();
 voicemaker.setDictionary(prefferdPath, filterPath)
 voicemaker.loadDictionary()
 voicemaker.loadDictionary()
+voicemaker.setDictionary('./voicemaker.dicc')
+voicemaker.saveDictionary()
+voicemaker.loadDictionary()
 try {
     voicemaker.convert('私は、モモンガの次男の孫の長男の従兄弟のへべれけという者です。');
     voicemaker.convert('私は、モモンガの次男の孫の長男の従兄弟のへべれけという者です。', '/usr/local/share/aquestalk2/phont/aq_rm.phont');
@@ -244,7 +221,203 @@ try {
     voicemaker.convert(' 11-00 ruhhff-gggg feijiefj-44 48877-feokfeo', 80,'/usr/local/share/aquestalk2/phont/aq_rm.phont');
     voicemaker.convert('3339-9番地だ', 80,'/usr/local/share/aquestalk2/phont/aq_rm.phont');
     voicemaker.convert('!"%#$○%&%()0♩0=~0|`{*}+*><?>/,;][\-0987654321', 80,'/usr/local/share/aquestalk2/phont/aq_rm.phont');
+    voicemaker.registerVoice('rm', '/usr/local/share/aquestalk2/phont/aq_rm.phont');
+    voicemaker.convert('ジオンガ', 80, 'rm');
+    voicemaker.reloadVoice('rm');
+    voicemaker.convert('ジオンガ', 'rm');
+    voicemaker.unregisterVoice('rm');
+    voicemaker.convert(new Buffer('ジオンガ'), 80);
+    var wave = voicemaker.convertWave('ジオンガ', 80, '/usr/local/share/aquestalk2/phont/aq_rm.phont');
+    if (!Buffer.isBuffer(wave) || wave.toString('ascii', 0, 4) != 'RIFF') {
+        console.log('bad wave buffer');
+    }
+    if (voicemaker.convertWave('').length != 0) {
+        console.log('bad empty wave buffer');
+    }
 } catch(e) {
     console.log(e);
     console.log('bad String -> ' + voicemaker.getErrorText());
 }
+voicemaker.convertAsync('私は、モモンガの次男の孫の長男の従兄弟のへべれけという者です。', function(err, waveData) {
+    if (err) {
+        console.log(err);
+        console.log('bad String -> ' + voicemaker.getErrorText());
+    }
+});
+voicemaker.convertAsync('3339-9番地だ', 80, '/usr/local/share/aquestalk2/phont/aq_rm.phont', function(err, waveData) {
+    if (err) {
+        console.log(err);
+        console.log('bad String -> ' + voicemaker.getErrorText());
+    }
+});
+voicemaker.convertWaveAsync(new Buffer('ジオンガ'), 80, function(err, wave) {
+    if (err) {
+        console.log(err);
+        console.log('bad String -> ' + voicemaker.getErrorText());
+    }
+});
+var longText = '';
+for (var i = 0; i < 100; i++) {
+    longText += '私は、モモンガの次男の孫の長男の従兄弟のへべれけという者です。';
+}
+voicemaker.convertWaveAsync(longText, 80, function(err, wave) {
+    if (err) {
+        console.log(err);
+        console.log('bad String -> ' + voicemaker.getErrorText());
+        return;
+    }
+    if (wave.toString('ascii', 0, 4) != 'RIFF' || (wave[4] | (wave[5] << 8) | (wave[6] << 16) | (wave[7] << 24)) != wave.length - 8) {
+        console.log('bad joined wave buffer');
+    }
+});
+var segments = 0;
+voicemaker.convertStream('私は、モモンガの次男です。本当ですか？\nはい', 80, function(err, waveData) {
+    if (err) {
+        console.log(err);
+        console.log('bad String -> ' + voicemaker.getErrorText());
+        return;
+    }
+    if (waveData === null) {
+        if (segments != 4) {
+            console.log('bad segment count ' + segments);
+        }
+        return;
+    }
+    segments++;
+});
+voicemaker.reloadDictionary(function(err) {
+    if (err) {
+        console.log(err);
+    }
+    voicemaker.convertAsync('ジオンガ', 80, function(err, waveData) {
+        if (err) {
+            console.log(err);
+            console.log('bad String -> ' + voicemaker.getErrorText());
+        }
+    });
+});
+// filter words are replaced in one pass, replaced text is not replaced again
+var chainVoicemaker = new VoiceMaker();
+chainVoicemaker.setDictionary(prefferdPath, filterPath);
+chainVoicemaker.loadDictionary();
+chainVoicemaker.addFilterWord('ヌヌ', 'ネネ');
+chainVoicemaker.addFilterWord('ネネ', 'ノ');
+// ヌヌネネ is ネネノ, not ノノ as replacing word by word, ホヌヌネ is ホネネネ, not ホノネ
+if (chainVoicemaker.convert('ヌヌネネ', 80) == chainVoicemaker.convert('ノノ', 80) ||
+    chainVoicemaker.convert('ホヌヌネ', 80) == chainVoicemaker.convert('ホノネ', 80)) {
+    console.log('bad chained filter words');
+}
+voicemaker.convertBatch([{ text: 'ジオンガ' }, { text: 'モモンガ', speed: 120 }, { text: 'へべれけ', model: './no_such_phont' }], function(err, results) {
+    if (err) {
+        console.log(err);
+        return;
+    }
+    if (results.length != 3 || results[0] instanceof Error || results[1] instanceof Error || !(results[2] instanceof Error)) {
+        console.log('bad batch results');
+    }
+});
+voicemaker.convertWaveBatch([{ text: longText }, { text: longText, model: './no_such_phont' }], function(err, results) {
+    if (err) {
+        console.log(err);
+        return;
+    }
+    if (results[0] instanceof Error || results[0].toString('ascii', 0, 4) != 'RIFF' ||
+        (results[0][4] | (results[0][5] << 8) | (results[0][6] << 16) | (results[0][7] << 24)) != results[0].length - 8 ||
+        !(results[1] instanceof Error)) {
+        console.log('bad joined batch results');
+    }
+});
+var cacheVoicemaker = new VoiceMaker();
+cacheVoicemaker.setDictionary(prefferdPath, filterPath);
+cacheVoicemaker.loadDictionary();
+cacheVoicemaker.setCacheSize(1024 * 1024);
+var cachedWave = cacheVoicemaker.convert('ジオンガ', 80);
+if (cacheVoicemaker.convert('ジオンガ', 80) != cachedWave || cacheVoicemaker.getCacheStats().hits != 1) {
+    console.log('bad cache hit');
+}
+cacheVoicemaker.addPreferredWord('ジオンガ', 'モモンガ');
+// added word is published and drops cached wave at next convert
+if (cacheVoicemaker.convert('ジオンガ', 80) == cachedWave || cacheVoicemaker.getCacheStats().hits != 1 || cacheVoicemaker.getCacheStats().entries != 1) {
+    console.log('bad cache invalidation');
+}
+cacheVoicemaker.setReadingCacheSize(1024 * 1024);
+cacheVoicemaker.convert('へべれけ', 80);
+cacheVoicemaker.convert('へべれけ', 120);
+if (cacheVoicemaker.getCacheStats().reading.hits != 1) {
+    console.log('bad reading cache hit');
+}
+var foldedHits = cacheVoicemaker.getCacheStats().hits;
+cacheVoicemaker.convert('ＡＢＣ', 80);
+cacheVoicemaker.convert('ABC', 80);
+if (cacheVoicemaker.getCacheStats().hits != foldedHits + 1) {
+    console.log('bad cache hit of folded text');
+}
+var sharedCachePath = '/tmp/voicemaker_test.cache';
+try {
+    require('fs').unlinkSync(sharedCachePath);
+} catch (e) {
+}
+var sharedVoicemaker = new VoiceMaker();
+sharedVoicemaker.setDictionary(prefferdPath, filterPath);
+sharedVoicemaker.loadDictionary();
+sharedVoicemaker.setSharedCache(sharedCachePath, 16 * 1024 * 1024);
+var sharedWave = sharedVoicemaker.convert('ジオンガ', 80);
+if (sharedVoicemaker.convert('ジオンガ', 80) != sharedWave || sharedVoicemaker.getCacheStats().shared.hits != 1) {
+    console.log('bad shared cache hit');
+}
+sharedVoicemaker.setSharedCache(null);
+var stats = cacheVoicemaker.getStats();
+if (stats.requests < 1 || stats.stages.total.count != stats.requests || cacheVoicemaker.getStats('prometheus').indexOf('voicemaker_requests_total') < 0) {
+    console.log('bad stats');
+}
+if (stats.memory.count < 1 || stats.memory.max < 1 || stats.arenaBytes < stats.memory.max) {
+    console.log('bad memory stats');
+}
+cacheVoicemaker.setTrace(1024);
+cacheVoicemaker.traceRequest('test-1');
+cacheVoicemaker.convert('トレース', 100);
+cacheVoicemaker.traceRequest(null);
+var traceEvents = JSON.parse(cacheVoicemaker.getTrace()).traceEvents;
+if (traceEvents.length < 1 || traceEvents[0].args.requestId != 'test-1') {
+    console.log('bad trace');
+}
+cacheVoicemaker.setTrace(0);
+cacheVoicemaker.setSlowLog(0, 10);
+cacheVoicemaker.convert('スローログ', 100);
+var slowLog = cacheVoicemaker.getSlowLog();
+if (slowLog.length != 1 || slowLog[0].text != 'スローログ' || slowLog[0].fixedup == '' || slowLog[0].stages.fixup <= 0) {
+    console.log('bad slow log');
+}
+cacheVoicemaker.convert('3時に', 100);
+slowLog = cacheVoicemaker.getSlowLog();
+if (slowLog[1].tagged.indexOf('#3') < 0 || slowLog[1].fixedup.indexOf('<NUMK VAL=3 COUNTER=') < 0) {
+    console.log('bad number tokens');
+}
+cacheVoicemaker.convert('2012/4/15 15:45に¥1,980', 100);
+slowLog = cacheVoicemaker.getSlowLog();
+if (slowLog[2].tagged.indexOf('#2012|') < 0 || slowLog[2].tagged.indexOf('#45|') < 0 ||
+    slowLog[2].fixedup.indexOf('<NUMK VAL=1980 COUNTER=') < 0) {
+    console.log('bad number scan');
+}
+cacheVoicemaker.convert('ｶﾞｿﾘﾝは１２０円', 100);
+slowLog = cacheVoicemaker.getSlowLog();
+if (slowLog[3].text != 'ｶﾞｿﾘﾝは１２０円' || slowLog[3].tagged.indexOf('ガソリン') < 0 || slowLog[3].tagged.indexOf('#120|') < 0) {
+    console.log('bad width folding');
+}
+try {
+    cacheVoicemaker.setKanaFolding(1);
+    console.log('bad kana folding arguments');
+} catch (e) {
+}
+try {
+    cacheVoicemaker.convert(new Buffer([0x61, 0xe3, 0x81, 0x82, 0xe3, 0x81]), 100);
+    console.log('bad invalid utf-8');
+} catch (e) {
+}
+cacheVoicemaker.setSlowLog(0, 0);
+cacheVoicemaker.setSynthesizer('stub');
+var stubWave = cacheVoicemaker.convertWave('スタブ', 100);
+if (stubWave.toString('ascii', 0, 4) != 'RIFF' || cacheVoicemaker.convert('スタブ', 100) != stubWave.toString('base64')) {
+    console.log('bad stub synthesizer');
+}
+cacheVoicemaker.setSynthesizer('aquestalk');
@@ -0,0 +1,289 @@
+#include <string.h>
+#include "textscan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VOICEMAKER_SCAN_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace voicemaker {
+
+TextScanner::Classifier TextScanner::classifier = TextScanner::ClassifyScalar;
+// fastest classifier of cpu is chosen when library is loaded
+int TextScanner::level = TextScanner::Detect();
+
+void TextScanner::Begin(State *state) {
+    state->expected = 0;
+    state->lead = 0;
+    state->letter = 0;
+}
+
+int TextScanner::CheckSpecial(unsigned char lead, unsigned char next) {
+    // overlong forms, surrogates and code points above U+10FFFF
+    switch (lead) {
+    case 0xe0:
+        return next < 0xa0;
+    case 0xed:
+        return next > 0x9f;
+    case 0xf0:
+        return next < 0x90;
+    case 0xf4:
+        return next > 0x8f;
+    default:
+        return 0;
+    }
+}
+
+int TextScanner::Scan(unsigned long long *stops, State *state, const char *text, int length) {
+    unsigned char padded[BLOCK];
+    const unsigned char *ptr = (const unsigned char *)text;
+    Masks masks;
+    unsigned long long leads;
+    unsigned long long longLeads;
+    unsigned long long fourLeads;
+    unsigned long long expected;
+    unsigned long long special;
+    int i;
+
+    // last block is padded with nul, it is neither letter nor part of character
+    if (length < BLOCK) {
+        memset(padded, 0, BLOCK);
+        memcpy(padded, text, length);
+        ptr = padded;
+    }
+    classifier(&masks, ptr);
+    // signed compares of vectors are true for ascii too
+    masks.geC0 &= masks.high;
+    masks.geC2 &= masks.high;
+    masks.geE0 &= masks.high;
+    masks.geF0 &= masks.high;
+    masks.geF5 &= masks.high;
+
+    // every lead is followed by its continuation bytes and nothing else is continuation byte
+    leads = masks.geC2 & ~masks.geF5;
+    longLeads = masks.geE0 & ~masks.geF5;
+    fourLeads = masks.geF0 & ~masks.geF5;
+    expected = (leads << 1) | (longLeads << 2) | (fourLeads << 3) | state->expected;
+    if (expected != (masks.high & ~masks.geC0) || (masks.geC0 & ~masks.geC2) || masks.geF5) {
+        return 1;
+    }
+    if (state->lead && CheckSpecial(state->lead, ptr[0])) {
+        return 1;
+    }
+    state->lead = 0;
+    for (special = masks.special; special; special &= special - 1) {
+        i = LowestBit(special);
+        if (i == BLOCK - 1) {
+            state->lead = ptr[i];
+        } else if (CheckSpecial(ptr[i], ptr[i + 1])) {
+            return 1;
+        }
+    }
+    state->expected = (leads >> (BLOCK - 1)) | (longLeads >> (BLOCK - 2)) | (fourLeads >> (BLOCK - 3));
+
+    *stops = (masks.letter ^ ((masks.letter << 1) | state->letter)) | masks.ef;
+    state->letter = masks.letter >> (BLOCK - 1);
+    if (length < BLOCK) {
+        *stops &= (1ULL << length) - 1;
+    }
+
+    return 0;
+}
+
+int TextScanner::End(const State *state) {
+    return state->expected != 0;
+}
+
+int TextScanner::LowestBit(unsigned long long bits) {
+#ifdef __GNUC__
+    return __builtin_ctzll(bits);
+#else
+    int i;
+
+    for (i = 0; !(bits & 1); i++) {
+        bits >>= 1;
+    }
+
+    return i;
+#endif
+}
+
+int TextScanner::GetLevel() {
+    return level;
+}
+
+int TextScanner::Select(int newLevel) {
+    if (newLevel < SCALAR || newLevel > GetCpuLevel()) {
+        return 1;
+    }
+    switch (newLevel) {
+    case AVX2:
+        classifier = ClassifyAvx2;
+        break;
+    case SSE2:
+        classifier = ClassifySse2;
+        break;
+    default:
+        classifier = ClassifyScalar;
+        break;
+    }
+    level = newLevel;
+
+    return 0;
+}
+
+const char *TextScanner::GetLevelName(int level) {
+    switch (level) {
+    case AVX2:
+        return "avx2";
+    case SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+int TextScanner::Detect() {
+    int cpuLevel = GetCpuLevel();
+
+    Select(cpuLevel);
+
+    return cpuLevel;
+}
+
+int TextScanner::GetCpuLevel() {
+#ifdef VOICEMAKER_SCAN_X86
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+    unsigned int xcr0;
+    unsigned int xcr0High;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return SCALAR;
+    }
+    // ymm registers must be saved by os too
+    if ((ecx & (1 << 27)) && (ecx & (1 << 28)) && __get_cpuid_max(0, NULL) >= 7) {
+        __asm__ (".byte 0x0f, 0x01, 0xd0" : "=a" (xcr0), "=d" (xcr0High) : "c" (0));
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if ((xcr0 & 6) == 6 && (ebx & (1 << 5))) {
+            return AVX2;
+        }
+        __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    }
+    if (edx & (1 << 26)) {
+        return SSE2;
+    }
+#endif
+
+    return SCALAR;
+}
+
+void TextScanner::ClassifyScalar(Masks *masks, const unsigned char *text) {
+    unsigned long long bit;
+    unsigned char c;
+    int i;
+
+    memset(masks, 0, sizeof(Masks));
+    for (i = 0; i < BLOCK; i++) {
+        c = text[i];
+        bit = 1ULL << i;
+        if (c < 0x80) {
+            if (IsLetter(c)) {
+                masks->letter |= bit;
+            }
+            continue;
+        }
+        masks->high |= bit;
+        masks->geC0 |= (c >= 0xc0) ? bit : 0;
+        masks->geC2 |= (c >= 0xc2) ? bit : 0;
+        masks->geE0 |= (c >= 0xe0) ? bit : 0;
+        masks->geF0 |= (c >= 0xf0) ? bit : 0;
+        masks->geF5 |= (c >= 0xf5) ? bit : 0;
+        if (c == 0xe0 || c == 0xed || c == 0xf0 || c == 0xf4) {
+            masks->special |= bit;
+        } else if (c == 0xef) {
+            masks->ef |= bit;
+        }
+    }
+}
+
+#ifdef VOICEMAKER_SCAN_X86
+
+// bytes are compared as signed, 0x80 to 0xff are below ascii
+__attribute__((target("sse2")))
+void TextScanner::ClassifySse2(Masks *masks, const unsigned char *text) {
+    __m128i x;
+    __m128i y;
+    unsigned long long shift;
+    int i;
+
+    memset(masks, 0, sizeof(Masks));
+    for (i = 0; i < BLOCK; i += 16) {
+        x = _mm_loadu_si128((const __m128i *)&text[i]);
+        y = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        shift = i;
+        masks->high |= (unsigned long long)(unsigned int)_mm_movemask_epi8(x) << shift;
+        masks->letter |= (unsigned long long)(unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpgt_epi8(y, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(y, _mm_set1_epi8('z' + 1)))) << shift;
+        if (!_mm_movemask_epi8(x)) {
+            continue;
+        }
+        masks->geC0 |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(x, _mm_set1_epi8((char)0xbf))) << shift;
+        masks->geC2 |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(x, _mm_set1_epi8((char)0xc1))) << shift;
+        masks->geE0 |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(x, _mm_set1_epi8((char)0xdf))) << shift;
+        masks->geF0 |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(x, _mm_set1_epi8((char)0xef))) << shift;
+        masks->geF5 |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(x, _mm_set1_epi8((char)0xf4))) << shift;
+        masks->special |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8((char)0xe0)), _mm_cmpeq_epi8(x, _mm_set1_epi8((char)0xed))),
+            _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8((char)0xf0)), _mm_cmpeq_epi8(x, _mm_set1_epi8((char)0xf4))))) << shift;
+        masks->ef |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8((char)0xef))) << shift;
+    }
+}
+
+__attribute__((target("avx2")))
+void TextScanner::ClassifyAvx2(Masks *masks, const unsigned char *text) {
+    __m256i x;
+    __m256i y;
+    unsigned long long shift;
+    int i;
+
+    memset(masks, 0, sizeof(Masks));
+    for (i = 0; i < BLOCK; i += 32) {
+        x = _mm256_loadu_si256((const __m256i *)&text[i]);
+        y = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        shift = i;
+        masks->high |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(x) << shift;
+        masks->letter |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpgt_epi8(y, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), y))) << shift;
+        if (!_mm256_movemask_epi8(x)) {
+            continue;
+        }
+        masks->geC0 |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(x, _mm256_set1_epi8((char)0xbf))) << shift;
+        masks->geC2 |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(x, _mm256_set1_epi8((char)0xc1))) << shift;
+        masks->geE0 |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(x, _mm256_set1_epi8((char)0xdf))) << shift;
+        masks->geF0 |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(x, _mm256_set1_epi8((char)0xef))) << shift;
+        masks->geF5 |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(x, _mm256_set1_epi8((char)0xf4))) << shift;
+        masks->special |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)0xe0)), _mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)0xed))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)0xf0)), _mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)0xf4))))) << shift;
+        masks->ef |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)0xef))) << shift;
+    }
+}
+
+#else
+
+// other cpus never select these
+void TextScanner::ClassifySse2(Masks *masks, const unsigned char *text) {
+    ClassifyScalar(masks, text);
+}
+
+void TextScanner::ClassifyAvx2(Masks *masks, const unsigned char *text) {
+    ClassifyScalar(masks, text);
+}
+
+#endif
+
+} // namespace voicemaker
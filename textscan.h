@@ -0,0 +1,69 @@
+#ifndef VOICEMAKER_TEXTSCAN_H
+#define VOICEMAKER_TEXTSCAN_H
+
+namespace voicemaker {
+
+// classification of utf-8 text by blocks of bytes, independent of node
+// blocks are classified by avx2 or sse2 if cpu has them, chosen at load
+class TextScanner {
+public:
+    const static int BLOCK = 64;
+    const static int SCALAR = 0;
+    const static int SSE2 = 1;
+    const static int AVX2 = 2;
+
+    // carried from block to next block
+    struct State {
+        // continuation bytes expected at start of next block
+        unsigned long long expected;
+        // last byte of block if it is checked with next byte, 0 if not
+        unsigned char lead;
+        int letter;
+    };
+
+    static void Begin(State *state);
+    // bit n of stops is set if byte n starts or ends a run of ascii letters, or leads full width form
+    // length is BLOCK except last block, returns 1 if text is not valid utf-8
+    static int Scan(unsigned long long *stops, State *state, const char *text, int length);
+    // returns 1 if text ends in middle of character
+    static int End(const State *state);
+    static int IsLetter(char c) {
+        return (unsigned char)((c | 0x20) - 'a') < 26;
+    }
+    // index of lowest set bit, bits must not be 0
+    static int LowestBit(unsigned long long bits);
+    // level used by Scan, Select fails with level cpu does not have
+    static int GetLevel();
+    static int Select(int level);
+    static const char *GetLevelName(int level);
+
+private:
+    // bit n is set if byte n is in class
+    struct Masks {
+        unsigned long long high;
+        unsigned long long geC0;
+        unsigned long long geC2;
+        unsigned long long geE0;
+        unsigned long long geF0;
+        unsigned long long geF5;
+        // e0, ed, f0 and f4 limit range of next byte
+        unsigned long long special;
+        unsigned long long ef;
+        unsigned long long letter;
+    };
+    typedef void (*Classifier)(Masks *masks, const unsigned char *text);
+
+    static Classifier classifier;
+    static int level;
+
+    static int Detect();
+    static int GetCpuLevel();
+    static void ClassifyScalar(Masks *masks, const unsigned char *text);
+    static void ClassifySse2(Masks *masks, const unsigned char *text);
+    static void ClassifyAvx2(Masks *masks, const unsigned char *text);
+    static int CheckSpecial(unsigned char lead, unsigned char next);
+};
+
+} // namespace voicemaker
+
+#endif
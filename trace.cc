@@ -0,0 +1,179 @@
+#include <unistd.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+using namespace std;
+
+namespace voicemaker {
+
+pthread_key_t TraceBuffer::requestIdKey;
+pthread_key_t TraceBuffer::threadKey;
+pthread_once_t TraceBuffer::keyOnce = PTHREAD_ONCE_INIT;
+int TraceBuffer::lastThread = 0;
+
+TraceBuffer::TraceBuffer() {
+    ring = NULL;
+    epoch = 0;
+    writers[0] = 0;
+    writers[1] = 0;
+    pthread_once(&keyOnce, TraceBuffer::CreateKeys);
+}
+
+TraceBuffer::~TraceBuffer() {
+    free(ring);
+}
+
+void TraceBuffer::CreateKeys() {
+    pthread_key_create(&requestIdKey, free);
+    pthread_key_create(&threadKey, NULL);
+}
+
+int TraceBuffer::GetThread() {
+    long thread = (long)pthread_getspecific(threadKey);
+
+    // small number is easier to read in viewer than pthread_t
+    if (thread == 0) {
+        thread = __sync_add_and_fetch(&lastThread, 1);
+        pthread_setspecific(threadKey, (void *)thread);
+    }
+
+    return (int)thread;
+}
+
+int TraceBuffer::SetCapacity(int newCapacity) {
+    Ring *newRing = NULL;
+    Ring *oldRing;
+    unsigned int oldEpoch;
+    int i;
+
+    if (newCapacity < 0) {
+        return 1;
+    }
+    if (newCapacity > 0) {
+        newRing = (Ring *)calloc(1, sizeof(Ring) + (size_t)(newCapacity - 1) * sizeof(Event));
+        if (newRing == NULL) {
+            return 2;
+        }
+        newRing->capacity = newCapacity;
+    }
+    __sync_synchronize();
+    oldRing = __sync_lock_test_and_set(&ring, newRing);
+    // grace period, Add started after the swap sees new ring
+    // both counters are drained since Add may count itself in epoch read long before
+    for (i = 0; i < 2; i++) {
+        oldEpoch = __sync_fetch_and_add(&epoch, 1);
+        while (__sync_fetch_and_add(&writers[oldEpoch & 1], 0) != 0) {
+            sched_yield();
+        }
+    }
+    __sync_synchronize();
+    free(oldRing);
+
+    return 0;
+}
+
+int TraceBuffer::IsEnabled() {
+    return ring != NULL;
+}
+
+void TraceBuffer::SetRequestId(const char *requestId) {
+    char *oldRequestId = (char *)pthread_getspecific(requestIdKey);
+    char *newRequestId = NULL;
+
+    if (requestId) {
+        newRequestId = strndup(requestId, REQUEST_ID_MAX_LENGTH);
+    }
+    pthread_setspecific(requestIdKey, newRequestId);
+    free(oldRequestId);
+}
+
+void TraceBuffer::Add(const char *name, unsigned long long start, unsigned long long duration, int count) {
+    unsigned long long index;
+    const char *requestId;
+    unsigned int currentEpoch;
+    Ring *currentRing;
+    Event *event;
+
+    if (!IsEnabled()) {
+        return;
+    }
+    currentEpoch = epoch;
+    __sync_fetch_and_add(&writers[currentEpoch & 1], 1);
+    currentRing = ring;
+    if (currentRing == NULL) {
+        __sync_fetch_and_sub(&writers[currentEpoch & 1], 1);
+        return;
+    }
+    // oldest event is overwritten
+    index = __sync_fetch_and_add(&currentRing->next, 1);
+    event = &currentRing->events[index % currentRing->capacity];
+    event->sequence = 0;
+    __sync_synchronize();
+    event->name = name;
+    event->start = start;
+    event->duration = duration;
+    event->count = count;
+    event->thread = GetThread();
+    requestId = (const char *)pthread_getspecific(requestIdKey);
+    strncpy(event->requestId, requestId ? requestId : "", REQUEST_ID_MAX_LENGTH);
+    event->requestId[REQUEST_ID_MAX_LENGTH] = '\0';
+    __sync_synchronize();
+    event->sequence = index + 1;
+    __sync_fetch_and_sub(&writers[currentEpoch & 1], 1);
+}
+
+void TraceBuffer::AppendEscaped(string *out, const char *text) {
+    char escaped[8];
+
+    for (; *text; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\') {
+            out->push_back('\\');
+            out->push_back(c);
+        } else if (c < 0x20) {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out->append(escaped);
+        } else {
+            out->push_back(c);
+        }
+    }
+}
+
+void TraceBuffer::WriteJson(string *out) {
+    unsigned long long first;
+    unsigned long long last;
+    unsigned long long index;
+    char line[160];
+    int pid = getpid();
+    int written = 0;
+    // ring is only freed by SetCapacity on this thread
+    Ring *currentRing = ring;
+
+    out->append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    last = currentRing ? currentRing->next : 0;
+    first = (currentRing && last > (unsigned long long)currentRing->capacity) ? last - currentRing->capacity : 0;
+    for (index = first; index < last; index++) {
+        Event event = currentRing->events[index % currentRing->capacity];
+        __sync_synchronize();
+        // event is being written or already overwritten
+        if (event.sequence != index + 1 || currentRing->events[index % currentRing->capacity].sequence != index + 1) {
+            continue;
+        }
+        // timestamps of chrome trace are microseconds
+        snprintf(line, sizeof(line), "%s{\"ph\":\"X\",\"cat\":\"voicemaker\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"",
+                 written ? "," : "", pid, event.thread, event.start / 1000.0, event.duration / 1000.0);
+        out->append(line);
+        AppendEscaped(out, event.name);
+        out->append("\",\"args\":{\"requestId\":\"");
+        AppendEscaped(out, event.requestId);
+        snprintf(line, sizeof(line), "\",\"count\":%d}}", event.count);
+        out->append(line);
+        written++;
+    }
+    out->append("]}");
+}
+
+} // namespace voicemaker
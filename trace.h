@@ -0,0 +1,61 @@
+#ifndef VOICEMAKER_TRACE_H
+#define VOICEMAKER_TRACE_H
+
+#include <pthread.h>
+#include <string>
+
+namespace voicemaker {
+
+// ring buffer of trace events, dumped as chrome trace event json
+class TraceBuffer {
+public:
+    const static int REQUEST_ID_MAX_LENGTH = 63;
+
+    // 0 disables tracing, events are dropped
+    // SetCapacity and WriteJson are called from one thread
+    int SetCapacity(int capacity);
+    int IsEnabled();
+    // request id of events added by calling thread, NULL clears
+    void SetRequestId(const char *requestId);
+    // complete event of start and duration in nanoseconds, lock free
+    void Add(const char *name, unsigned long long start, unsigned long long duration, int count);
+    void WriteJson(std::string *out);
+
+    TraceBuffer();
+    ~TraceBuffer();
+private:
+    struct Event {
+        // index of event plus one, 0 while writing
+        volatile unsigned long long sequence;
+        const char *name;
+        unsigned long long start;
+        unsigned long long duration;
+        int count;
+        int thread;
+        char requestId[REQUEST_ID_MAX_LENGTH + 1];
+    };
+    // replaced as a whole when capacity is changed
+    struct Ring {
+        unsigned long long next;
+        int capacity;
+        Event events[1];
+    };
+    Ring * volatile ring;
+    // Add counts itself in writers of epoch it started in,
+    // old ring is freed after writers of previous epoch have left
+    volatile unsigned int epoch;
+    volatile int writers[2];
+
+    static pthread_key_t requestIdKey;
+    static pthread_key_t threadKey;
+    static pthread_once_t keyOnce;
+    static int lastThread;
+
+    static void CreateKeys();
+    static int GetThread();
+    static void AppendEscaped(std::string *out, const char *text);
+};
+
+} // namespace voicemaker
+
+#endif
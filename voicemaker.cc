@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <regex.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -7,534 +8,1019 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <list>
+#include <vector>
+#include <map>
+#include <string>
 #include <v8.h>
 #include <node.h>
-#include <AquesTalk2.h>
+#include <node_version.h>
+#include <node_buffer.h>
 #include <mecab.h>
+#include "dictionary.h"
+#include "shared_cache.h"
+#include "stats.h"
+#include "trace.h"
+#include "slowlog.h"
+#include "reading.h"
+#include "synthesizer.h"
+#include "arena.h"
 
 using namespace v8;
 using namespace node;
 using namespace MeCab;
 using namespace std;
+using namespace voicemaker;
 
 namespace {
 
-class WordPair {
+class MecabModel {
 public:
-    const static int WORD_MAX_LENGTH = 512;
-    int Get(char **src, int *srcLen, char **dst, int *dstLen);
-    int GetSrc(char **src, int *srcLen);
-    int Set(const char *src, int srcLen, const char *dst, int dstLen);
+    // tagger and lattice of calling thread
+    static int GetTagger(mecab_t **tagger, mecab_lattice_t **lattice);
 
-    WordPair();
-    ~WordPair();
 private:
-    char *src;
-    int srcLen;
-    char *dst;
-    int dstLen;
+    struct ThreadTagger {
+        mecab_t *tagger;
+        mecab_lattice_t *lattice;
+    };
+    static pthread_once_t modelOnce;
+    static pthread_key_t taggerKey;
+    static mecab_model_t *model;
+
+    static void InitializeModel();
+    static void DestroyThreadTagger(void *threadTagger);
 };
 
-WordPair::WordPair() {
-    src = NULL;
-    srcLen = 0;
-    dst = NULL;
-    dstLen = 0;
+pthread_once_t MecabModel::modelOnce = PTHREAD_ONCE_INIT;
+pthread_key_t MecabModel::taggerKey;
+mecab_model_t *MecabModel::model = NULL;
+
+void MecabModel::InitializeModel() {
+    int argc = 1;
+    char *argv[] = { (char *)"voicemaker" };
+
+    if (pthread_key_create(&taggerKey, MecabModel::DestroyThreadTagger)) {
+        return;
+    }
+    model = mecab_model_new(argc, argv);
 }
 
-WordPair::~WordPair() {
-    free(src);
-    free(dst);
+void MecabModel::DestroyThreadTagger(void *threadTagger) {
+    ThreadTagger *t = (ThreadTagger *)threadTagger;
+
+    if (t == NULL) {
+        return;
+    }
+    if (t->lattice) {
+        mecab_lattice_destroy(t->lattice);
+    }
+    if (t->tagger) {
+        mecab_destroy(t->tagger);
+    }
+    free(t);
 }
 
-int WordPair::Get(char **src, int *srcLen, char **dst, int *dstLen) {
-    if (src == NULL ||
-        srcLen == 0 ||
-        dst == NULL ||
-        dstLen == 0) {
+int MecabModel::GetTagger(mecab_t **tagger, mecab_lattice_t **lattice) {
+    ThreadTagger *t;
+
+    if (tagger == NULL ||
+        lattice == NULL) {
         return 1;
     }
-    *src = this->src;
-    *srcLen = this->srcLen;
-    *dst = this->dst;
-    *dstLen = this->dstLen;
+    pthread_once(&modelOnce, MecabModel::InitializeModel);
+    if (model == NULL) {
+        return 2;
+    }
+    t = (ThreadTagger *)pthread_getspecific(taggerKey);
+    if (t == NULL) {
+        t = (ThreadTagger *)malloc(sizeof(ThreadTagger));
+        if (t == NULL) {
+            return 3;
+        }
+        t->tagger = mecab_model_new_tagger(model);
+        t->lattice = mecab_model_new_lattice(model);
+        if (t->tagger == NULL || t->lattice == NULL) {
+            DestroyThreadTagger(t);
+            return 4;
+        }
+        if (pthread_setspecific(taggerKey, t)) {
+            DestroyThreadTagger(t);
+            return 5;
+        }
+    }
+    *tagger = t->tagger;
+    *lattice = t->lattice;
 
     return 0;
 }
 
-int WordPair::GetSrc(char **src, int *srcLen) {
-    if (src == NULL ||
-        srcLen == 0) {
-        return 1;
-    }
-    *src = this->src;
-    *srcLen = this->srcLen;
+class Phont {
+public:
+    static int Map(Phont **phont, const char *path);
+    void Ref();
+    void Unref();
+    void *GetData();
+    // same file gives same id
+    unsigned long long GetId();
+    int IsModified(const struct stat *st);
 
-    return 0;
+private:
+    int refCount;
+    void *data;
+    size_t size;
+    time_t mtime;
+    ino_t ino;
+    dev_t dev;
+
+    Phont();
+    ~Phont();
+};
+
+Phont::Phont() {
+    refCount = 1;
+    data = MAP_FAILED;
+    size = 0;
+    mtime = 0;
+    ino = 0;
+    dev = 0;
 }
 
-int WordPair::Set(const char *src, int srcLen, const char *dst, int dstLen) {
-    char *tmpSrc = NULL;
-    char *tmpDst = NULL;
-    if (src == NULL ||
-        srcLen == 0 ||
-        dst == NULL ||
-        dstLen == 0) {
-        return 1;
+Phont::~Phont() {
+    if (data != MAP_FAILED) {
+        munmap(data, size);
     }
-    tmpSrc = (char *)malloc(srcLen + 1);
-    if (tmpSrc == NULL) {
+}
+
+int Phont::Map(Phont **phont, const char *path) {
+    struct stat st;
+    int fd;
+    Phont *newPhont;
+
+    if (phont == NULL ||
+        path == NULL) {
         return 1;
     }
-    tmpDst = (char *)malloc(dstLen + 1);
-    if (tmpDst == NULL)  {
-        free(tmpSrc);
-        return 1;
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return 2;
     }
-    memcpy(tmpSrc, src, srcLen);
-    tmpSrc[srcLen] = '\0';
-    memcpy(tmpDst, dst, dstLen);
-    tmpDst[dstLen] = '\0';
-    this->src = tmpSrc;
-    this->srcLen = srcLen;
-    this->dst = tmpDst;
-    this->dstLen = dstLen;
+    if (fstat(fd, &st) != 0 || st.st_size < 1) {
+        close(fd);
+        return 3;
+    }
+    newPhont = new Phont();
+    newPhont->size = (size_t)st.st_size;
+    newPhont->mtime = st.st_mtime;
+    newPhont->ino = st.st_ino;
+    newPhont->dev = st.st_dev;
+    newPhont->data = mmap(NULL, newPhont->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (newPhont->data == MAP_FAILED) {
+        delete newPhont;
+        return 4;
+    }
+    *phont = newPhont;
 
     return 0;
 }
 
-class Dictionary  {
+void Phont::Ref() {
+    __sync_add_and_fetch(&refCount, 1);
+}
+
+void Phont::Unref() {
+    if (__sync_sub_and_fetch(&refCount, 1) == 0) {
+        delete this;
+    }
+}
+
+void *Phont::GetData() {
+    return data;
+}
+
+unsigned long long Phont::GetId() {
+    unsigned long long id = 14695981039346656037ULL;
+
+    id = (id ^ (unsigned long long)dev) * 1099511628211ULL;
+    id = (id ^ (unsigned long long)ino) * 1099511628211ULL;
+    id = (id ^ (unsigned long long)size) * 1099511628211ULL;
+    id = (id ^ (unsigned long long)mtime) * 1099511628211ULL;
+
+    return id;
+}
+
+int Phont::IsModified(const struct stat *st) {
+    return (size_t)st->st_size != size || st->st_mtime != mtime || st->st_ino != ino || st->st_dev != dev;
+}
+
+class PhontRegistry {
 public:
-    const static int PREFERRED = 1;
-    const static int FILTER = 2;
-    int SetDictionaryPath(const char *preferredDictionaryPath, const char *filterDictionary);
-    int LoadDictionary();
-    int SaveDictionary();
-    // preferred dictionary or filter dictionary
-    int AddWordPair(const char *src, int srcLen, const char *dst, int dstLen, int dictType);
-    // preferred dictionary or filter dictionary
-    int DelWordPair(const char *src, int srcLen, int dictType);
-    // preferred dictionary only
-    int GetDstWord(const char *src, int srcLen, char **dst, int *dstLen);
-    // filter dictionary only
-    int GetWordPairBegin(list<WordPair *>::iterator *wordPairIterator);
-    int GetWordPairNext(char **src, int *srcLen, char **dst, int *dstLen, list<WordPair *>::iterator *wordPairIterator);
-    // preferred dictionary or filter dictionary
-    int GetExtensionRatio(int *ratio, int dictType);
-
-
-    Dictionary();
-    ~Dictionary();
+    // phont file is checked for update at most once in interval (ns)
+    const static unsigned long long CHECK_INTERVAL = 1000000000ULL;
+    // least recently used voices registered by path are dropped over this
+    const static int PATH_VOICES_MAX = 16;
+
+    int Register(const char *name, const char *path);
+    int Unregister(const char *name);
+    int Reload(const char *name);
+    // name of registered voice or path of phont file, release with Phont::Unref
+    int Acquire(Phont **phont, const char *nameOrPath);
+
+    PhontRegistry();
+    ~PhontRegistry();
 private:
-    int hashSize;
-    char *preferredDictionaryPath;
-    char *filterDictionaryPath;
-    list<WordPair *> *preferredDictionary;
-    list<WordPair *> *filterDictionary;
-    int preferredExtensionRatio;
-    int filterExtensionRatio;
- 
-    int GetHashValue(const char *key, int keyLen);
-    int ClearDictionary(int dictType);
+    struct Voice {
+        char *name;
+        char *path;
+        Phont *phont;
+        int byPath;
+        unsigned long long checked;
+        unsigned long long used;
+    };
+    list<Voice *> voices;
+    int pathVoices;
+    unsigned long long lastUsed;
+    pthread_mutex_t mutex;
+
+    Voice *FindVoice(const char *name);
+    int NewVoice(Voice **voice, const char *name, const char *path, Phont *phont);
+    void DeleteVoice(Voice *voice);
+    void AddVoice(Voice *voice);
+    void RemoveVoice(Voice *voice);
+    void ReplacePhont(const char *name, Phont *oldPhont, Phont *newPhont);
+    int Update(Phont **phont, const char *path);
 };
 
-Dictionary::Dictionary() {
-    hashSize = 5003;
-    preferredDictionaryPath = NULL;
-    filterDictionaryPath = NULL;
-    preferredExtensionRatio = 2;
-    filterExtensionRatio = 2;
-    preferredDictionary = new list<WordPair *>[hashSize];
-    filterDictionary = new list<WordPair *>;
+PhontRegistry::PhontRegistry() {
+    pathVoices = 0;
+    lastUsed = 0;
+    pthread_mutex_init(&mutex, NULL);
 }
 
-Dictionary::~Dictionary() {
-    int i;
-    // preferred dictionary
-    for (i = 0; i < hashSize; i++) {
-        list<WordPair *>::iterator wordPairIterator = preferredDictionary[i].begin();
-        while (wordPairIterator != preferredDictionary[i].end()) {
-             WordPair *wordPair = *wordPairIterator;
-             wordPairIterator = preferredDictionary[i].erase(wordPairIterator);
-             delete wordPair;
-        }
-    }
-    delete [] preferredDictionary;
-    free(preferredDictionaryPath);
-    // filter dictionary
-    list<WordPair *>::iterator wordPairIterator = filterDictionary->begin();
-    while (wordPairIterator != filterDictionary->end()) {
-         WordPair *wordPair = *wordPairIterator;
-         wordPairIterator = filterDictionary->erase(wordPairIterator);
-         delete wordPair;
+PhontRegistry::~PhontRegistry() {
+    list<Voice *>::iterator voiceIterator = voices.begin();
+    while (voiceIterator != voices.end()) {
+        Voice *voice = *voiceIterator;
+        voiceIterator = voices.erase(voiceIterator);
+        DeleteVoice(voice);
     }
-    delete filterDictionary;
-    free(filterDictionaryPath);
+    pthread_mutex_destroy(&mutex);
 }
 
-int Dictionary::GetHashValue(const char *key, int keyLen) {
-    unsigned int v = keyLen;
+PhontRegistry::Voice *PhontRegistry::FindVoice(const char *name) {
+    list<Voice *>::iterator voiceIterator = voices.begin();
+    while (voiceIterator != voices.end()) {
+        if (strcmp((*voiceIterator)->name, name) == 0) {
+            return *voiceIterator;
+        }
+        voiceIterator++;
+    }
+
+    return NULL;
+}
 
-    for (int i = 0; i < keyLen; i++) {
-       v = v * 31 + key[i];
+int PhontRegistry::NewVoice(Voice **voice, const char *name, const char *path, Phont *phont) {
+    Voice *newVoice;
+
+    newVoice = new Voice();
+    newVoice->name = strdup(name);
+    newVoice->path = strdup(path);
+    newVoice->phont = NULL;
+    newVoice->byPath = 0;
+    newVoice->checked = ConvertStats::Now();
+    newVoice->used = 0;
+    if (newVoice->name == NULL || newVoice->path == NULL) {
+        DeleteVoice(newVoice);
+        return 5;
     }
-    return (int)(v % hashSize);
+    newVoice->phont = phont;
+    *voice = newVoice;
+
+    return 0;
 }
 
-int Dictionary::ClearDictionary(int dictType) {
-    int i;
-    if (dictType != PREFERRED && dictType != FILTER) {
-        return 1;
+void PhontRegistry::DeleteVoice(Voice *voice) {
+    if (voice->phont) {
+        voice->phont->Unref();
     }
-    if (dictType == PREFERRED) {
-        for (i = 0; i < hashSize; i++) {
-            list<WordPair *>::iterator wordPairIterator = preferredDictionary[i].begin();
-            while (wordPairIterator != preferredDictionary[i].end()) {
-                WordPair *wordPair = *wordPairIterator;
-                wordPairIterator = preferredDictionary[i].erase(wordPairIterator);
-                delete wordPair;
+    free(voice->name);
+    free(voice->path);
+    delete voice;
+}
+
+void PhontRegistry::AddVoice(Voice *voice) {
+    list<Voice *>::iterator voiceIterator;
+    Voice *oldest;
+
+    voice->used = ++lastUsed;
+    voices.push_back(voice);
+    if (!voice->byPath) {
+        return;
+    }
+    pathVoices++;
+    while (pathVoices > PATH_VOICES_MAX) {
+        oldest = NULL;
+        for (voiceIterator = voices.begin(); voiceIterator != voices.end(); voiceIterator++) {
+            if ((*voiceIterator)->byPath && (oldest == NULL || (*voiceIterator)->used < oldest->used)) {
+                oldest = *voiceIterator;
             }
         }
+        RemoveVoice(oldest);
     }
-    if (dictType == FILTER) {
-        list<WordPair *>::iterator wordPairIterator = filterDictionary->begin();
-        while (wordPairIterator != filterDictionary->end()) {
-            WordPair *wordPair = *wordPairIterator;
-            wordPairIterator = filterDictionary->erase(wordPairIterator);
-            delete wordPair;
-        }
+}
+
+void PhontRegistry::RemoveVoice(Voice *voice) {
+    if (voice->byPath) {
+        pathVoices--;
     }
+    voices.remove(voice);
+    DeleteVoice(voice);
+}
 
-    return 0;
+void PhontRegistry::ReplacePhont(const char *name, Phont *oldPhont, Phont *newPhont) {
+    Voice *voice;
+
+    // voice may be unregistered or registered again while mutex is unlocked
+    if ((voice = FindVoice(name)) && voice->phont == oldPhont) {
+        newPhont->Ref();
+        voice->phont->Unref();
+        voice->phont = newPhont;
+    }
 }
 
-int Dictionary::LoadDictionary() {
-    int error = 0;
-    FILE *fp;
-    char line[(WordPair::WORD_MAX_LENGTH * 2) + 2];
-    const char *preferredPath = "./voicemaker_preferred.dict";
-    const char *filterPath = "./voicemaker_filter.dict";
-    int dictTypes[] = { PREFERRED, FILTER };
-    int i;
+int PhontRegistry::Update(Phont **phont, const char *path) {
+    struct stat st;
+    Phont *newPhont;
+    int result;
 
-    if (preferredDictionaryPath) {
-        preferredPath = preferredDictionaryPath;
-    } 
-    if (filterDictionaryPath) {
-        filterPath = filterDictionaryPath;
-    } 
-    for (i = 0; i < sizeof(dictTypes)/sizeof(dictTypes[0]) && !error; i++) {
-        if (ClearDictionary(dictTypes[i])) {
-            return 1;
-        }
-        if (dictTypes[i] == PREFERRED) {
-            fp = fopen(preferredPath, "r");
-        } else if (dictTypes[i] == FILTER) {
-            fp = fopen(filterPath, "r");
-        }
-        if (fp == NULL) {
-            return 2;
-        }
-        while(fgets(line, sizeof(line), fp)) { 
-            char *srcStartPtr = NULL;
-            char *dstStartPtr = NULL;
-            char *endPtr = NULL;
-            if (*line == '\0') {
-                continue;
-            }
-            srcStartPtr = line;
-            dstStartPtr = strchr(line, ' ');
-            if (!dstStartPtr) {
-                continue;
-            }
-            *dstStartPtr = '\0';
-            dstStartPtr++;
-            endPtr = strchr(dstStartPtr, '\n');
-            if (endPtr) {
-                *endPtr = '\0';
-            }
-            if (*srcStartPtr == '\0' || *dstStartPtr == '\0') {
-                continue;
-            }
-            if (AddWordPair(srcStartPtr, strlen(srcStartPtr), dstStartPtr, strlen(dstStartPtr), dictTypes[i])) {
-                error = 3;
-            }
-        }
-        fclose(fp);
+    // called without mutex, phont is referenced by caller
+    if (stat(path, &st) != 0 || !(*phont)->IsModified(&st)) {
+        return 0;
+    }
+    if ((result = Phont::Map(&newPhont, path))) {
+        return result;
     }
+    (*phont)->Unref();
+    *phont = newPhont;
 
-    return error;
+    return 0;
 }
 
-int Dictionary::SaveDictionary() {
-    int error = 0;
-    FILE *fp;
-    const char *preferredPath = "./voicemaker_preferred.dict";
-    const char *filterPath = "./voicemaker_filter.dict";
+int PhontRegistry::Register(const char *name, const char *path) {
+    Voice *voice;
+    Voice *oldVoice;
+    Phont *phont;
+    int result;
 
-    if (preferredDictionaryPath) {
-        preferredPath = preferredDictionaryPath;
-    } 
-    if (filterDictionaryPath) {
-        filterPath = filterDictionaryPath;
-    } 
-    // preferred dictionary
-    fp = fopen(preferredPath, "w+");
-    if (fp == NULL) {
+    if (name == NULL ||
+        path == NULL) {
         return 1;
     }
-    for (int i = 0; i < hashSize; i++) {
-        list<WordPair *>::iterator wordPairIterator = preferredDictionary[i].begin();
-        while (wordPairIterator != preferredDictionary[i].end()) {
-            char *dicSrc;
-            int dicSrcLen;
-            char *dicDst;
-            int dicDstLen;
-            WordPair *wordPair = *wordPairIterator;
-            if (wordPair->Get(&dicSrc, &dicSrcLen, &dicDst, &dicDstLen)) {
-                error = 2;
-            }
-            fwrite(dicSrc, (size_t)dicSrcLen, 1, fp);
-            fwrite(" ", 1, 1, fp);
-            fwrite(dicDst,(size_t) dicDstLen, 1, fp);
-            fwrite("\n", 1, 1, fp);
-            wordPairIterator++;
-        }
+    if ((result = Phont::Map(&phont, path))) {
+        return result;
+    }
+    if ((result = NewVoice(&voice, name, path, phont))) {
+        phont->Unref();
+        return result;
+    }
+    pthread_mutex_lock(&mutex);
+    if ((oldVoice = FindVoice(name))) {
+        RemoveVoice(oldVoice);
     }
-    fclose(fp);
+    AddVoice(voice);
+    pthread_mutex_unlock(&mutex);
 
-    // filter dictionary
-    fp = fopen(filterPath, "w+");
-    if (fp == NULL) {
+    return 0;
+}
+
+int PhontRegistry::Unregister(const char *name) {
+    Voice *voice;
+
+    if (name == NULL) {
         return 1;
     }
-    list<WordPair *>::iterator wordPairIterator = filterDictionary->begin();
-    while (wordPairIterator != filterDictionary->end()) {
-        char *dicSrc;
-        int dicSrcLen;
-        char *dicDst;
-        int dicDstLen;
-        WordPair *wordPair = *wordPairIterator;
-        if (wordPair->Get(&dicSrc, &dicSrcLen, &dicDst, &dicDstLen)) {
-            error = 2;
-        }
-        fwrite(dicSrc, (size_t)dicSrcLen, 1, fp);
-        fwrite(" ", 1, 1, fp);
-        fwrite(dicDst,(size_t) dicDstLen, 1, fp);
-        fwrite("\n", 1, 1, fp);
-        wordPairIterator++;
+    pthread_mutex_lock(&mutex);
+    if ((voice = FindVoice(name)) == NULL) {
+        pthread_mutex_unlock(&mutex);
+        return 6;
     }
-    fclose(fp);
+    RemoveVoice(voice);
+    pthread_mutex_unlock(&mutex);
 
-    return error;
+    return 0;
 }
 
-int Dictionary::SetDictionaryPath(const char* preferredDictionaryPath, const char* filterDictionaryPath) {
-    if (preferredDictionaryPath == NULL ||
-        filterDictionary == NULL) {
+int PhontRegistry::Reload(const char *name) {
+    Voice *voice;
+    Phont *oldPhont;
+    Phont *phont;
+    char *path;
+    int result;
+
+    if (name == NULL) {
         return 1;
     }
-    free(this->preferredDictionaryPath);
-    this->preferredDictionaryPath = strdup(preferredDictionaryPath);
-    if (this->preferredDictionaryPath == NULL) {
-        return 2;
+    pthread_mutex_lock(&mutex);
+    if ((voice = FindVoice(name)) == NULL) {
+        pthread_mutex_unlock(&mutex);
+        return 6;
     }
-    free(this->filterDictionaryPath);
-    this->filterDictionaryPath = strdup(filterDictionaryPath);
-    if (this->filterDictionaryPath == NULL) {
-        return 3;
+    oldPhont = voice->phont;
+    oldPhont->Ref();
+    path = strdup(voice->path);
+    pthread_mutex_unlock(&mutex);
+    if (path == NULL) {
+        oldPhont->Unref();
+        return 5;
+    }
+    // file is mapped without mutex, conversions of other voices are not blocked
+    if ((result = Phont::Map(&phont, path)) == 0) {
+        pthread_mutex_lock(&mutex);
+        ReplacePhont(name, oldPhont, phont);
+        pthread_mutex_unlock(&mutex);
+        phont->Unref();
     }
+    oldPhont->Unref();
+    free(path);
 
-    return 0;
+    return result;
 }
 
-int Dictionary::AddWordPair(const char *src, int srcLen, const char *dst, int dstLen, int dictType) {
-    if (src == NULL ||
-        srcLen <= 0 ||
-        dst == NULL ||
-        dstLen <= 0 ||
-        (dictType != PREFERRED && dictType != FILTER)) {
+int PhontRegistry::Acquire(Phont **phont, const char *nameOrPath) {
+    unsigned long long now = ConvertStats::Now();
+    Voice *voice;
+    Voice *newVoice;
+    Phont *oldPhont;
+    Phont *newPhont;
+    char *path;
+    int result;
+
+    if (phont == NULL ||
+        nameOrPath == NULL) {
         return 1;
     }
-    if (dictType == PREFERRED) {
-        int hashValue = GetHashValue(src, srcLen);
-        WordPair *wordPair = new WordPair();
-        preferredDictionary[hashValue].push_front(wordPair);
-        if (wordPair->Set(src, srcLen, dst, dstLen)) {
-            return 1;
+    pthread_mutex_lock(&mutex);
+    if ((voice = FindVoice(nameOrPath))) {
+        voice->used = ++lastUsed;
+        voice->phont->Ref();
+        *phont = voice->phont;
+        if (now - voice->checked < CHECK_INTERVAL) {
+            pthread_mutex_unlock(&mutex);
+            return 0;
         }
-        if (dstLen / srcLen > preferredExtensionRatio) {
-            preferredExtensionRatio = (dstLen / srcLen) + 1;
+        // other threads use current phont until this one has checked file
+        voice->checked = now;
+        path = strdup(voice->path);
+        pthread_mutex_unlock(&mutex);
+        if (path == NULL) {
+            return 0;
         }
-    } else if (dictType == FILTER) {
-        WordPair *wordPair = new WordPair();
-        filterDictionary->push_back(wordPair);
-        if (wordPair->Set(src, srcLen, dst, dstLen)) {
-            return 1;
+        oldPhont = *phont;
+        oldPhont->Ref();
+        if ((result = Update(phont, path)) == 0 && *phont != oldPhont) {
+            pthread_mutex_lock(&mutex);
+            ReplacePhont(nameOrPath, oldPhont, *phont);
+            pthread_mutex_unlock(&mutex);
         }
-        if (dstLen / srcLen > filterExtensionRatio) {
-            filterExtensionRatio = (dstLen / srcLen) + 1;
+        oldPhont->Unref();
+        free(path);
+        if (result) {
+            (*phont)->Unref();
         }
+        return result;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    // unregistered phont file is registered by its path
+    if ((result = Phont::Map(&newPhont, nameOrPath))) {
+        return result;
+    }
+    if ((result = NewVoice(&newVoice, nameOrPath, nameOrPath, newPhont))) {
+        newPhont->Unref();
+        return result;
+    }
+    newVoice->byPath = 1;
+    pthread_mutex_lock(&mutex);
+    if ((voice = FindVoice(nameOrPath))) {
+        // other thread has registered it while file was mapped
+        DeleteVoice(newVoice);
+    } else {
+        voice = newVoice;
+        AddVoice(voice);
     }
+    voice->used = ++lastUsed;
+    voice->phont->Ref();
+    *phont = voice->phont;
+    pthread_mutex_unlock(&mutex);
 
     return 0;
 }
 
-int Dictionary::DelWordPair(const char *src, int srcLen, int dictType) {
-    if (src == NULL ||
-        srcLen <= 0 ||
-        (dictType != PREFERRED && dictType != FILTER)) {
-        return 1;
+// cache of waves or reading texts
+class ConvertCache {
+public:
+    struct Stats {
+        size_t size;
+        size_t maxSize;
+        int entries;
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long evictions;
+        unsigned long long invalidations;
+    };
+
+    // 0 disables cache, entries over new size are evicted
+    void SetMaxSize(size_t maxSize);
+    // data is copied, free with free
+    int Get(unsigned char **data, int *dataLen, const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version);
+    // entry of other version than current is ignored
+    void Put(const unsigned char *data, int dataLen, const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version);
+    // entries of other version are dropped
+    void Invalidate(unsigned long long version);
+    void GetStats(Stats *stats);
+
+    ConvertCache();
+    ~ConvertCache();
+private:
+    struct Entry {
+        unsigned long long hash;
+        char *text;
+        int textLength;
+        int speed;
+        unsigned long long phontId;
+        unsigned long long version;
+        unsigned char *data;
+        int dataLen;
+        size_t size;
+    };
+    // front is most recently used
+    list<Entry *> entries;
+    map<unsigned long long, list<Entry *>::iterator> index;
+    size_t size;
+    size_t maxSize;
+    unsigned long long version;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long invalidations;
+    pthread_mutex_t mutex;
+
+    static unsigned long long GetHashValue(const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version);
+    void Evict(list<Entry *>::iterator entryIterator);
+    void DeleteEntry(Entry *entry);
+};
+
+ConvertCache::ConvertCache() {
+    size = 0;
+    maxSize = 0;
+    version = 0;
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+    invalidations = 0;
+    pthread_mutex_init(&mutex, NULL);
+}
+
+ConvertCache::~ConvertCache() {
+    while (!entries.empty()) {
+        DeleteEntry(entries.front());
+        entries.pop_front();
     }
-    if (dictType == PREFERRED) {
-        int hashValue = GetHashValue(src, srcLen);
-        list<WordPair *>::iterator wordPairIterator = preferredDictionary[hashValue].begin();
-        while (wordPairIterator != preferredDictionary[hashValue].end()) {
-             char *dicSrc;
-             int dicSrcLen;
-             WordPair *wordPair = *wordPairIterator;
-             if (wordPair->GetSrc(&dicSrc, &dicSrcLen)) {
-                 return 1;
-             }
-             if (dicSrcLen == srcLen && strncmp(dicSrc, src, srcLen) == 0) {
-                 wordPairIterator = preferredDictionary[hashValue].erase(wordPairIterator);
-                 delete wordPair;
-             } else {
-                 wordPairIterator++;
-             }
-        }
-    } else if (dictType == FILTER) {
-        list<WordPair *>::iterator wordPairIterator = filterDictionary->begin();
-        while (wordPairIterator != filterDictionary->end()) {
-             char *dicSrc;
-             int dicSrcLen;
-             WordPair *wordPair = *wordPairIterator;
-             if (wordPair->GetSrc(&dicSrc, &dicSrcLen)) {
-                 return 1;
-             }
-             if (dicSrcLen == srcLen && strncmp(dicSrc, src, srcLen) == 0) {
-                 wordPairIterator = filterDictionary->erase(wordPairIterator);
-                 delete wordPair;
-             } else {
-                 wordPairIterator++;
-             }
-        }
+    pthread_mutex_destroy(&mutex);
+}
+
+unsigned long long ConvertCache::GetHashValue(const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long version) {
+    unsigned long long hash = 14695981039346656037ULL;
+    int i;
+
+    // fnv-1a
+    for (i = 0; i < textLength; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
     }
+    hash = (hash ^ (unsigned int)speed) * 1099511628211ULL;
+    hash = (hash ^ phontId) * 1099511628211ULL;
+    hash = (hash ^ version) * 1099511628211ULL;
 
-    return 0;
+    return hash;
+}
+
+void ConvertCache::DeleteEntry(Entry *entry) {
+    free(entry->text);
+    free(entry->data);
+    delete entry;
+}
+
+void ConvertCache::Evict(list<Entry *>::iterator entryIterator) {
+    Entry *entry = *entryIterator;
+
+    index.erase(entry->hash);
+    size -= entry->size;
+    entries.erase(entryIterator);
+    DeleteEntry(entry);
+}
+
+void ConvertCache::SetMaxSize(size_t newMaxSize) {
+    pthread_mutex_lock(&mutex);
+    maxSize = newMaxSize;
+    while (size > maxSize) {
+        Evict(--entries.end());
+        evictions++;
+    }
+    pthread_mutex_unlock(&mutex);
 }
 
-int Dictionary::GetDstWord(const char *src, int srcLen, char **dst, int *dstLen) {
-    if (src == NULL ||
-        srcLen <= 0 ||
-        dst == NULL ||
-        dstLen == NULL) {
+int ConvertCache::Get(unsigned char **data, int *dataLen, const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long entryVersion) {
+    unsigned long long hash;
+    map<unsigned long long, list<Entry *>::iterator>::iterator indexIterator;
+    Entry *entry;
+    unsigned char *newData;
+
+    if (data == NULL ||
+        dataLen == NULL ||
+        text == NULL) {
         return 1;
     }
-    char copySrc[WordPair::WORD_MAX_LENGTH];
-    strncpy(copySrc, src, sizeof(copySrc));
-    copySrc[sizeof(copySrc) - 1] = '\0';
-    int hashValue = GetHashValue(copySrc, srcLen);
-    list<WordPair *>::iterator wordPairIterator = preferredDictionary[hashValue].begin();
-    while (wordPairIterator != preferredDictionary[hashValue].end()) {
-         char *dicSrc;
-         int dicSrcLen;
-         char *dicDst;
-         int dicDstLen;
-         WordPair *wordPair = *wordPairIterator;
-         wordPair->Get(&dicSrc, &dicSrcLen, &dicDst, &dicDstLen);
-         if (dicSrcLen == srcLen && strncmp(dicSrc, copySrc, srcLen) == 0) {
-              *dst = dicDst;
-              *dstLen = dicDstLen;
-              return 0;
-         }
-         wordPairIterator++; 
+    hash = GetHashValue(text, textLength, speed, phontId, entryVersion);
+    pthread_mutex_lock(&mutex);
+    if (maxSize == 0) {
+        pthread_mutex_unlock(&mutex);
+        return 2;
+    }
+    indexIterator = index.find(hash);
+    if (indexIterator == index.end()) {
+        misses++;
+        pthread_mutex_unlock(&mutex);
+        return 2;
+    }
+    entry = *indexIterator->second;
+    if (entry->textLength != textLength ||
+        entry->speed != speed ||
+        entry->phontId != phontId ||
+        entry->version != entryVersion ||
+        memcmp(entry->text, text, textLength) != 0) {
+        misses++;
+        pthread_mutex_unlock(&mutex);
+        return 2;
     }
+    newData = (unsigned char *)malloc(entry->dataLen);
+    if (newData == NULL) {
+        pthread_mutex_unlock(&mutex);
+        return 3;
+    }
+    memcpy(newData, entry->data, entry->dataLen);
+    *data = newData;
+    *dataLen = entry->dataLen;
+    entries.splice(entries.begin(), entries, indexIterator->second);
+    hits++;
+    pthread_mutex_unlock(&mutex);
 
-    return 1;
+    return 0;
 }
 
-int Dictionary::GetWordPairBegin(list<WordPair *>::iterator *wordPairIterator) {
-    if (wordPairIterator == NULL) {
-        return 1;
+void ConvertCache::Put(const unsigned char *data, int dataLen, const char *text, int textLength, int speed, unsigned long long phontId, unsigned long long entryVersion) {
+    map<unsigned long long, list<Entry *>::iterator>::iterator indexIterator;
+    Entry *entry;
+    size_t entrySize;
+
+    if (data == NULL ||
+        dataLen < 1 ||
+        text == NULL) {
+        return;
+    }
+    entrySize = sizeof(Entry) + textLength + dataLen;
+    pthread_mutex_lock(&mutex);
+    // converted with old dictionary
+    if (entrySize > maxSize || entryVersion != version) {
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    pthread_mutex_unlock(&mutex);
+    // copy out of lock
+    entry = new Entry();
+    entry->hash = GetHashValue(text, textLength, speed, phontId, entryVersion);
+    entry->text = (char *)malloc(textLength > 0 ? textLength : 1);
+    entry->textLength = textLength;
+    entry->speed = speed;
+    entry->phontId = phontId;
+    entry->version = entryVersion;
+    entry->data = (unsigned char *)malloc(dataLen);
+    entry->dataLen = dataLen;
+    entry->size = entrySize;
+    if (entry->text == NULL || entry->data == NULL) {
+        DeleteEntry(entry);
+        return;
+    }
+    memcpy(entry->text, text, textLength);
+    memcpy(entry->data, data, dataLen);
+    pthread_mutex_lock(&mutex);
+    if (entrySize > maxSize || entryVersion != version) {
+        pthread_mutex_unlock(&mutex);
+        DeleteEntry(entry);
+        return;
+    }
+    // same key converted concurrently or collision of hash, newer wins
+    if ((indexIterator = index.find(entry->hash)) != index.end()) {
+        Evict(indexIterator->second);
+    }
+    while (size + entrySize > maxSize) {
+        Evict(--entries.end());
+        evictions++;
+    }
+    entries.push_front(entry);
+    index[entry->hash] = entries.begin();
+    size += entrySize;
+    pthread_mutex_unlock(&mutex);
+}
+
+void ConvertCache::Invalidate(unsigned long long newVersion) {
+    pthread_mutex_lock(&mutex);
+    if (newVersion != version) {
+        version = newVersion;
+        while (!entries.empty()) {
+            Evict(entries.begin());
+            invalidations++;
+        }
     }
-    *wordPairIterator = filterDictionary->begin();
+    pthread_mutex_unlock(&mutex);
+}
 
-    return 0;
+void ConvertCache::GetStats(Stats *stats) {
+    pthread_mutex_lock(&mutex);
+    stats->size = size;
+    stats->maxSize = maxSize;
+    stats->entries = entries.size();
+    stats->hits = hits;
+    stats->misses = misses;
+    stats->evictions = evictions;
+    stats->invalidations = invalidations;
+    pthread_mutex_unlock(&mutex);
 }
 
-int Dictionary::GetWordPairNext(char **src, int *srcLen, char **dst, int *dstLen, list<WordPair *>::iterator *wordPairIterator) {
-    if (src == NULL ||
-        srcLen <= 0 ||
-        dst == NULL ||
-        dstLen == NULL ||
-        wordPairIterator == NULL) {
+class ThreadPool {
+public:
+    typedef void (*Callback)(void *data);
+    // work runs in thread pool, after runs in main thread
+    static int Queue(Callback work, Callback after, void *data);
+
+private:
+    struct Job {
+        Callback work;
+        Callback after;
+        void *data;
+#if NODE_VERSION_AT_LEAST(0, 5, 6)
+        uv_work_t request;
+#endif
+    };
+#if NODE_VERSION_AT_LEAST(0, 5, 6)
+    static void Work(uv_work_t *request);
+    static void After(uv_work_t *request);
+#else
+    static void Work(eio_req *request);
+    static int After(eio_req *request);
+#endif
+};
+
+int ThreadPool::Queue(Callback work, Callback after, void *data) {
+    Job *job;
+
+    if (work == NULL ||
+        after == NULL) {
         return 1;
     }
-    if ((*wordPairIterator) == filterDictionary->end()) {
-        *src = NULL;
-        *srcLen = 0;
-        *dst = NULL;
-        *dstLen = 0;
-        return -1;
+    job = new Job;
+    job->work = work;
+    job->after = after;
+    job->data = data;
+#if NODE_VERSION_AT_LEAST(0, 5, 6)
+    job->request.data = job;
+    if (uv_queue_work(uv_default_loop(), &job->request, ThreadPool::Work, ThreadPool::After)) {
+        delete job;
+        return 2;
     }
-    WordPair *wordPair = *(*wordPairIterator);
-    wordPair->Get(src, srcLen, dst, dstLen);
-    (*wordPairIterator)++; 
+#else
+    eio_custom(ThreadPool::Work, EIO_PRI_DEFAULT, ThreadPool::After, job);
+    ev_ref(EV_DEFAULT_UC);
+#endif
 
     return 0;
 }
 
-int Dictionary::GetExtensionRatio(int *ratio, int dictType) {
-    if (dictType != PREFERRED && dictType != FILTER) {
-        return 1;
-    }
-    if (dictType == PREFERRED) {
-        *ratio = preferredExtensionRatio;
-    } else if (dictType == FILTER) {
-        *ratio = filterExtensionRatio;
-    }
+#if NODE_VERSION_AT_LEAST(0, 5, 6)
+void ThreadPool::Work(uv_work_t *request) {
+    Job *job = (Job *)request->data;
+    job->work(job->data);
+}
+
+void ThreadPool::After(uv_work_t *request) {
+    Job *job = (Job *)request->data;
+    job->after(job->data);
+    delete job;
+}
+#else
+void ThreadPool::Work(eio_req *request) {
+    Job *job = (Job *)request->data;
+    job->work(job->data);
+}
 
+int ThreadPool::After(eio_req *request) {
+    Job *job = (Job *)request->data;
+    ev_unref(EV_DEFAULT_UC);
+    job->after(job->data);
+    delete job;
     return 0;
 }
+#endif
 
 class VoiceMaker: ObjectWrap {
 public:
     static void Initialize(const Handle<Object>& target);
     static Handle<Value> New(const Arguments& args);
     static Handle<Value> Convert(const Arguments& args);
+    static Handle<Value> ConvertAsync(const Arguments& args);
+    static Handle<Value> ConvertWave(const Arguments& args);
+    static Handle<Value> ConvertWaveAsync(const Arguments& args);
+    static Handle<Value> ConvertStream(const Arguments& args);
+    static Handle<Value> ConvertWaveStream(const Arguments& args);
+    static Handle<Value> ConvertBatch(const Arguments& args);
+    static Handle<Value> ConvertWaveBatch(const Arguments& args);
     static Handle<Value> GetErrorText(const Arguments& args);
+    static Handle<Value> GetStats(const Arguments& args);
+    static Handle<Value> SetTrace(const Arguments& args);
+    static Handle<Value> TraceRequest(const Arguments& args);
+    static Handle<Value> GetTrace(const Arguments& args);
+    static Handle<Value> SetSlowLog(const Arguments& args);
+    static Handle<Value> GetSlowLog(const Arguments& args);
+    static Handle<Value> WriteSlowLog(const Arguments& args);
+    static Handle<Value> SetSynthesizer(const Arguments& args);
     static Handle<Value> SetDictionary(const Arguments& args);
+    static Handle<Value> SetKanaFolding(const Arguments& args);
     static Handle<Value> LoadDictionary(const Arguments& args);
     static Handle<Value> SaveDictionary(const Arguments& args);
+    static Handle<Value> ReloadDictionary(const Arguments& args);
     static Handle<Value> AddWord(const Arguments& args, int dictType);
     static Handle<Value> AddPreferredWord(const Arguments& args);
     static Handle<Value> AddFilterWord(const Arguments& args);
     static Handle<Value> DelWord(const Arguments& args, int dictType);
     static Handle<Value> DelPreferredWord(const Arguments& args);
     static Handle<Value> DelFilterWord(const Arguments& args);
+    static Handle<Value> RegisterVoice(const Arguments& args);
+    static Handle<Value> UnregisterVoice(const Arguments& args);
+    static Handle<Value> ReloadVoice(const Arguments& args);
+    static Handle<Value> SetCacheSize(const Arguments& args);
+    static Handle<Value> SetReadingCacheSize(const Arguments& args);
+    static Handle<Value> GetCacheStats(const Arguments& args);
+    static Handle<Value> SetSharedCache(const Arguments& args);
 
     VoiceMaker();
     ~VoiceMaker();
 
 private:
+    const static int OUTPUT_BASE64 = 1;
+    const static int OUTPUT_WAVE = 2;
+    // longer text is converted by segments and joined
+    const static int SEGMENT_MAX_LENGTH = 1024;
+    struct StreamBaton;
+    struct BatchBaton;
+    struct ConvertBaton {
+        VoiceMaker *voicemaker;
+        Persistent<Function> callback;
+        // text of Buffer is not copied, keep Buffer until converted
+        Persistent<Object> textBuffer;
+        const char *text;
+        char *textCopy;
+        int textLength;
+        int speed;
+        char *modelFile;
+        int output;
+        int result;
+        char *waveBase64;
+        int waveBase64Len;
+        unsigned char *wave;
+        int waveLen;
+        // synthesizer which made wave, NULL if wave is allocated by malloc
+        Synthesizer *waveOwner;
+        char *badText;
+        const char *error;
+        // set when converting a segment of stream
+        StreamBaton *stream;
+        int segment;
+        // set when converting an item of batch, shared with other items
+        BatchBaton *batch;
+        DictionarySnapshot *snapshot;
+        Phont *phont;
+        // set when tracing
+        char *requestId;
+        unsigned long long queued;
+    };
+    struct BatchBaton {
+        VoiceMaker *voicemaker;
+        Persistent<Function> callback;
+        vector<ConvertBaton *> items;
+        DictionarySnapshot *snapshot;
+        map<string, Phont *> phonts;
+        int pending;
+    };
+    struct StreamBaton {
+        VoiceMaker *voicemaker;
+        Persistent<Function> callback;
+        // owns text and model file, segments point into text
+        ConvertBaton *source;
+        vector<ConvertBaton *> segments;
+        vector<char> done;
+        int emitted;
+        int pending;
+        int stopped;
+        // join waves of segments into source instead of emitting
+        int join;
+    };
+    struct TextSegment {
+        int start;
+        int length;
+    };
+    struct ReloadBaton {
+        VoiceMaker *voicemaker;
+        Persistent<Function> callback;
+        int result;
+    };
 
     char *errorText;
-    const char *base64char;
     Dictionary *dictionary;
+    PhontRegistry *phontRegistry;
+    ConvertCache *audioCache;
+    ConvertCache *readingCache;
+    SharedCache *sharedCache;
+    ConvertStats *stats;
+    // replaced only by main thread, read once for each conversion by pool threads
+    // replaced one is never freed, its waves may still be freed after the swap
+    Synthesizer * volatile synthesizer;
+    TraceBuffer *trace;
+    // request id of conversions called from js, main thread only
+    char *traceRequestId;
+    SlowLog *slowLog;
  
-    void ConvertFree(char *preText, char *newText, mecab_t *mecab, char *fixupText, char *filterFree, unsigned char *modelData, unsigned char *waveData);
-    Handle<Value> Convert(const char* text, int textLength, int speed, const char *modelFile);
-
-    void FixupFree(char *newText);
-    int Fixup(char **fixupText, const char *text);
-
-    void FilterFree(char *newText);
-    int Filter(char **filterText, const char *text);
+    static const char *GetVoiceErrorMessage(int result);
+    static const char *GetLoadErrorMessage(int result);
+    static void ReloadWork(void *data);
+    static void ReloadAfter(void *data);
+    static Handle<Object> NewCacheStats(ConvertCache *cache);
+    // publish callback of dictionary, cached waves of other dictionary are dropped
+    static void InvalidateCache(void *data, unsigned long long version);
+    // records stats and trace event of stage
+    void RecordStage(int stage, unsigned long long start);
+    void RecordMemory(unsigned long long bytes);
+    static int ParseConvertArguments(const Arguments& args, int argc, int *speed, int *modelArgumentIndex, const char **error);
+    static void InitConvertBaton(ConvertBaton *baton, VoiceMaker *voicemaker, int speed, int output);
+    // queue time is traced from here
+    static int QueueConvertBaton(ConvertBaton *baton, ThreadPool::Callback after);
+    static int NewConvertBaton(ConvertBaton **baton, const Arguments& args, int argc, int output, int async, const char **error);
+    static int SetConvertText(ConvertBaton *baton, Handle<Value> text, int async, const char **error);
+    // snapshot of dictionary and phont of model file, error is set to baton if phont failed
+    static int AcquireConvertBaton(ConvertBaton *baton, const char **error);
+    static int NewSegmentBaton(ConvertBaton **baton, ConvertBaton *source, const TextSegment *segment, int output);
+    static int NewStreamBaton(StreamBaton **stream, ConvertBaton *source, int join, const char **error);
+    static void DeleteConvertBaton(ConvertBaton *baton);
+    static Handle<Value> GetConvertResult(ConvertBaton *baton);
+    static Handle<Value> ConvertSync(const Arguments& args, int output);
+    static Handle<Value> QueueConvert(const Arguments& args, int output);
+    static void ConvertWork(void *data);
+    static void ConvertAfter(void *data);
+    static Handle<Value> QueueStream(const Arguments& args, int output);
+    static void SegmentAfter(void *data);
+    static void EmitSegments(StreamBaton *stream);
+    static void DeleteStreamBaton(StreamBaton *stream);
+    static int IsBlankSegment(const char *text, int textLength);
+    static void SplitText(vector<TextSegment> *segments, const char *text, int textLength, int maxLength);
+    static int QueueStreamBaton(StreamBaton *stream);
+    static int QueueBatchItem(ConvertBaton *item);
+    static Handle<Value> QueueBatch(const Arguments& args, int output);
+    static int ValidateBatchItem(Handle<Value> item, const char **error);
+    static void BatchAfter(void *data);
+    static void DeleteBatchBaton(BatchBaton *batch);
+    static void JoinWork(void *data);
+    static void JoinSegments(StreamBaton *stream);
+    static void JoinAfter(void *data);
+    static void SetWaveSize(unsigned char *ptr, int size);
+    static int FindWaveChunk(const unsigned char *wave, int waveLen, const char *id, int *offset, int *size);
+    // thread safe, waves must be same format
+    static int JoinWave(unsigned char **wave, int *waveLen, unsigned char * const *waves, const int *waveLens, int count);
+    // hint is owner of wave
+    static void FreeWave(char *data, void *hint);
+    static void ReleaseWave(unsigned char *wave, Synthesizer *waveOwner);
+    void SetErrorText(char *badText);
+
+    // thread safe, run in main thread or thread pool
+    int Convert(char **waveBase64, int *waveBase64Len, char **badText, const char **error, const char* text, int textLength, int speed, const char *modelFile);
+    // wave is freed by ReleaseWave with waveOwner, synthesized wave is not copied
+    int ConvertWave(unsigned char **wave, int *waveLen, Synthesizer **waveOwner, char **badText, const char **error, const char* text, int textLength, int speed, const char *modelFile);
+    // snapshot and phont are acquired by caller, phont may be NULL
+    int ConvertWave(unsigned char **wave, int *waveLen, Synthesizer **waveOwner, char **badText, const char **error, const char* text, int textLength, int speed, DictionarySnapshot *snapshot, Phont *phont);
+    // text to input of aquestalk, reading text is freed by free
+    // begins arena of thread, text is width folded and separated for mecab
+    int PreprocessText(const char **preText, int *preTextLen, ConvertArena **arena, const char **error, const char* text, int textLength);
+    // preprocessed text to reading, ends arena
+    int ConvertText(char **readingText, char **badText, const char **error, ConvertArena *arena, const char* preText, int preTextLen, DictionarySnapshot *snapshot, unsigned long long preprocessTime);
 
-    void LoadFileFree(unsigned char *fileData);
-    int LoadFile(const char *filePath, unsigned char **fileData, size_t *fileSize);
 
     void Base64EncodeFree(char *out);
     int Base64Encode(char **out, int *outLen, const unsigned char *in, int inSize);
@@ -542,13 +1028,30 @@ private:
 
 VoiceMaker::VoiceMaker() {
     errorText = NULL;
-    base64char = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
     dictionary = new Dictionary();
+    phontRegistry = new PhontRegistry();
+    audioCache = new ConvertCache();
+    readingCache = new ConvertCache();
+    sharedCache = new SharedCache();
+    stats = new ConvertStats();
+    synthesizer = Synthesizer::GetDefault();
+    trace = new TraceBuffer();
+    traceRequestId = NULL;
+    slowLog = new SlowLog();
+    dictionary->SetPublishCallback(VoiceMaker::InvalidateCache, this);
 }
 
 VoiceMaker::~VoiceMaker() {
     free(errorText);
     delete dictionary;
+    delete phontRegistry;
+    delete audioCache;
+    delete readingCache;
+    delete sharedCache;
+    delete stats;
+    delete trace;
+    free(traceRequestId);
+    delete slowLog;
 }
 
 void VoiceMaker::Base64EncodeFree(char *out) {
@@ -556,595 +1059,335 @@ void VoiceMaker::Base64EncodeFree(char *out) {
 }
 
 int VoiceMaker::Base64Encode(char **out, int *outLen, const unsigned char *in, int inSize) {
-    char *encoded;
-    const unsigned char *inp;
-    char *outp;
-    int inLen;
+    unsigned long long start = ConvertStats::Now();
 
-    encoded = (char *)malloc(inSize * 4 / 3 + 4);
-    if (encoded == NULL) {
-            return 1;
-    }
-    outp = encoded;
-    inp = in;
-    inLen = inSize;
-
-    while (inLen >= 3) {
-        *outp++ = base64char[(inp[0] >> 2) & 0x3f];
-        *outp++ = base64char[((inp[0] & 0x03) << 4) | ((inp[1] >> 4) & 0x0f)];
-        *outp++ = base64char[((inp[1] & 0x0f) << 2) | ((inp[2] >> 6) & 0x03)];
-        *outp++ = base64char[inp[2] & 0x3f];
-        inp += 3;
-        inLen -= 3;
-    }
-    if (inLen > 0) {
-        *outp++ = base64char[(inp[0] >> 2) & 0x3f];
-        if (inLen == 1) {
-            *outp++ = base64char[(inp[0] & 0x03) << 4];
-            *outp++ = '=';
-        } else {
-            *outp++ = base64char[((inp[0] & 0x03) << 4) | ((inp[1] >> 4) & 0x0f)];
-            *outp++ = base64char[((inp[1] & 0x0f) << 2)];
-        }
-        *outp++ = '=';
-    }
-    *outp = '\0';
-    *out = encoded;
-    if (outLen) {
-        *outLen = outp - encoded;
+    if (ReadingConverter::Base64Encode(out, outLen, in, inSize)) {
+        stats->RecordError(ConvertStats::ENCODING);
+        return 1;
     }
+    RecordStage(ConvertStats::ENCODING, start);
 
     return 0;
 }
 
-void VoiceMaker::LoadFileFree(unsigned char *fileData) {
-    free(fileData);
-}
-
-int VoiceMaker::LoadFile(const char *filePath, unsigned char **fileData, size_t *fileSize) {
-    struct stat st;
-    int fd = -1;
-    unsigned char *data = NULL;
-    size_t size;
-    ssize_t rsz;
-
-    *fileData = NULL;
-    *fileSize = 0;
+int VoiceMaker::ConvertWave(unsigned char **wave, int *waveLen, Synthesizer **waveOwner, char **badText, const char **error, const char* text, int textLength, int speed, const char *modelFile) {
+    DictionarySnapshot *snapshot;
+    Phont *phont = NULL;
+    int result;
 
-    if (stat(filePath, &st) != 0) {
-        return 1;
+    *wave = NULL;
+    *waveLen = 0;
+    *badText = NULL;
+    *error = NULL;
+    if (textLength < 1) {
+        return 0;
     }
-    size = (size_t)st.st_size;
-    data = (unsigned char*)malloc(size);
-    if (data == NULL) {
-        return 2;
+    // snapshot is not changed by reload while converting
+    if (dictionary->Acquire(&snapshot)) {
+        *error = "failed in acquire dictionary.";
+        return 1;
     }
-    if ((fd = open(filePath, O_RDONLY)) < 0) {
-        free(data);
-        return 3;
+    if (modelFile) {
+        unsigned long long start = ConvertStats::Now();
+        if ((result = phontRegistry->Acquire(&phont, modelFile))) {
+            snapshot->Unref();
+            stats->RecordError(ConvertStats::MODEL_LOAD);
+            *error = GetVoiceErrorMessage(result);
+            return 1;
+        }
+        RecordStage(ConvertStats::MODEL_LOAD, start);
     }
-    if ((rsz = read(fd, data, size)) != size) {
-        close(fd);
-        free(data);
-        return 4;
+    result = ConvertWave(wave, waveLen, waveOwner, badText, error, text, textLength, speed, snapshot, phont);
+    if (phont) {
+        phont->Unref();
     }
-    close(fd); 
-    *fileData = data;
-    *fileSize = size;
+    snapshot->Unref();
 
-    return 0;
+    return result;
 }
 
-void VoiceMaker::FixupFree(char *fixupText) {
-    free(fixupText);
-}
+int VoiceMaker::ConvertWave(unsigned char **wave, int *waveLen, Synthesizer **waveOwner, char **badText, const char **error, const char* text, int textLength, int speed, DictionarySnapshot *snapshot, Phont *phont) {
+    char *readingText;
+    char *cachedText = NULL;
+    int readingTextLen;
+    unsigned char *waveData;
+    int waveSize;
+    unsigned long long phontId;
+    unsigned long long version;
+    unsigned long long start = ConvertStats::Now();
+    unsigned long long stageStart;
+    // wave is made and freed by this one even if synthesizer is swapped meanwhile
+    Synthesizer *currentSynthesizer = synthesizer;
+    ConvertArena *arena;
+    const char *pre;
+    int preTextLen;
+    unsigned long long preprocessTime;
 
-#define MAX_REG_MATCH 5 
-int VoiceMaker::Fixup(char **fixupText, const char *text) {
-    int i;
-    regex_t pre;
-    regmatch_t pmatch[MAX_REG_MATCH];
-    char *origText = NULL;
-    int origTextLength;
-    char *newText = NULL;
-    int newTextLength;
-    int newTextCurrent;
-
-    if (fixupText == NULL ||
-        text == NULL) {
-        return 1;
-    }
-    if (strlen(text) < 1) {
-        return 2;
-    }
-    origText = strdup(text);
-    if (origText == NULL) {
-        return 3;
+    *wave = NULL;
+    *waveLen = 0;
+    *waveOwner = NULL;
+    *badText = NULL;
+    *error = NULL;
+    if (textLength < 1) {
+        return 0;
     }
-    if (regcomp(&pre, " ([-.[:digit:]]+) (([^ ]+) )?", REG_EXTENDED | REG_ICASE)) {
-        free(origText);
-        return 4;
+    // caches are keyed by preprocessed text, full width and half width forms of a text are one entry
+    if (PreprocessText(&pre, &preTextLen, &arena, error, text, textLength)) {
+        stats->RecordRequest(textLength, 0);
+        stats->RecordError(ConvertStats::TOTAL);
+        return 1;
     }
-    while (1) {
-        int numk = 1;
-        char *num = "NUMK";
-        int numLen = sizeof("NUMK") - 1;
-        origTextLength = strlen(origText);
-        newTextLength = origTextLength + 22;
-        newText = (char *)malloc(newTextLength);
-        if (!newText) {
-            free(origText);
-            regfree(&pre);
-            return 5;
-        }
-        if(regexec(&pre, origText, sizeof(pmatch)/sizeof(pmatch[0]), pmatch, 0)) {
-            strcpy(newText, origText);
-            break;
-        } else {
-            if (pmatch[0].rm_so < 0 || pmatch[0].rm_eo < 0 ||
-                pmatch[1].rm_so < 0 || pmatch[1].rm_eo < 0) {
-                strcpy(newText, origText);
-                break;
-            }
-            newTextCurrent = 0;
-            memcpy(&newText[newTextCurrent], origText, pmatch[0].rm_so);
-            newTextCurrent += pmatch[0].rm_so;
-            for (i = 0; pmatch[1].rm_so + i < pmatch[1].rm_eo; i++) {
-                 if (origText[pmatch[1].rm_so + i] == '-') {
-		     numk = 0;
-                     num = "NUM";
-                     numLen = sizeof("NUM") - 1;
-                 }
-            }
-            memcpy(&newText[newTextCurrent], "<" , 1);
-            newTextCurrent += 1;
-            memcpy(&newText[newTextCurrent], num , numLen);
-            newTextCurrent += numLen;
-            memcpy(&newText[newTextCurrent], " VAL=" , 5);
-            newTextCurrent += 5;
-            int headZeroPadding = 1;
-            for (i = 0; i < pmatch[1].rm_eo - pmatch[1].rm_so; i++) {
-                 if (origText[pmatch[1].rm_so + i] != '0') {
-                     headZeroPadding = 0;
-                 }
-                 if (headZeroPadding && origText[pmatch[1].rm_so + i] == '0' && origText[pmatch[1].rm_so + i + 1] == '0') {
-                     continue;
-                 } else {
-                     memcpy(&newText[newTextCurrent], &origText[pmatch[1].rm_so + i], 1);
-                     newTextCurrent += 1;
-                 }
-            }
-            if (pmatch[2].rm_so >= 0 && pmatch[2].rm_eo >= 0 ||
-                pmatch[3].rm_so >= 0 && pmatch[3].rm_eo >= 0) {
-                    if (numk) {
-                        memcpy(&newText[newTextCurrent], " COUNTER=" , 9);
-                        newTextCurrent += 9;
-                        for (i = 0; i < pmatch[3].rm_eo - pmatch[3].rm_so; i++) {
-                            if (!isascii(origText[pmatch[3].rm_so + i])) {
-                                memcpy(&newText[newTextCurrent], &origText[pmatch[3].rm_so + i], 1);
-                                newTextCurrent += 1;
-                            }
-                        }
-                        memcpy(&newText[newTextCurrent], ">" , 1);
-                        newTextCurrent += 1;
-                    } else {
-                        memcpy(&newText[newTextCurrent], ">" , 1);
-                        newTextCurrent += 1;
-                        for (i = 0; i < pmatch[3].rm_eo - pmatch[3].rm_so; i++) {
-                             memcpy(&newText[newTextCurrent], &origText[pmatch[3].rm_so + i], 1);
-                             newTextCurrent += 1;
-                        }
-                    }
-            } else {
-                memcpy(&newText[newTextCurrent], ">" , 1);
-                newTextCurrent += 1;
-            }
-            strcpy(&newText[newTextCurrent], &origText[pmatch[0].rm_eo]);
+    preprocessTime = ConvertStats::Now() - start;
+    // waves of other synthesizer are not hit
+    phontId = (phont ? phont->GetId() : 0) ^ currentSynthesizer->GetId();
+    version = snapshot->GetVersion();
+    if (audioCache->Get(wave, waveLen, pre, preTextLen, speed, phontId, version) == 0) {
+        arena->End();
+        stats->RecordRequest(textLength, *waveLen);
+        RecordStage(ConvertStats::TOTAL, start);
+        return 0;
+    }
+    // converted by other process
+    if (sharedCache->Get(wave, waveLen, pre, preTextLen, speed, phontId, version) == 0) {
+        audioCache->Put(*wave, *waveLen, pre, preTextLen, speed, phontId, version);
+        arena->End();
+        stats->RecordRequest(textLength, *waveLen);
+        RecordStage(ConvertStats::TOTAL, start);
+        return 0;
+    }
+    // reading text does not depend on speed and voice
+    if (readingCache->Get((unsigned char **)&cachedText, &readingTextLen, pre, preTextLen, 0, 0, version)) {
+        // converted text is in arena of this thread, key is put before arena is reused
+        if (ConvertText(&readingText, badText, error, arena, pre, preTextLen, snapshot, preprocessTime)) {
+            stats->RecordRequest(textLength, 0);
+            stats->RecordError(ConvertStats::TOTAL);
+            return 1;
         }
-        free(origText);
-        origText = newText;
+        readingCache->Put((unsigned char *)readingText, strlen(readingText) + 1, pre, preTextLen, 0, 0, version);
+    } else {
+        arena->End();
+        readingText = cachedText;
+    }
+    stageStart = ConvertStats::Now();
+    if (currentSynthesizer->Synthesize(&waveData, &waveSize, readingText, speed, phont ? phont->GetData() : NULL)) {
+        *badText = cachedText ? cachedText : strdup(readingText);
+        *error = "failed in create data of wave.";
+        stats->RecordError(ConvertStats::SYNTHESIS);
+        stats->RecordRequest(textLength, 0);
+        stats->RecordError(ConvertStats::TOTAL);
+        return 1;
     }
-    free(origText);
-    regfree(&pre);
-    *fixupText = newText;
+    RecordStage(ConvertStats::SYNTHESIS, stageStart);
+    free(cachedText);
+    // caches copy wave into their own storage
+    *wave = waveData;
+    *waveLen = waveSize;
+    *waveOwner = currentSynthesizer;
+    audioCache->Put(*wave, *waveLen, pre, preTextLen, speed, phontId, version);
+    sharedCache->Put(*wave, *waveLen, pre, preTextLen, speed, phontId, version);
+    stats->RecordRequest(textLength, *waveLen);
+    RecordStage(ConvertStats::TOTAL, start);
 
     return 0;
 }
 
-void VoiceMaker::FilterFree(char *filterdText) {
-    free(filterdText);
-}
-
-int VoiceMaker::Filter(char **filterdText, const char *text) {
+int VoiceMaker::PreprocessText(const char **preText, int *preTextLen, ConvertArena **arena, const char **error, const char* text, int textLength) {
+    ConvertArena::Buffer *buffer;
     int result;
-    int i;
-    char *newText, *newTextBack;
-    int textLength, newTextLength;
-    char *exist;
-    list<WordPair *>::iterator wordPairIterator;
-    char *dicSrc;
-    int dicSrcLen;
-    char *dicDst;
-    int dicDstLen;
-    int ext;
-    if (filterdText == NULL ||
-        text == NULL) {
-        return 1;
-    }
-    textLength = strlen(text);
-    if (textLength < 1) {
-        return 2;
-    }
-    if (dictionary->GetExtensionRatio(&ext, Dictionary::FILTER)) {
-        return 3;
-    }
-    newTextLength = textLength * ext;
-    newText = (char *)malloc(newTextLength);
-    if (!newText) {
-        return 4;
-    }
-    newTextBack = (char *)malloc(newTextLength);
-    if (!newTextBack) {
-        free(newText);
-        return 5;
+
+    *error = NULL;
+    // buffers are reused by next conversion on this thread
+    if ((*arena = ConvertArena::Get()) == NULL) {
+         *error = "failed in get arena of thread.";
+         stats->RecordError(ConvertStats::PREPROCESS);
+         return 1;
+    }
+    (*arena)->Begin();
+    buffer = (*arena)->GetBuffer(ConvertArena::PRE_TEXT);
+    // text is used as is if it has no alphabet nor full width forms
+    if ((result = ReadingConverter::Preprocess(preText, preTextLen, &buffer->data, &buffer->capacity, text, textLength))) {
+         (*arena)->End();
+         switch (result) {
+         case 1:
+             *error = "failed in allocate buffer of pre text.";
+             break;
+         case 2:
+             *error = "text is not valid utf-8.";
+             break;
+         default:
+             *error = "preferred error in preprocess.";
+             break;
+         }
+         stats->RecordError(ConvertStats::PREPROCESS);
+         return 1;
     }
-    strcpy(newText, text);
-    if (dictionary->GetWordPairBegin(&wordPairIterator)) {
-        return 6;
+    if (*preText != text) {
+        (*arena)->Use(ConvertArena::PRE_TEXT, *preTextLen + 1);
     }
-    while(1) {
-       result = dictionary->GetWordPairNext(&dicSrc, &dicSrcLen, &dicDst, &dicDstLen, &wordPairIterator);
-       if (result == -1) {
-           break;
-       }
-       if (result == 1) {
-           free(newText);
-           free(newTextBack);
-           return 7;
-       }
-       if ((*dicSrc >= 0x30 && *dicSrc <= 0x39 && dicSrcLen == 1) ||
-           (*dicSrc == ' ' && dicSrcLen == 1) ||
-           (*dicSrc == '-' && dicSrcLen == 1) ||
-           (*dicSrc == '.' && dicSrcLen == 1)) {
-           continue;
-       }
-       if (textLength < dicSrcLen) {
-           continue;
-       }
-       if (newTextLength < dicDstLen) {
-           continue;
-       }
-       while(1) {
-           exist = strcasestr(newText, dicSrc);
-           if (!exist) {
-               break;
-           }
-           strcpy(newTextBack, exist);
-           strcpy(exist, dicDst);
-           strcpy(exist + dicDstLen, newTextBack + dicSrcLen);
-       }
-    }
-    free(newTextBack);
-    *filterdText = newText;
 
     return 0;
 }
 
-void VoiceMaker::ConvertFree(char *preText, char *newText, mecab_t *mecab, char *fixupText, char *filterText, unsigned char *modelData, unsigned char *waveData) {
-    free(preText);
-    free(newText);
-    if (mecab) {
-        mecab_destroy(mecab);
-    }
-    if (fixupText) {
-        FixupFree(fixupText);
-    }
-    if (filterText) {
-        FixupFree(filterText);
-    }
-    if (modelData) {
-        LoadFileFree(modelData);
-    }
-    if (waveData) {
-        AquesTalk2_FreeWave(waveData);
-    }
-}
-
-Handle<Value> VoiceMaker::Convert(const char* text, int textLength, int speed, const char *modelFile) {
-    HandleScope scope;
-    const char *error = NULL;
+int VoiceMaker::ConvertText(char **readingText, char **badText, const char **error, ConvertArena *arena, const char* pre, int preTextLen, DictionarySnapshot *snapshot, unsigned long long preprocessTime) {
     mecab_t *mecab = NULL;
+    mecab_lattice_t *lattice = NULL;
     const mecab_node_t *node;
-    int argc = 1;
-    char *argv[] = { "voicemaker" };
-    char *newText = NULL;
-    char *newTextPtr = NULL;
-    char *fixupText = NULL;
-    char *filterText = NULL;
-    int newTextLength;
-    unsigned char *modelData = NULL;
-    size_t modelSize;
-    unsigned char *waveData = NULL;
-    int waveSize;
-    char *waveBase64 = NULL;
-    int waveBase64Len;
+    ConvertArena::Buffer *taggerText;
+    ConvertArena::Buffer *swapText;
+    ConvertArena::Buffer *newText;
+    TokenStream *stream;
+    int taggerTextLen;
+    int newTextLen;
+    int readingsLen;
     int result;
-    char *dst;
-    int dstLen;
-    int ext;
-    char *preText = NULL;
-    int preTextLen;
-    int prevAlpha;
-    int i;
-
-    if (textLength < 1) {
-        Local<String> dataString = String::New("");
-        return scope.Close(dataString);
-    }
-    preText = (char *)malloc(textLength * 2);
-    if (!preText) {
-         return scope.Close(ThrowException(Exception::Error(String::New("failed in allocate buffer of pre text."))));
-    }
-    preTextLen = 0;
-    prevAlpha = 0;
-    for (i = 0; i < textLength; i++) {
-        if (isalpha(text[i])) {
-            if (i > 0 && text[i - 1] != ' ' && !prevAlpha) {
-                preText[preTextLen++] = ',';
-            }
-            preText[preTextLen++] = text[i];
-            prevAlpha = 1;
-        } else {
-            if (text[i] != ' ' && prevAlpha) {
-                preText[preTextLen++] = ',';
-            }
-            preText[preTextLen++] = text[i];
-            prevAlpha = 0;
-        }
-    }
-    preText[preTextLen++] = '\0';
-    if (dictionary->GetExtensionRatio(&ext, Dictionary::PREFERRED)) {
-        scope.Close(ThrowException(Exception::Error(String::New("failed in get extension ratio of preferred dictionary."))));
-    }
-    newTextLength = preTextLen * 15 * 4 * ext;
-    newText = (char *)malloc(newTextLength);
-    if (!newText) {
-         ConvertFree(preText, newText, mecab, fixupText, filterText, modelData, waveData);
-         return scope.Close(ThrowException(Exception::Error(String::New("failed in allocate buffer of new text."))));
-    }
-    newTextPtr = newText;
-    mecab = mecab_new(argc, argv);
-    if (!mecab) {
-         ConvertFree(preText, newText, mecab, fixupText, filterText, modelData, waveData);
-         return ThrowException(Exception::Error(String::New("failed in create instance of Mecab::Tagger.")));
-    }
-    node = mecab_sparse_tonode(mecab, preText);
-    if (!node) {
-         ConvertFree(preText, newText, mecab, fixupText, filterText, modelData, waveData);
-         return ThrowException(Exception::Error(String::New("failed in create instance of Mecab::Node.")));
-    }
-    int digit = 0;
-    int separator = 0;
-    for (; node; node = node->next) {
-         const char *startPtr = NULL;
-         const char *endPtr = NULL;
-         const char *currentPtr = node->feature;
-         int delimiter = 0;
-         int length;
-         int counter = 0;
-
-         if (*node->surface >= 0x30 && *node->surface <= 0x39 && node->length == 1) {
-             if (separator != 0) {
-                 newTextPtr -= separator;
-             }
-             if (digit == 0) {
-                 memcpy(newTextPtr, " ", 1);
-                 newTextPtr += 1;
-             }
-             memcpy(newTextPtr, node->surface, node->length);
-             newTextPtr += node->length;
-             digit += 1;
-             separator = 0;
-             continue;
-         } else if ((*node->surface == '-' && node->length == 1) ||
-                    (*node->surface == '.' && node->length == 1)) {
-             if (digit != 0) {
-                 memcpy(newTextPtr, node->surface, node->length);
-                 newTextPtr += node->length;
-                 digit += 1;
-                 separator = 0;
-                 continue;
-             }
-             digit = 0;
-             separator = 0;
-         } else if (*node->surface == ',' && node->length == 1) {
-             if (digit != 0) {
-                 memcpy(newTextPtr, node->surface, node->length);
-                 newTextPtr += node->length;
-                 digit += 1;
-                 separator += 1;
-                 continue;
-             }
-             digit = 0;
-             separator = 0;
-         } else {
-             if (digit != 0) {
-                 memcpy(newTextPtr, " ", 1);
-                 newTextPtr += 1;
-                 counter = 1;
-             }
-             digit = 0;
-             separator = 0;
-         }
-          
-         if (dictionary->GetDstWord(node->surface, node->length, &dst, &dstLen) == 0) {
-             memcpy(newTextPtr, dst, dstLen);
-             newTextPtr += dstLen;
-             if (counter) {
-                 memcpy(newTextPtr, " ", 1);
-                 newTextPtr += 1;
-             }
-             continue;
-         }
-         while (*currentPtr != '\0') {
-             if (*currentPtr == ',') {
-                 delimiter++;
-	         if (delimiter == 8) {
-                     startPtr = currentPtr;
-                     startPtr++;
-                 } else if (delimiter == 9) {
-                     endPtr = currentPtr;
-                     break;
-                 }
-             }
-             currentPtr++;
-         }
-         if (!startPtr && !endPtr && delimiter < 7) {
-             startPtr = node->surface;
-             length = node->length;
-             memcpy(newTextPtr, startPtr, length);
-             newTextPtr += length;
-             if (counter) {
-                 memcpy(newTextPtr, " ", 1);
-                 newTextPtr += 1;
-             }
-         } else {
-             if (startPtr && endPtr) {
-                 if (*startPtr == '"' && *(endPtr - 1) == '"') {
-                     startPtr += 1;
-                     endPtr -= 1;
-                 }
-                 length = endPtr - startPtr;
-                 if (length >= 0) {
-                     memcpy(newTextPtr, startPtr, length);
-                     newTextPtr += length;
-                     if (counter) {
-                         memcpy(newTextPtr, " ", 1);
-                         newTextPtr += 1;
-                     }
-                 }
-             }
-         }
-    }
-    if (digit) {
-        memcpy(newTextPtr, " ", 1);
-        newTextPtr += 1;
-    }
-    *newTextPtr = '\0';
-    mecab_destroy(mecab);
-    mecab = NULL;
-    free(preText);
-    preText = NULL;
-    if ((result = Filter(&filterText, newText))) {
-        free(errorText);
-        errorText = strdup(newText);
-        ConvertFree(preText, newText, mecab, fixupText, filterText, modelData, waveData);
+    // stage of preprocess includes folding done before cache lookup
+    unsigned long long stageStart = ConvertStats::Now() - preprocessTime;
+
+    *readingText = NULL;
+    *badText = NULL;
+    *error = NULL;
+    taggerText = arena->GetBuffer(ConvertArena::TAGGER_TEXT);
+    swapText = arena->GetBuffer(ConvertArena::SWAP_TEXT);
+    newText = arena->GetBuffer(ConvertArena::READING_TEXT);
+    stream = arena->GetTokenStream();
+    // mecab never sees digits of numbers
+    if (ReadingConverter::ScanNumbers(&taggerText->data, &taggerText->capacity, &taggerTextLen, stream, pre, preTextLen)) {
+         arena->End();
+         *error = "failed in allocate buffer of numbers.";
+         stats->RecordError(ConvertStats::PREPROCESS);
+         return 1;
+    }
+    arena->Use(ConvertArena::TAGGER_TEXT, taggerTextLen);
+    RecordStage(ConvertStats::PREPROCESS, stageStart);
+    stageStart = ConvertStats::Now();
+    if (MecabModel::GetTagger(&mecab, &lattice)) {
+         arena->End();
+         *error = "failed in create instance of Mecab::Tagger.";
+         stats->RecordError(ConvertStats::TAGGING);
+         return 1;
+    }
+    mecab_lattice_set_sentence(lattice, taggerText->data);
+    if (!mecab_parse_lattice(mecab, lattice) ||
+        !(node = mecab_lattice_get_bos_node(lattice))) {
+         arena->End();
+         *error = "failed in create instance of Mecab::Node.";
+         stats->RecordError(ConvertStats::TAGGING);
+         return 1;
+    }
+    RecordStage(ConvertStats::TAGGING, stageStart);
+    stageStart = ConvertStats::Now();
+    if (ReadingConverter::ReadTokens(stream, node, snapshot, trace)) {
+         arena->End();
+         *error = "failed in allocate buffer of tokens.";
+         stats->RecordError(ConvertStats::PREFERRED);
+         return 1;
+    }
+    readingsLen = stream->readingsLen;
+    RecordStage(ConvertStats::PREFERRED, stageStart);
+    if (slowLog->IsEnabled()) {
+        string tokens;
+        ReadingConverter::DumpTokens(&tokens, stream);
+        slowLog->SetText(SlowLog::TAGGED, tokens.c_str());
+    }
+    stageStart = ConvertStats::Now();
+    if ((result = ReadingConverter::FilterTokens(stream, &swapText->data, &swapText->capacity, snapshot, arena->GetReplaceBuffer()))) {
+        string tokens;
+        ReadingConverter::DumpTokens(&tokens, stream);
+        *badText = strdup(tokens.c_str());
+        RecordMemory(arena->End());
         switch (result) {
         case 1:
-            error = "invalid argument in filter.";
+            *error = "invalid argument in filter.";
             break;
         case 2:
-            error = "too short text in filter.";
+            *error = "too short text in filter.";
             break;
         case 3:
-            error = "failed in get extension ratio of filter dictionary in filter.";
+            *error = "failed in get matcher of filter dictionary in filter.";
             break;
         case 4:
-            error = "failed in allocate memory of new text in filter.";
-            break;
-        case 5:
-            error = "failed in allocate memory of backup text in filter.";
-            break;
-        case 6:
-            error = "failed in get dictionary iterator in filter.";
-            break;
-        case 7:
-            error = "failed in get word pair in filter.";
+            *error = "failed in allocate memory of new text in filter.";
             break;
         default:
-            error = "preferred error in filter.";
+            *error = "preferred error in filter.";
             break;
         }
-        return scope.Close(ThrowException(Exception::Error(String::New(error))));
+        stats->RecordError(ConvertStats::FILTER);
+        return 1;
     }
-    free(newText);
-    newText = NULL;
-    if ((result = Fixup(&fixupText, filterText))) {
-        free(errorText);
-        errorText = strdup(filterText);
-        ConvertFree(preText, newText, mecab, fixupText, filterText, modelData, waveData);
+    arena->Use(ConvertArena::SWAP_TEXT, readingsLen);
+    RecordStage(ConvertStats::FILTER, stageStart);
+    if (slowLog->IsEnabled()) {
+        string tokens;
+        ReadingConverter::DumpTokens(&tokens, stream);
+        slowLog->SetText(SlowLog::FILTERED, tokens.c_str());
+    }
+    stageStart = ConvertStats::Now();
+    // reading text is written once from tokens
+    if ((result = ReadingConverter::WriteReading(&newText->data, &newText->capacity, &newTextLen, stream))) {
+        string tokens;
+        ReadingConverter::DumpTokens(&tokens, stream);
+        *badText = strdup(tokens.c_str());
+        RecordMemory(arena->End());
         switch (result) {
         case 1:
-            error = "invalid argument in fixup.";
+            *error = "invalid argument in fixup.";
             break;
         case 2:
-            error = "too short text in fixup.";
+            *error = "too short text in fixup.";
             break;
         case 3:
-            error = "failed in allocate memory of orignal text in fixup.";
-            break;
-        case 4:
-            error = "failed in failed in compile regex in fixup.";
-            break;
-        case 5:
-            error = "failed in allocate memory of new text in fixup.";
+            *error = "failed in allocate memory of new text in fixup.";
             break;
         default:
-            error = "preferred error in fixup.";
+            *error = "preferred error in fixup.";
             break;
         }
-        return scope.Close(ThrowException(Exception::Error(String::New(error))));
-    }
-    free(filterText);
-    filterText = NULL;
-    if (modelFile) {
-        if ((result = LoadFile(modelFile, &modelData, &modelSize))) {
-            ConvertFree(preText, newText, mecab, fixupText, filterText, modelData, waveData);
-            switch (result) {
-            case 1:
-                error = "not found model file in model file loader.";
-                break;
-            case 2:
-                error = "failed in allocate memory of model data in model file loader.";
-                break;
-            case 3:
-                error = "failed in open file of model in model file loader.";
-                break;
-            case 4:
-                error = "failed in read data of model in model file loader.";
-                break;
-            default:
-                error = "preferred error in model file loader.";
-                break;
-            }
-            return scope.Close(ThrowException(Exception::Error(String::New(error))));
-        }
+        stats->RecordError(ConvertStats::FIXUP);
+        return 1;
     }
-    waveData = AquesTalk2_Synthe_Utf8(fixupText, speed, &waveSize, modelData);
-    if (!waveData) {
-        free(errorText);
-        errorText = strdup(fixupText);
-        ConvertFree(preText, newText, mecab, fixupText, filterText, modelData, waveData);
-        return ThrowException(Exception::Error(String::New("failed in create data of wave.")));
+    arena->Use(ConvertArena::READING_TEXT, newTextLen + 1);
+    RecordStage(ConvertStats::FIXUP, stageStart);
+    slowLog->SetText(SlowLog::FIXEDUP, newText->data);
+    RecordMemory(arena->End());
+    *readingText = newText->data;
+
+    return 0;
+}
+
+int VoiceMaker::Convert(char **waveBase64, int *waveBase64Len, char **badText, const char **error, const char* text, int textLength, int speed, const char *modelFile) {
+    unsigned char *waveData;
+    int waveSize;
+    Synthesizer *waveOwner;
+
+    if (ConvertWave(&waveData, &waveSize, &waveOwner, badText, error, text, textLength, speed, modelFile)) {
+        *waveBase64 = NULL;
+        *waveBase64Len = 0;
+        return 1;
     }
-    FilterFree(fixupText);
-    fixupText = NULL;
-    LoadFileFree(modelData);
-    modelData = NULL;
-    if (Base64Encode(&waveBase64, &waveBase64Len, waveData, waveSize)) {
-        ConvertFree(preText, newText, mecab, fixupText, filterText, modelData, waveData);
-        return scope.Close(ThrowException(Exception::Error(String::New("failed in encode to base64."))));
+    if (Base64Encode(waveBase64, waveBase64Len, waveData, waveSize)) {
+        ReleaseWave(waveData, waveOwner);
+        *error = "failed in encode to base64.";
+        return 1;
     }
-    AquesTalk2_FreeWave(waveData);
-    Local<String> dataString = String::New(waveBase64);
-    Base64EncodeFree(waveBase64);
+    ReleaseWave(waveData, waveOwner);
 
-    return scope.Close(dataString);
+    return 0;
 }
 
+
 Handle<Value> VoiceMaker::SetDictionary(const Arguments& args) {
     HandleScope scope;
 
+    if (args.Length() == 1 && args[0]->IsString()) {
+        // compiled dictionary
+        VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+        String::Utf8Value compiledDictionaryPath(args[0]->ToString());
+        if (voicemaker->dictionary->SetCompiledDictionaryPath(*compiledDictionaryPath)) {
+            return scope.Close(ThrowException(Exception::Error(String::New("failed in set dictionary path."))));
+        }
+        return scope.Close(Undefined());
+    }
     if (args.Length() != 2 || !args[0]->IsString() || !args[1]->IsString()) {
         return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. no dictionary path."))));
     }
@@ -1154,34 +1397,120 @@ Handle<Value> VoiceMaker::SetDictionary(const Arguments& args) {
     if (voicemaker->dictionary->SetDictionaryPath(*preferredDictionaryPath, *filterDictionaryPath)) {
         return scope.Close(ThrowException(Exception::Error(String::New("failed in set dictionary path."))));
     }
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> VoiceMaker::SetKanaFolding(const Arguments& args) {
+    HandleScope scope;
+
+    /* kanaFolding(boolean) */
+    if (args.Length() != 1 || !args[0]->IsBoolean()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. kanaFolding must be boolean."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    voicemaker->dictionary->SetKanaFolding(args[0]->BooleanValue() ? 1 : 0);
+
+    return scope.Close(Undefined());
 }
 
 Handle<Value> VoiceMaker::LoadDictionary(const Arguments& args) {
     HandleScope scope;
     int result;
-    char *error;
 
     if (args.Length() > 0) {
         return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. must be no argument."))));
     }
     VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
     if ((result = voicemaker->dictionary->LoadDictionary())) {
-        switch (result) {
-        case 1:
-            error = "failed in clear dictionary.";
-            break;
-        case 2:
-            error = "failed in open dictionary.";
-            break;
-        case 3:
-            error = "failed in set word.";
-            break;
-        default:
-            error = "preferred error";
-            break;
-        }
-        return scope.Close(ThrowException(Exception::Error(String::New(error))));
+        return scope.Close(ThrowException(Exception::Error(String::New(GetLoadErrorMessage(result)))));
+    }
+
+    return scope.Close(Undefined());
+}
+
+const char *VoiceMaker::GetLoadErrorMessage(int result) {
+    switch (result) {
+    case 1:
+        return "failed in copy path of dictionary.";
+    case 2:
+        return "failed in open dictionary.";
+    case 3:
+        return "failed in set word.";
+    case 4:
+        return "invalid compiled dictionary.";
+    default:
+        return "preferred error";
+    }
+}
+
+Handle<Value> VoiceMaker::ReloadDictionary(const Arguments& args) {
+    HandleScope scope;
+    ReloadBaton *baton;
+
+    /* callback(function) */
+    if (args.Length() != 1 || !args[0]->IsFunction()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. no callback."))));
+    }
+    baton = new ReloadBaton();
+    baton->voicemaker = Unwrap<VoiceMaker>(args.This());
+    baton->callback = Persistent<Function>::New(Local<Function>::Cast(args[0]));
+    baton->result = 0;
+    if (ThreadPool::Queue(VoiceMaker::ReloadWork, VoiceMaker::ReloadAfter, baton)) {
+        baton->callback.Dispose();
+        delete baton;
+        return scope.Close(ThrowException(Exception::Error(String::New("failed in queue work of reload."))));
+    }
+    baton->voicemaker->Ref();
+
+    return Undefined();
+}
+
+void VoiceMaker::ReloadWork(void *data) {
+    ReloadBaton *baton = (ReloadBaton *)data;
+
+    baton->result = baton->voicemaker->dictionary->LoadDictionary();
+}
+
+void VoiceMaker::RecordStage(int stage, unsigned long long start) {
+    unsigned long long elapsed = ConvertStats::Now() - start;
+
+    stats->Record(stage, elapsed);
+    slowLog->SetStage(stage, elapsed);
+    trace->Add(ConvertStats::GetStageName(stage), start, elapsed, 0);
+}
+
+void VoiceMaker::RecordMemory(unsigned long long bytes) {
+    stats->RecordMemory(bytes);
+    slowLog->SetMemory(bytes);
+}
+
+void VoiceMaker::InvalidateCache(void *data, unsigned long long version) {
+    VoiceMaker *voicemaker = (VoiceMaker *)data;
+
+    // called by publisher with its own version, not with version acquired later
+    voicemaker->audioCache->Invalidate(version);
+    voicemaker->readingCache->Invalidate(version);
+}
+
+void VoiceMaker::ReloadAfter(void *data) {
+    HandleScope scope;
+    ReloadBaton *baton = (ReloadBaton *)data;
+    Handle<Value> argv[1];
+
+    if (baton->result) {
+        argv[0] = Exception::Error(String::New(GetLoadErrorMessage(baton->result)));
+    } else {
+        argv[0] = Null();
     }
+    baton->voicemaker->Unref();
+    TryCatch tryCatch;
+    baton->callback->Call(Context::GetCurrent()->Global(), 1, argv);
+    if (tryCatch.HasCaught()) {
+        FatalException(tryCatch);
+    }
+    baton->callback.Dispose();
+    delete baton;
 }
 
 Handle<Value> VoiceMaker::SaveDictionary(const Arguments& args) {
@@ -1201,12 +1530,17 @@ Handle<Value> VoiceMaker::SaveDictionary(const Arguments& args) {
         case 2:
             error = "failed in get word.";
             break;
+        case 3:
+            error = "failed in write dictionary.";
+            break;
         default:
             error = "preferred error";
             break;
         }
         return scope.Close(ThrowException(Exception::Error(String::New(error))));
     }
+
+    return scope.Close(Undefined());
 }
 
 Handle<Value> VoiceMaker::AddWord(const Arguments& args, int dictType) {
@@ -1224,6 +1558,8 @@ Handle<Value> VoiceMaker::AddWord(const Arguments& args, int dictType) {
     if (voicemaker->dictionary->AddWordPair(*src, src.length(), *dst, dst.length(), dictType)) {
         return scope.Close(ThrowException(Exception::Error(String::New("failed in add word."))));
     }
+
+    return scope.Close(Undefined());
 }
 
 Handle<Value> VoiceMaker::AddPreferredWord(const Arguments& args) {
@@ -1248,6 +1584,8 @@ Handle<Value> VoiceMaker::DelWord(const Arguments& args, int dictType) {
     if (voicemaker->dictionary->DelWordPair(*src, src.length(), dictType)) {
         return scope.Close(ThrowException(Exception::Error(String::New("failed in delete word."))));
     }
+
+    return scope.Close(Undefined());
 }
 
 Handle<Value> VoiceMaker::DelPreferredWord(const Arguments& args) {
@@ -1258,47 +1596,1429 @@ Handle<Value> VoiceMaker::DelFilterWord(const Arguments& args) {
     return DelWord(args, Dictionary::FILTER);
 }
 
-Handle<Value> VoiceMaker::Convert(const Arguments& args) {
-    HandleScope scope;
-    int modelArgumentIndex = -1;
-    int speed = 100;
+const char *VoiceMaker::GetVoiceErrorMessage(int result) {
+    switch (result) {
+    case 1:
+        return "invalid argument in model file loader.";
+    case 2:
+        return "failed in open file of model in model file loader.";
+    case 3:
+        return "not found model file in model file loader.";
+    case 4:
+        return "failed in map data of model in model file loader.";
+    case 5:
+        return "failed in allocate memory of voice in model file loader.";
+    case 6:
+        return "not registered voice in model file loader.";
+    default:
+        return "preferred error in model file loader.";
+    }
+}
 
-    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
-    /* text(string), [[speed(int32)], [modelFile(string)]] */
-    if (args.Length() < 1 || !args[0]->IsString()) {
-        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. no text."))));
+void VoiceMaker::SetErrorText(char *badText) {
+    if (badText == NULL) {
+        return;
+    }
+    free(errorText);
+    errorText = badText;
+}
+
+int VoiceMaker::ParseConvertArguments(const Arguments& args, int argc, int *speed, int *modelArgumentIndex, const char **error) {
+    *speed = 100;
+    *modelArgumentIndex = -1;
+
+    /* text(string or buffer), [[speed(int32)], [modelFile(string)]] */
+    if (argc < 1 || (!args[0]->IsString() && !Buffer::HasInstance(args[0]))) {
+        *error = "Bad arguments. no text.";
+        return 1;
     }
-    String::Utf8Value textString(args[0]->ToString());
-    if (args.Length() >= 2) {
+    if (argc >= 2) {
         if (args[1]->IsString()) {
-            modelArgumentIndex = 1;
+            *modelArgumentIndex = 1;
         } else if (args[1]->IsInt32()) {
-            speed = args[1]->ToInt32()->Value();
-            if (speed < 30 || speed > 300) {
-                return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. speed is out of range."))));
+            *speed = args[1]->ToInt32()->Value();
+            if (*speed < 30 || *speed > 300) {
+                *error = "Bad arguments. speed is out of range.";
+                return 1;
             }
         } else {
-            return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. second argument is invalid type."))));
+            *error = "Bad arguments. second argument is invalid type.";
+            return 1;
         }
     }
-    if (args.Length() == 3) {
+    if (argc == 3) {
         if (args[1]->IsString()) {
-            return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. too many arguments."))));
+            *error = "Bad arguments. too many arguments.";
+            return 1;
         }
         if (!args[2]->IsString()) {
-            return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. third argument is invalid type."))));
+            *error = "Bad arguments. third argument is invalid type.";
+            return 1;
         }
-        modelArgumentIndex = 2;
+        *modelArgumentIndex = 2;
+    }
+    if (argc >= 4) {
+        *error = "Bad arguments. too many arguments.";
+        return 1;
+    }
+
+    return 0;
+}
+
+void VoiceMaker::InitConvertBaton(ConvertBaton *baton, VoiceMaker *voicemaker, int speed, int output) {
+    baton->voicemaker = voicemaker;
+    baton->text = NULL;
+    baton->textCopy = NULL;
+    baton->textLength = 0;
+    baton->speed = speed;
+    baton->modelFile = NULL;
+    baton->output = output;
+    baton->result = 0;
+    baton->waveBase64 = NULL;
+    baton->waveBase64Len = 0;
+    baton->wave = NULL;
+    baton->waveLen = 0;
+    baton->waveOwner = NULL;
+    baton->badText = NULL;
+    baton->error = NULL;
+    baton->stream = NULL;
+    baton->segment = 0;
+    baton->batch = NULL;
+    baton->snapshot = NULL;
+    baton->phont = NULL;
+    baton->requestId = NULL;
+    // set when handed to thread pool
+    baton->queued = 0;
+    if (voicemaker->trace->IsEnabled() && voicemaker->traceRequestId) {
+        baton->requestId = strdup(voicemaker->traceRequestId);
+    }
+}
+
+int VoiceMaker::QueueConvertBaton(ConvertBaton *baton, ThreadPool::Callback after) {
+    if (baton->voicemaker->trace->IsEnabled()) {
+        baton->queued = ConvertStats::Now();
+    }
+
+    return ThreadPool::Queue(VoiceMaker::ConvertWork, after, baton);
+}
+
+int VoiceMaker::NewConvertBaton(ConvertBaton **baton, const Arguments& args, int argc, int output, int async, const char **error) {
+    int modelArgumentIndex;
+    int speed;
+    ConvertBaton *newBaton;
+
+    if (ParseConvertArguments(args, argc, &speed, &modelArgumentIndex, error)) {
+        return 1;
     }
-    if (args.Length() >= 4) {
-        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. too many arguments."))));
+    newBaton = new ConvertBaton();
+    InitConvertBaton(newBaton, Unwrap<VoiceMaker>(args.This()), speed, output);
+    if (SetConvertText(newBaton, args[0], async, error)) {
+        DeleteConvertBaton(newBaton);
+        return 1;
     }
     if (modelArgumentIndex != -1) {
         String::Utf8Value modelFile(args[modelArgumentIndex]->ToString());
-        return voicemaker->Convert(*textString, textString.length(), speed, *modelFile);
+        newBaton->modelFile = strdup(*modelFile);
+        if (newBaton->modelFile == NULL) {
+            DeleteConvertBaton(newBaton);
+            *error = "failed in allocate buffer of model file.";
+            return 1;
+        }
+    }
+    *baton = newBaton;
+
+    return 0;
+}
+
+int VoiceMaker::AcquireConvertBaton(ConvertBaton *baton, const char **error) {
+    VoiceMaker *voicemaker = baton->voicemaker;
+    unsigned long long start;
+    int result;
+
+    if (voicemaker->dictionary->Acquire(&baton->snapshot)) {
+        baton->snapshot = NULL;
+        *error = "failed in acquire dictionary.";
+        return 1;
+    }
+    if (baton->modelFile == NULL) {
+        return 0;
+    }
+    start = ConvertStats::Now();
+    if ((result = voicemaker->phontRegistry->Acquire(&baton->phont, baton->modelFile))) {
+        // reported by callback like other errors of conversion
+        baton->phont = NULL;
+        voicemaker->stats->RecordError(ConvertStats::MODEL_LOAD);
+        baton->result = 1;
+        baton->error = GetVoiceErrorMessage(result);
+        return 0;
+    }
+    voicemaker->RecordStage(ConvertStats::MODEL_LOAD, start);
+
+    return 0;
+}
+
+int VoiceMaker::NewSegmentBaton(ConvertBaton **baton, ConvertBaton *source, const TextSegment *segment, int output) {
+    ConvertBaton *newBaton;
+
+    newBaton = new ConvertBaton();
+    InitConvertBaton(newBaton, source->voicemaker, source->speed, output);
+    newBaton->text = source->text + segment->start;
+    newBaton->textLength = segment->length;
+    // events of segments are tagged with id of caller
+    free(newBaton->requestId);
+    newBaton->requestId = source->requestId ? strdup(source->requestId) : NULL;
+    // all segments are converted by dictionary and phont of source
+    newBaton->result = source->result;
+    newBaton->error = source->error;
+    newBaton->snapshot = source->snapshot;
+    if (newBaton->snapshot) {
+        newBaton->snapshot->Ref();
+    }
+    newBaton->phont = source->phont;
+    if (newBaton->phont) {
+        newBaton->phont->Ref();
+    }
+    *baton = newBaton;
+
+    return 0;
+}
+
+void VoiceMaker::DeleteConvertBaton(ConvertBaton *baton) {
+    if (!baton->callback.IsEmpty()) {
+        baton->callback.Dispose();
+    }
+    if (!baton->textBuffer.IsEmpty()) {
+        baton->textBuffer.Dispose();
+    }
+    free(baton->textCopy);
+    free(baton->modelFile);
+    free(baton->requestId);
+    if (baton->waveBase64) {
+        baton->voicemaker->Base64EncodeFree(baton->waveBase64);
+    }
+    ReleaseWave(baton->wave, baton->waveOwner);
+    if (baton->snapshot) {
+        baton->snapshot->Unref();
+    }
+    if (baton->phont) {
+        baton->phont->Unref();
+    }
+    free(baton->badText);
+    delete baton;
+}
+
+void VoiceMaker::FreeWave(char *data, void *hint) {
+    ReleaseWave((unsigned char *)data, (Synthesizer *)hint);
+}
+
+void VoiceMaker::ReleaseWave(unsigned char *wave, Synthesizer *waveOwner) {
+    if (wave == NULL) {
+        return;
+    }
+    if (waveOwner) {
+        waveOwner->FreeWave(wave);
+    } else {
+        free(wave);
+    }
+}
+
+Handle<Value> VoiceMaker::GetConvertResult(ConvertBaton *baton) {
+    HandleScope scope;
+
+    if (baton->result) {
+        baton->voicemaker->SetErrorText(baton->badText);
+        baton->badText = NULL;
+        return scope.Close(Exception::Error(String::New(baton->error)));
+    }
+    if (baton->output == OUTPUT_WAVE) {
+        Buffer *waveBuffer;
+        if (baton->wave) {
+            // wave is wrapped without copy and freed with buffer
+            waveBuffer = Buffer::New((char *)baton->wave, baton->waveLen, VoiceMaker::FreeWave, baton->waveOwner);
+            baton->wave = NULL;
+            baton->waveOwner = NULL;
+        } else {
+            waveBuffer = Buffer::New(0);
+        }
+        return scope.Close(waveBuffer->handle_);
+    }
+
+    return scope.Close(String::New(baton->waveBase64, baton->waveBase64Len));
+}
+
+Handle<Value> VoiceMaker::ConvertSync(const Arguments& args, int output) {
+    HandleScope scope;
+    const char *error;
+    ConvertBaton *baton;
+    StreamBaton *stream = NULL;
+    int i;
+
+    if (NewConvertBaton(&baton, args, args.Length(), output, 0, &error)) {
+        return scope.Close(ThrowException(Exception::Error(String::New(error))));
+    }
+    if (baton->textLength > SEGMENT_MAX_LENGTH) {
+        // segments are converted one by one and joined
+        if (NewStreamBaton(&stream, baton, 1, &error)) {
+            DeleteConvertBaton(baton);
+            return scope.Close(ThrowException(Exception::Error(String::New(error))));
+        }
+        for (i = 0; i < (int)stream->segments.size(); i++) {
+            ConvertWork(stream->segments[i]);
+        }
+        JoinWork(stream);
+    } else {
+        ConvertWork(baton);
+    }
+    Handle<Value> result = GetConvertResult(baton);
+    int failed = baton->result;
+    if (stream) {
+        DeleteStreamBaton(stream);
+    } else {
+        DeleteConvertBaton(baton);
+    }
+    if (failed) {
+        return scope.Close(ThrowException(result));
+    }
+
+    return scope.Close(result);
+}
+
+Handle<Value> VoiceMaker::QueueConvert(const Arguments& args, int output) {
+    HandleScope scope;
+    const char *error;
+    ConvertBaton *baton;
+    StreamBaton *stream;
+
+    /* text(string or buffer), [[speed(int32)], [modelFile(string)]], callback(function) */
+    if (args.Length() < 2 || !args[args.Length() - 1]->IsFunction()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. no callback."))));
+    }
+    if (NewConvertBaton(&baton, args, args.Length() - 1, output, 1, &error)) {
+        return scope.Close(ThrowException(Exception::Error(String::New(error))));
+    }
+    if (baton->textLength > SEGMENT_MAX_LENGTH) {
+        // segments are converted in parallel and joined
+        if (NewStreamBaton(&stream, baton, 1, &error)) {
+            DeleteConvertBaton(baton);
+            return scope.Close(ThrowException(Exception::Error(String::New(error))));
+        }
+        if (QueueStreamBaton(stream)) {
+            DeleteStreamBaton(stream);
+            return scope.Close(ThrowException(Exception::Error(String::New("failed in queue work of convert."))));
+        }
+        stream->callback = Persistent<Function>::New(Local<Function>::Cast(args[args.Length() - 1]));
+        stream->voicemaker->Ref();
+        return Undefined();
+    }
+    baton->callback = Persistent<Function>::New(Local<Function>::Cast(args[args.Length() - 1]));
+    if (QueueConvertBaton(baton, VoiceMaker::ConvertAfter)) {
+        DeleteConvertBaton(baton);
+        return scope.Close(ThrowException(Exception::Error(String::New("failed in queue work of convert."))));
+    }
+    baton->voicemaker->Ref();
+
+    return Undefined();
+}
+
+Handle<Value> VoiceMaker::Convert(const Arguments& args) {
+    return ConvertSync(args, OUTPUT_BASE64);
+}
+
+Handle<Value> VoiceMaker::ConvertAsync(const Arguments& args) {
+    return QueueConvert(args, OUTPUT_BASE64);
+}
+
+Handle<Value> VoiceMaker::ConvertWave(const Arguments& args) {
+    return ConvertSync(args, OUTPUT_WAVE);
+}
+
+Handle<Value> VoiceMaker::ConvertWaveAsync(const Arguments& args) {
+    return QueueConvert(args, OUTPUT_WAVE);
+}
+
+Handle<Value> VoiceMaker::ConvertStream(const Arguments& args) {
+    return QueueStream(args, OUTPUT_BASE64);
+}
+
+Handle<Value> VoiceMaker::ConvertWaveStream(const Arguments& args) {
+    return QueueStream(args, OUTPUT_WAVE);
+}
+
+Handle<Value> VoiceMaker::ConvertBatch(const Arguments& args) {
+    return QueueBatch(args, OUTPUT_BASE64);
+}
+
+Handle<Value> VoiceMaker::ConvertWaveBatch(const Arguments& args) {
+    return QueueBatch(args, OUTPUT_WAVE);
+}
+
+int VoiceMaker::SetConvertText(ConvertBaton *baton, Handle<Value> text, int async, const char **error) {
+    if (Buffer::HasInstance(text)) {
+        Local<Object> textBuffer = text->ToObject();
+        baton->text = Buffer::Data(textBuffer);
+        baton->textLength = Buffer::Length(textBuffer);
+        if (async) {
+            baton->textBuffer = Persistent<Object>::New(textBuffer);
+        }
     } else {
-        return voicemaker->Convert(*textString, textString.length(), speed, NULL);
+        String::Utf8Value textString(text->ToString());
+        baton->textLength = textString.length();
+        baton->textCopy = (char *)malloc(baton->textLength + 1);
+        if (baton->textCopy == NULL) {
+            *error = "failed in allocate buffer of text.";
+            return 1;
+        }
+        memcpy(baton->textCopy, *textString, baton->textLength + 1);
+        baton->text = baton->textCopy;
+    }
+
+    return 0;
+}
+
+int VoiceMaker::ValidateBatchItem(Handle<Value> item, const char **error) {
+    HandleScope scope;
+
+    /* {text(string or buffer), [speed(int32)], [model(string)]} */
+    if (!item->IsObject()) {
+        *error = "Bad arguments. item is not object.";
+        return 1;
+    }
+    Local<Object> object = item->ToObject();
+    Local<Value> text = object->Get(String::NewSymbol("text"));
+    Local<Value> speed = object->Get(String::NewSymbol("speed"));
+    Local<Value> model = object->Get(String::NewSymbol("model"));
+    if (!text->IsString() && !Buffer::HasInstance(text)) {
+        *error = "Bad arguments. no text in item.";
+        return 1;
+    }
+    if (!speed->IsUndefined()) {
+        if (!speed->IsInt32()) {
+            *error = "Bad arguments. speed of item is invalid type.";
+            return 1;
+        }
+        if (speed->ToInt32()->Value() < 30 || speed->ToInt32()->Value() > 300) {
+            *error = "Bad arguments. speed of item is out of range.";
+            return 1;
+        }
     }
+    if (!model->IsUndefined() && !model->IsString()) {
+        *error = "Bad arguments. model of item is invalid type.";
+        return 1;
+    }
+
+    return 0;
+}
+
+void VoiceMaker::DeleteBatchBaton(BatchBaton *batch) {
+    int i;
+    map<string, Phont *>::iterator phontIterator;
+
+    if (!batch->callback.IsEmpty()) {
+        batch->callback.Dispose();
+    }
+    for (i = 0; i < (int)batch->items.size(); i++) {
+        DeleteConvertBaton(batch->items[i]);
+    }
+    for (phontIterator = batch->phonts.begin(); phontIterator != batch->phonts.end(); phontIterator++) {
+        phontIterator->second->Unref();
+    }
+    if (batch->snapshot) {
+        batch->snapshot->Unref();
+    }
+    delete batch;
+}
+
+Handle<Value> VoiceMaker::QueueBatch(const Arguments& args, int output) {
+    HandleScope scope;
+    const char *error;
+    BatchBaton *batch;
+    int length;
+    int i;
+
+    /* items(array), callback(function) */
+    if (args.Length() != 2 || !args[0]->IsArray() || !args[1]->IsFunction()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. required items and callback."))));
+    }
+    Local<Array> items = Local<Array>::Cast(args[0]);
+    length = items->Length();
+    if (length < 1) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. no item."))));
+    }
+    // nothing is queued if any item is invalid
+    for (i = 0; i < length; i++) {
+        if (ValidateBatchItem(items->Get(i), &error)) {
+            return scope.Close(ThrowException(Exception::Error(String::New(error))));
+        }
+    }
+    batch = new BatchBaton();
+    batch->voicemaker = Unwrap<VoiceMaker>(args.This());
+    batch->pending = 0;
+    batch->snapshot = NULL;
+    // items share snapshot of dictionary and phont of same model
+    if (batch->voicemaker->dictionary->Acquire(&batch->snapshot)) {
+        DeleteBatchBaton(batch);
+        return scope.Close(ThrowException(Exception::Error(String::New("failed in acquire dictionary."))));
+    }
+    for (i = 0; i < length; i++) {
+        Local<Object> object = items->Get(i)->ToObject();
+        Local<Value> speed = object->Get(String::NewSymbol("speed"));
+        Local<Value> model = object->Get(String::NewSymbol("model"));
+        ConvertBaton *item = new ConvertBaton();
+        InitConvertBaton(item, batch->voicemaker, speed->IsUndefined() ? 100 : speed->ToInt32()->Value(), output);
+        item->batch = batch;
+        batch->items.push_back(item);
+        if (SetConvertText(item, object->Get(String::NewSymbol("text")), 1, &error)) {
+            DeleteBatchBaton(batch);
+            return scope.Close(ThrowException(Exception::Error(String::New(error))));
+        }
+        item->snapshot = batch->snapshot;
+        item->snapshot->Ref();
+        if (!model->IsUndefined()) {
+            String::Utf8Value modelFile(model->ToString());
+            map<string, Phont *>::iterator phontIterator = batch->phonts.find(*modelFile);
+            if (phontIterator != batch->phonts.end()) {
+                item->phont = phontIterator->second;
+                item->phont->Ref();
+            } else {
+                Phont *phont;
+                int result;
+                unsigned long long start = ConvertStats::Now();
+                if ((result = batch->voicemaker->phontRegistry->Acquire(&phont, *modelFile))) {
+                    // only this item fails
+                    batch->voicemaker->stats->RecordError(ConvertStats::MODEL_LOAD);
+                    item->result = 1;
+                    item->error = GetVoiceErrorMessage(result);
+                } else {
+                    batch->voicemaker->RecordStage(ConvertStats::MODEL_LOAD, start);
+                    batch->phonts[*modelFile] = phont;
+                    item->phont = phont;
+                    item->phont->Ref();
+                }
+            }
+        }
+    }
+    for (i = 0; i < length; i++) {
+        if (QueueBatchItem(batch->items[i])) {
+            if (batch->pending == 0) {
+                DeleteBatchBaton(batch);
+                return scope.Close(ThrowException(Exception::Error(String::New("failed in queue work of convert."))));
+            }
+            for (; i < length; i++) {
+                batch->items[i]->result = 1;
+                batch->items[i]->error = "failed in queue work of convert.";
+            }
+            break;
+        }
+        batch->pending++;
+    }
+    batch->callback = Persistent<Function>::New(Local<Function>::Cast(args[1]));
+    batch->voicemaker->Ref();
+
+    return Undefined();
+}
+
+int VoiceMaker::QueueBatchItem(ConvertBaton *item) {
+    StreamBaton *stream;
+    const char *error;
+
+    if (item->result || item->textLength <= SEGMENT_MAX_LENGTH) {
+        return QueueConvertBaton(item, VoiceMaker::BatchAfter);
+    }
+    // long item is split and joined like convertAsync, with snapshot and phont of batch
+    if (NewStreamBaton(&stream, item, 1, &error)) {
+        item->result = 1;
+        item->error = error;
+        return QueueConvertBaton(item, VoiceMaker::BatchAfter);
+    }
+    if (QueueStreamBaton(stream)) {
+        // item is owned by batch
+        stream->source = NULL;
+        DeleteStreamBaton(stream);
+        return 1;
+    }
+
+    return 0;
+}
+
+void VoiceMaker::BatchAfter(void *data) {
+    HandleScope scope;
+    ConvertBaton *baton = (ConvertBaton *)data;
+    BatchBaton *batch = baton->batch;
+    Handle<Value> argv[2];
+    int i;
+
+    batch->pending--;
+    if (batch->pending > 0) {
+        return;
+    }
+    // result of item is data or Error
+    Local<Array> results = Array::New(batch->items.size());
+    for (i = 0; i < (int)batch->items.size(); i++) {
+        results->Set(i, GetConvertResult(batch->items[i]));
+    }
+    argv[0] = Null();
+    argv[1] = results;
+    batch->voicemaker->Unref();
+    TryCatch tryCatch;
+    batch->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (tryCatch.HasCaught()) {
+        FatalException(tryCatch);
+    }
+    DeleteBatchBaton(batch);
+}
+
+int VoiceMaker::IsBlankSegment(const char *text, int textLength) {
+    const unsigned char *p = (const unsigned char *)text;
+    int i = 0;
+
+    while (i < textLength) {
+        if (p[i] == ' ' || p[i] == '\t' || p[i] == '\r' || p[i] == '\n') {
+            i += 1;
+        } else if (i + 3 <= textLength && p[i] == 0xE3 && p[i + 1] == 0x80 &&
+                   (p[i + 2] == 0x80 || p[i + 2] == 0x81 || p[i + 2] == 0x82)) {
+            // full width space, 、 and 。
+            i += 3;
+        } else if (i + 3 <= textLength && p[i] == 0xEF && p[i + 1] == 0xBC &&
+                   (p[i + 2] == 0x81 || p[i + 2] == 0x9F)) {
+            // ！ and ？
+            i += 3;
+        } else {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void VoiceMaker::SplitText(vector<TextSegment> *segments, const char *text, int textLength, int maxLength) {
+    const unsigned char *p = (const unsigned char *)text;
+    vector<TextSegment> clauses;
+    TextSegment segment;
+    int start = 0;
+    int i = 0;
+
+    // split after 、。！？ and newline, delimiter is kept in segment
+    while (i <= textLength) {
+        int end = -1;
+        if (i == textLength) {
+            end = i;
+        } else if (p[i] == '\n') {
+            end = i + 1;
+        } else if (i + 3 <= textLength &&
+                   ((p[i] == 0xE3 && p[i + 1] == 0x80 && (p[i + 2] == 0x81 || p[i + 2] == 0x82)) ||
+                    (p[i] == 0xEF && p[i + 1] == 0xBC && (p[i + 2] == 0x81 || p[i + 2] == 0x9F)))) {
+            end = i + 3;
+        }
+        if (end == -1) {
+            i++;
+            continue;
+        }
+        if (!IsBlankSegment(text + start, end - start)) {
+            segment.start = start;
+            segment.length = end - start;
+            clauses.push_back(segment);
+        }
+        start = end;
+        i = (end > i) ? end : i + 1;
+    }
+    if (maxLength <= 0) {
+        segments->swap(clauses);
+    } else {
+        // pack clauses up to max length, too long clause is cut at character boundary
+        for (i = 0; i < (int)clauses.size(); i++) {
+            TextSegment clause = clauses[i];
+            if (!segments->empty() &&
+                clause.start + clause.length - segments->back().start <= maxLength) {
+                segments->back().length = clause.start + clause.length - segments->back().start;
+                continue;
+            }
+            while (clause.length > maxLength) {
+                int length = maxLength;
+                while (length > 0 && (p[clause.start + length] & 0xC0) == 0x80) {
+                    length--;
+                }
+                if (length == 0) {
+                    length = maxLength;
+                }
+                segment.start = clause.start;
+                segment.length = length;
+                segments->push_back(segment);
+                clause.start += length;
+                clause.length -= length;
+            }
+            segments->push_back(clause);
+        }
+    }
+    if (segments->empty()) {
+        segment.start = 0;
+        segment.length = 0;
+        segments->push_back(segment);
+    }
+}
+
+int VoiceMaker::NewStreamBaton(StreamBaton **stream, ConvertBaton *source, int join, const char **error) {
+    StreamBaton *newStream;
+    vector<TextSegment> textSegments;
+    int i;
+
+    newStream = new StreamBaton();
+    newStream->voicemaker = source->voicemaker;
+    newStream->source = source;
+    newStream->emitted = 0;
+    newStream->pending = 0;
+    newStream->stopped = 0;
+    newStream->join = join;
+    // items of batch already share snapshot and phont of batch
+    if (source->snapshot == NULL && AcquireConvertBaton(source, error)) {
+        newStream->source = NULL;
+        DeleteStreamBaton(newStream);
+        return 1;
+    }
+    SplitText(&textSegments, source->text, source->textLength, join ? SEGMENT_MAX_LENGTH : 0);
+    for (i = 0; i < (int)textSegments.size(); i++) {
+        ConvertBaton *segment;
+        // joined segments are always converted to wave
+        if (NewSegmentBaton(&segment, source, &textSegments[i], join ? OUTPUT_WAVE : source->output)) {
+            newStream->source = NULL;
+            DeleteStreamBaton(newStream);
+            *error = "failed in allocate baton of segment.";
+            return 1;
+        }
+        segment->stream = newStream;
+        segment->segment = i;
+        newStream->segments.push_back(segment);
+        newStream->done.push_back(0);
+    }
+    *stream = newStream;
+
+    return 0;
+}
+
+int VoiceMaker::QueueStreamBaton(StreamBaton *stream) {
+    int i;
+
+    // segments are converted in parallel, results are used in order
+    for (i = 0; i < (int)stream->segments.size(); i++) {
+        if (QueueConvertBaton(stream->segments[i], VoiceMaker::SegmentAfter)) {
+            if (stream->pending == 0) {
+                return 1;
+            }
+            stream->segments[i]->result = 1;
+            stream->segments[i]->error = "failed in queue work of convert.";
+            stream->done[i] = 1;
+            break;
+        }
+        stream->pending++;
+    }
+
+    return 0;
+}
+
+Handle<Value> VoiceMaker::QueueStream(const Arguments& args, int output) {
+    HandleScope scope;
+    const char *error;
+    ConvertBaton *source;
+    StreamBaton *stream;
+
+    /* text(string or buffer), [[speed(int32)], [modelFile(string)]], callback(function) */
+    if (args.Length() < 2 || !args[args.Length() - 1]->IsFunction()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. no callback."))));
+    }
+    if (NewConvertBaton(&source, args, args.Length() - 1, output, 1, &error)) {
+        return scope.Close(ThrowException(Exception::Error(String::New(error))));
+    }
+    if (NewStreamBaton(&stream, source, 0, &error)) {
+        DeleteConvertBaton(source);
+        return scope.Close(ThrowException(Exception::Error(String::New(error))));
+    }
+    if (QueueStreamBaton(stream)) {
+        DeleteStreamBaton(stream);
+        return scope.Close(ThrowException(Exception::Error(String::New("failed in queue work of convert."))));
+    }
+    stream->callback = Persistent<Function>::New(Local<Function>::Cast(args[args.Length() - 1]));
+    stream->voicemaker->Ref();
+
+    return Undefined();
+}
+
+void VoiceMaker::SegmentAfter(void *data) {
+    HandleScope scope;
+    ConvertBaton *baton = (ConvertBaton *)data;
+    StreamBaton *stream = baton->stream;
+
+    stream->pending--;
+    stream->done[baton->segment] = 1;
+    if (stream->join) {
+        if (stream->pending == 0 &&
+            ThreadPool::Queue(VoiceMaker::JoinWork, VoiceMaker::JoinAfter, stream)) {
+            JoinWork(stream);
+            JoinAfter(stream);
+        }
+        return;
+    }
+    EmitSegments(stream);
+    if (stream->pending == 0) {
+        stream->voicemaker->Unref();
+        DeleteStreamBaton(stream);
+    }
+}
+
+void VoiceMaker::JoinWork(void *data) {
+    StreamBaton *stream = (StreamBaton *)data;
+    ConvertBaton *source = stream->source;
+
+    if (source->requestId) {
+        source->voicemaker->trace->SetRequestId(source->requestId);
+    }
+    JoinSegments(stream);
+    if (source->requestId) {
+        source->voicemaker->trace->SetRequestId(NULL);
+    }
+}
+
+void VoiceMaker::JoinSegments(StreamBaton *stream) {
+    ConvertBaton *source = stream->source;
+    vector<unsigned char *> waves;
+    vector<int> waveLens;
+    int i;
+
+    for (i = 0; i < (int)stream->segments.size(); i++) {
+        ConvertBaton *segment = stream->segments[i];
+        if (segment->result) {
+            // first error in order of text
+            source->result = segment->result;
+            source->error = segment->error;
+            source->badText = segment->badText;
+            segment->badText = NULL;
+            return;
+        }
+        waves.push_back(segment->wave);
+        waveLens.push_back(segment->waveLen);
+    }
+    if (JoinWave(&source->wave, &source->waveLen, &waves[0], &waveLens[0], waves.size())) {
+        source->result = 1;
+        source->error = "failed in join wave of segments.";
+        return;
+    }
+    if (source->output == OUTPUT_BASE64) {
+        if (source->voicemaker->Base64Encode(&source->waveBase64, &source->waveBase64Len, source->wave, source->waveLen)) {
+            source->result = 1;
+            source->error = "failed in encode to base64.";
+        }
+        ReleaseWave(source->wave, source->waveOwner);
+        source->wave = NULL;
+        source->waveLen = 0;
+    }
+}
+
+void VoiceMaker::JoinAfter(void *data) {
+    HandleScope scope;
+    StreamBaton *stream = (StreamBaton *)data;
+    ConvertBaton *source = stream->source;
+    Handle<Value> argv[2];
+
+    if (source->batch) {
+        // item of batch is owned and answered by batch
+        stream->source = NULL;
+        DeleteStreamBaton(stream);
+        BatchAfter(source);
+        return;
+    }
+    if (source->result) {
+        argv[0] = GetConvertResult(source);
+        argv[1] = Undefined();
+    } else {
+        argv[0] = Null();
+        argv[1] = GetConvertResult(source);
+    }
+    stream->voicemaker->Unref();
+    TryCatch tryCatch;
+    stream->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (tryCatch.HasCaught()) {
+        FatalException(tryCatch);
+    }
+    DeleteStreamBaton(stream);
+}
+
+void VoiceMaker::SetWaveSize(unsigned char *ptr, int size) {
+    // little endian
+    ptr[0] = size & 0xff;
+    ptr[1] = (size >> 8) & 0xff;
+    ptr[2] = (size >> 16) & 0xff;
+    ptr[3] = (size >> 24) & 0xff;
+}
+
+int VoiceMaker::FindWaveChunk(const unsigned char *wave, int waveLen, const char *id, int *offset, int *size) {
+    int position = 12;
+
+    if (waveLen < 12 || memcmp(wave, "RIFF", 4) != 0 || memcmp(wave + 8, "WAVE", 4) != 0) {
+        return 1;
+    }
+    while (position + 8 <= waveLen) {
+        int chunkSize = wave[position + 4] | (wave[position + 5] << 8) | (wave[position + 6] << 16) | (wave[position + 7] << 24);
+        if (chunkSize < 0 || chunkSize > waveLen - position - 8) {
+            return 1;
+        }
+        if (memcmp(wave + position, id, 4) == 0) {
+            *offset = position + 8;
+            *size = chunkSize;
+            return 0;
+        }
+        position += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    return 1;
+}
+
+int VoiceMaker::JoinWave(unsigned char **wave, int *waveLen, unsigned char * const *waves, const int *waveLens, int count) {
+    const unsigned char *format = NULL;
+    int formatSize = 0;
+    int dataSize = 0;
+    int offset;
+    int size;
+    unsigned char *newWave;
+    unsigned char *ptr;
+    int i;
+
+    *wave = NULL;
+    *waveLen = 0;
+    // empty segment has no wave
+    for (i = 0; i < count; i++) {
+        if (waves[i] == NULL || waveLens[i] == 0) {
+            continue;
+        }
+        if (FindWaveChunk(waves[i], waveLens[i], "fmt ", &offset, &size)) {
+            return 1;
+        }
+        if (format == NULL) {
+            format = waves[i] + offset;
+            formatSize = size;
+        } else if (size != formatSize || memcmp(format, waves[i] + offset, size) != 0) {
+            return 2;
+        }
+        if (FindWaveChunk(waves[i], waveLens[i], "data", &offset, &size)) {
+            return 1;
+        }
+        dataSize += size;
+    }
+    if (format == NULL) {
+        return 0;
+    }
+    newWave = (unsigned char *)malloc(20 + formatSize + 8 + dataSize);
+    if (newWave == NULL) {
+        return 3;
+    }
+    // riff header, fmt chunk of first wave and data of all waves
+    ptr = newWave;
+    memcpy(ptr, "RIFF", 4);
+    SetWaveSize(ptr + 4, 4 + 8 + formatSize + 8 + dataSize);
+    memcpy(ptr + 8, "WAVE", 4);
+    memcpy(ptr + 12, "fmt ", 4);
+    SetWaveSize(ptr + 16, formatSize);
+    memcpy(ptr + 20, format, formatSize);
+    ptr += 20 + formatSize;
+    memcpy(ptr, "data", 4);
+    SetWaveSize(ptr + 4, dataSize);
+    ptr += 8;
+    for (i = 0; i < count; i++) {
+        if (waves[i] == NULL || waveLens[i] == 0) {
+            continue;
+        }
+        FindWaveChunk(waves[i], waveLens[i], "data", &offset, &size);
+        memcpy(ptr, waves[i] + offset, size);
+        ptr += size;
+    }
+    *wave = newWave;
+    *waveLen = ptr - newWave;
+
+    return 0;
+}
+
+void VoiceMaker::EmitSegments(StreamBaton *stream) {
+    HandleScope scope;
+    Handle<Value> argv[2];
+
+    while (!stream->stopped &&
+           stream->emitted < (int)stream->segments.size() &&
+           stream->done[stream->emitted]) {
+        ConvertBaton *segment = stream->segments[stream->emitted];
+        if (segment->result) {
+            argv[0] = GetConvertResult(segment);
+            argv[1] = Undefined();
+            // segments after error are not emitted
+            stream->stopped = 1;
+        } else {
+            argv[0] = Null();
+            argv[1] = GetConvertResult(segment);
+        }
+        DeleteConvertBaton(segment);
+        stream->segments[stream->emitted] = NULL;
+        stream->emitted++;
+        TryCatch tryCatch;
+        stream->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+        if (tryCatch.HasCaught()) {
+            FatalException(tryCatch);
+        }
+    }
+    if (!stream->stopped && stream->emitted == (int)stream->segments.size()) {
+        // end of stream
+        argv[0] = Null();
+        argv[1] = Null();
+        stream->stopped = 1;
+        TryCatch tryCatch;
+        stream->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+        if (tryCatch.HasCaught()) {
+            FatalException(tryCatch);
+        }
+    }
+}
+
+void VoiceMaker::DeleteStreamBaton(StreamBaton *stream) {
+    int i;
+
+    if (!stream->callback.IsEmpty()) {
+        stream->callback.Dispose();
+    }
+    for (i = 0; i < (int)stream->segments.size(); i++) {
+        if (stream->segments[i]) {
+            DeleteConvertBaton(stream->segments[i]);
+        }
+    }
+    if (stream->source) {
+        DeleteConvertBaton(stream->source);
+    }
+    delete stream;
+}
+
+void VoiceMaker::ConvertWork(void *data) {
+    ConvertBaton *baton = (ConvertBaton *)data;
+    TraceBuffer *trace = baton->voicemaker->trace;
+
+    if (baton->result) {
+        // failed before queued
+        return;
+    }
+    if (baton->requestId) {
+        trace->SetRequestId(baton->requestId);
+    }
+    if (baton->queued) {
+        trace->Add("queue", baton->queued, ConvertStats::Now() - baton->queued, 0);
+    }
+    baton->voicemaker->slowLog->Begin(baton->text, baton->textLength);
+    if (baton->snapshot) {
+        baton->result = baton->voicemaker->ConvertWave(&baton->wave, &baton->waveLen, &baton->waveOwner, &baton->badText, &baton->error, baton->text, baton->textLength, baton->speed, baton->snapshot, baton->phont);
+        if (baton->result == 0 && baton->output == OUTPUT_BASE64) {
+            if (baton->voicemaker->Base64Encode(&baton->waveBase64, &baton->waveBase64Len, baton->wave, baton->waveLen)) {
+                baton->result = 1;
+                baton->error = "failed in encode to base64.";
+            }
+            ReleaseWave(baton->wave, baton->waveOwner);
+            baton->wave = NULL;
+            baton->waveOwner = NULL;
+        }
+    } else if (baton->output == OUTPUT_WAVE) {
+        baton->result = baton->voicemaker->ConvertWave(&baton->wave, &baton->waveLen, &baton->waveOwner, &baton->badText, &baton->error, baton->text, baton->textLength, baton->speed, baton->modelFile);
+    } else {
+        baton->result = baton->voicemaker->Convert(&baton->waveBase64, &baton->waveBase64Len, &baton->badText, &baton->error, baton->text, baton->textLength, baton->speed, baton->modelFile);
+    }
+    baton->voicemaker->slowLog->End(baton->waveBase64 ? baton->waveBase64Len : baton->waveLen, baton->result ? baton->error : NULL);
+    if (baton->requestId) {
+        trace->SetRequestId(NULL);
+    }
+}
+
+void VoiceMaker::ConvertAfter(void *data) {
+    HandleScope scope;
+    ConvertBaton *baton = (ConvertBaton *)data;
+    Handle<Value> argv[2];
+
+    if (baton->result) {
+        argv[0] = GetConvertResult(baton);
+        argv[1] = Undefined();
+    } else {
+        argv[0] = Null();
+        argv[1] = GetConvertResult(baton);
+    }
+    baton->voicemaker->Unref();
+    TryCatch tryCatch;
+    baton->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (tryCatch.HasCaught()) {
+        FatalException(tryCatch);
+    }
+    DeleteConvertBaton(baton);
+}
+
+Handle<Value> VoiceMaker::RegisterVoice(const Arguments& args) {
+    HandleScope scope;
+    int result;
+
+    if (args.Length() != 2 || !args[0]->IsString() || !args[1]->IsString()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. required voice name and model file."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    String::Utf8Value name(args[0]->ToString());
+    String::Utf8Value modelFile(args[1]->ToString());
+    if (name.length() < 1 || modelFile.length() < 1) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. specified empty string."))));
+    }
+    if ((result = voicemaker->phontRegistry->Register(*name, *modelFile))) {
+        return scope.Close(ThrowException(Exception::Error(String::New(GetVoiceErrorMessage(result)))));
+    }
+
+    return Undefined();
+}
+
+Handle<Value> VoiceMaker::UnregisterVoice(const Arguments& args) {
+    HandleScope scope;
+    int result;
+
+    if (args.Length() != 1 || !args[0]->IsString()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. required voice name."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    String::Utf8Value name(args[0]->ToString());
+    if ((result = voicemaker->phontRegistry->Unregister(*name))) {
+        return scope.Close(ThrowException(Exception::Error(String::New(GetVoiceErrorMessage(result)))));
+    }
+
+    return Undefined();
+}
+
+Handle<Value> VoiceMaker::ReloadVoice(const Arguments& args) {
+    HandleScope scope;
+    int result;
+
+    if (args.Length() != 1 || !args[0]->IsString()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. required voice name."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    String::Utf8Value name(args[0]->ToString());
+    if ((result = voicemaker->phontRegistry->Reload(*name))) {
+        return scope.Close(ThrowException(Exception::Error(String::New(GetVoiceErrorMessage(result)))));
+    }
+
+    return Undefined();
+}
+
+Handle<Value> VoiceMaker::SetCacheSize(const Arguments& args) {
+    HandleScope scope;
+
+    /* size(number of bytes), 0 disables cache */
+    if (args.Length() != 1 || !args[0]->IsNumber() || args[0]->NumberValue() < 0) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. required size of cache."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    voicemaker->audioCache->SetMaxSize((size_t)args[0]->NumberValue());
+
+    return Undefined();
+}
+
+Handle<Value> VoiceMaker::SetReadingCacheSize(const Arguments& args) {
+    HandleScope scope;
+
+    /* size(number of bytes), 0 disables cache */
+    if (args.Length() != 1 || !args[0]->IsNumber() || args[0]->NumberValue() < 0) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. required size of cache."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    voicemaker->readingCache->SetMaxSize((size_t)args[0]->NumberValue());
+
+    return Undefined();
+}
+
+Handle<Object> VoiceMaker::NewCacheStats(ConvertCache *cache) {
+    HandleScope scope;
+    ConvertCache::Stats stats;
+
+    cache->GetStats(&stats);
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("size"), Number::New((double)stats.size));
+    result->Set(String::NewSymbol("maxSize"), Number::New((double)stats.maxSize));
+    result->Set(String::NewSymbol("entries"), Integer::New(stats.entries));
+    result->Set(String::NewSymbol("hits"), Number::New((double)stats.hits));
+    result->Set(String::NewSymbol("misses"), Number::New((double)stats.misses));
+    result->Set(String::NewSymbol("evictions"), Number::New((double)stats.evictions));
+    result->Set(String::NewSymbol("invalidations"), Number::New((double)stats.invalidations));
+
+    return scope.Close(result);
+}
+
+Handle<Value> VoiceMaker::GetCacheStats(const Arguments& args) {
+    HandleScope scope;
+    SharedCache::Stats sharedStats;
+
+    if (args.Length() > 0) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. must be no argument."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    // stats of wave cache, others are nested
+    Handle<Object> result = NewCacheStats(voicemaker->audioCache);
+    result->Set(String::NewSymbol("reading"), NewCacheStats(voicemaker->readingCache));
+    if (voicemaker->sharedCache->GetStats(&sharedStats) == 0) {
+        Local<Object> shared = Object::New();
+        shared->Set(String::NewSymbol("size"), Number::New((double)sharedStats.size));
+        shared->Set(String::NewSymbol("hits"), Number::New((double)sharedStats.hits));
+        shared->Set(String::NewSymbol("misses"), Number::New((double)sharedStats.misses));
+        shared->Set(String::NewSymbol("evictions"), Number::New((double)sharedStats.evictions));
+        result->Set(String::NewSymbol("shared"), shared);
+    }
+
+    return scope.Close(result);
+}
+
+Handle<Value> VoiceMaker::SetSharedCache(const Arguments& args) {
+    HandleScope scope;
+    const char *error;
+    int result;
+
+    /* path(string), size(number of bytes) or null */
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    if (args.Length() == 1 && args[0]->IsNull()) {
+        voicemaker->sharedCache->Close();
+        return Undefined();
+    }
+    if (args.Length() != 2 || !args[0]->IsString() || !args[1]->IsNumber() || args[1]->NumberValue() < 0) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. required path and size of shared cache."))));
+    }
+    String::Utf8Value path(args[0]->ToString());
+    if ((result = voicemaker->sharedCache->Open(*path, (size_t)args[1]->NumberValue()))) {
+        switch (result) {
+        case 1:
+            error = "too small size of shared cache.";
+            break;
+        case 2:
+            error = "failed in open file of shared cache.";
+            break;
+        case 3:
+            error = "failed in lock or resize file of shared cache.";
+            break;
+        case 4:
+            error = "failed in map file of shared cache.";
+            break;
+        case 5:
+            error = "invalid file of shared cache.";
+            break;
+        case 6:
+            error = "failed in initialize shared cache.";
+            break;
+        default:
+            error = "preferred error";
+            break;
+        }
+        return scope.Close(ThrowException(Exception::Error(String::New(error))));
+    }
+
+    return Undefined();
+}
+
+Handle<Value> VoiceMaker::GetStats(const Arguments& args) {
+    HandleScope scope;
+    ConvertStats::Counters counters;
+    ConvertStats::Summary summary;
+    int stage;
+
+    /* [format(string)], "prometheus" returns text */
+    if (args.Length() > 1 || (args.Length() == 1 && !args[0]->IsString())) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. format must be string."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    if (args.Length() == 1) {
+        String::Utf8Value format(args[0]->ToString());
+        if (strcmp(*format, "prometheus") != 0) {
+            return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. unknown format."))));
+        }
+        string text;
+        char line[128];
+        voicemaker->stats->WritePrometheus(&text);
+        text.append("# HELP voicemaker_arena_bytes Bytes held by buffers of conversion threads.\n");
+        text.append("# TYPE voicemaker_arena_bytes gauge\n");
+        snprintf(line, sizeof(line), "voicemaker_arena_bytes %llu\n", (unsigned long long)ConvertArena::GetTotalCapacity());
+        text.append(line);
+        return scope.Close(String::New(text.c_str(), text.size()));
+    }
+    voicemaker->stats->GetCounters(&counters);
+    Local<Object> result = Object::New();
+    Local<Object> errors = Object::New();
+    Local<Object> stages = Object::New();
+    result->Set(String::NewSymbol("requests"), Number::New((double)counters.requests));
+    result->Set(String::NewSymbol("inputBytes"), Number::New((double)counters.inputBytes));
+    result->Set(String::NewSymbol("outputBytes"), Number::New((double)counters.outputBytes));
+    // times are nanoseconds
+    for (stage = 0; stage < ConvertStats::STAGE_COUNT; stage++) {
+        Local<Object> stageStats = Object::New();
+        voicemaker->stats->GetSummary(&summary, stage);
+        stageStats->Set(String::NewSymbol("count"), Number::New((double)summary.count));
+        stageStats->Set(String::NewSymbol("sum"), Number::New((double)summary.sum));
+        stageStats->Set(String::NewSymbol("max"), Number::New((double)summary.max));
+        stageStats->Set(String::NewSymbol("p50"), Number::New((double)summary.p50));
+        stageStats->Set(String::NewSymbol("p90"), Number::New((double)summary.p90));
+        stageStats->Set(String::NewSymbol("p99"), Number::New((double)summary.p99));
+        stageStats->Set(String::NewSymbol("p999"), Number::New((double)summary.p999));
+        stages->Set(String::NewSymbol(ConvertStats::GetStageName(stage)), stageStats);
+        errors->Set(String::NewSymbol(ConvertStats::GetStageName(stage)), Number::New((double)summary.errors));
+    }
+    result->Set(String::NewSymbol("errors"), errors);
+    result->Set(String::NewSymbol("stages"), stages);
+    // bytes of buffers used by each conversion of text, and held by threads
+    voicemaker->stats->GetMemorySummary(&summary);
+    Local<Object> memory = Object::New();
+    memory->Set(String::NewSymbol("count"), Number::New((double)summary.count));
+    memory->Set(String::NewSymbol("sum"), Number::New((double)summary.sum));
+    memory->Set(String::NewSymbol("max"), Number::New((double)summary.max));
+    memory->Set(String::NewSymbol("p50"), Number::New((double)summary.p50));
+    memory->Set(String::NewSymbol("p90"), Number::New((double)summary.p90));
+    memory->Set(String::NewSymbol("p99"), Number::New((double)summary.p99));
+    memory->Set(String::NewSymbol("p999"), Number::New((double)summary.p999));
+    result->Set(String::NewSymbol("memory"), memory);
+    result->Set(String::NewSymbol("arenaBytes"), Number::New((double)ConvertArena::GetTotalCapacity()));
+
+    return scope.Close(result);
+}
+
+Handle<Value> VoiceMaker::SetTrace(const Arguments& args) {
+    HandleScope scope;
+
+    /* capacity(number), 0 disables tracing */
+    if (args.Length() != 1 || !args[0]->IsNumber()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. capacity must be number."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    switch (voicemaker->trace->SetCapacity(args[0]->Int32Value())) {
+    case 0:
+        break;
+    case 1:
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. capacity must not be negative."))));
+    default:
+        return scope.Close(ThrowException(Exception::Error(String::New("failed in allocate trace buffer."))));
+    }
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> VoiceMaker::TraceRequest(const Arguments& args) {
+    HandleScope scope;
+
+    /* requestId(string) or null, tagged to events of following conversions */
+    if (args.Length() != 1 || !(args[0]->IsString() || args[0]->IsNull())) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. requestId must be string or null."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    free(voicemaker->traceRequestId);
+    voicemaker->traceRequestId = NULL;
+    if (args[0]->IsString()) {
+        String::Utf8Value requestId(args[0]->ToString());
+        voicemaker->traceRequestId = strndup(*requestId, TraceBuffer::REQUEST_ID_MAX_LENGTH);
+    }
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> VoiceMaker::GetTrace(const Arguments& args) {
+    HandleScope scope;
+    string json;
+
+    if (args.Length() > 0) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. must be no argument."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    voicemaker->trace->WriteJson(&json);
+
+    return scope.Close(String::New(json.c_str(), json.size()));
+}
+
+Handle<Value> VoiceMaker::SetSlowLog(const Arguments& args) {
+    HandleScope scope;
+    double threshold;
+
+    /* threshold(number of milliseconds), capacity(number), 0 capacity disables log */
+    if (args.Length() != 2 || !args[0]->IsNumber() || !args[1]->IsNumber()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. threshold and capacity must be number."))));
+    }
+    threshold = args[0]->NumberValue();
+    if (!(threshold >= 0)) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. threshold must not be negative."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    if (voicemaker->slowLog->Set((unsigned long long)(threshold * 1000000.0), args[1]->Int32Value())) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. capacity must not be negative."))));
+    }
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> VoiceMaker::GetSlowLog(const Arguments& args) {
+    HandleScope scope;
+    deque<SlowLog::Entry> entries;
+    int i;
+    int stage;
+
+    if (args.Length() > 0) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. must be no argument."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    voicemaker->slowLog->GetEntries(&entries);
+    Local<Array> result = Array::New(entries.size());
+    // times are nanoseconds
+    for (i = 0; i < (int)entries.size(); i++) {
+        const SlowLog::Entry &entry = entries[i];
+        Local<Object> item = Object::New();
+        Local<Object> stages = Object::New();
+        item->Set(String::NewSymbol("time"), Date::New((double)entry.time * 1000.0));
+        item->Set(String::NewSymbol("text"), String::New(entry.text.data(), entry.text.size()));
+        item->Set(String::NewSymbol("tagged"), String::New(entry.texts[SlowLog::TAGGED].data(), entry.texts[SlowLog::TAGGED].size()));
+        item->Set(String::NewSymbol("filtered"), String::New(entry.texts[SlowLog::FILTERED].data(), entry.texts[SlowLog::FILTERED].size()));
+        item->Set(String::NewSymbol("fixedup"), String::New(entry.texts[SlowLog::FIXEDUP].data(), entry.texts[SlowLog::FIXEDUP].size()));
+        item->Set(String::NewSymbol("total"), Number::New((double)entry.total));
+        item->Set(String::NewSymbol("outputBytes"), Integer::New(entry.outputBytes));
+        item->Set(String::NewSymbol("memoryBytes"), Number::New((double)entry.memoryBytes));
+        item->Set(String::NewSymbol("error"), entry.error ? (Handle<Value>)String::New(entry.error) : (Handle<Value>)Null());
+        for (stage = 0; stage < ConvertStats::STAGE_COUNT; stage++) {
+            stages->Set(String::NewSymbol(ConvertStats::GetStageName(stage)), Number::New((double)entry.stages[stage]));
+        }
+        item->Set(String::NewSymbol("stages"), stages);
+        result->Set(i, item);
+    }
+
+    return scope.Close(result);
+}
+
+Handle<Value> VoiceMaker::WriteSlowLog(const Arguments& args) {
+    HandleScope scope;
+
+    /* path(string), appended as json lines */
+    if (args.Length() != 1 || !args[0]->IsString()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. path must be string."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    String::Utf8Value path(args[0]->ToString());
+    switch (voicemaker->slowLog->Write(*path)) {
+    case 0:
+        break;
+    case 1:
+        return scope.Close(ThrowException(Exception::Error(String::New("failed in open slow log file."))));
+    default:
+        return scope.Close(ThrowException(Exception::Error(String::New("failed in write slow log file."))));
+    }
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> VoiceMaker::SetSynthesizer(const Arguments& args) {
+    HandleScope scope;
+    Synthesizer *synthesizer;
+
+    /* name(string), "aquestalk" or "stub" */
+    if (args.Length() != 1 || !args[0]->IsString()) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. name must be string."))));
+    }
+    VoiceMaker *voicemaker = Unwrap<VoiceMaker>(args.This());
+    String::Utf8Value name(args[0]->ToString());
+    if ((synthesizer = Synthesizer::Get(*name)) == NULL) {
+        return scope.Close(ThrowException(Exception::Error(String::New("Bad arguments. unknown synthesizer."))));
+    }
+    __sync_lock_test_and_set(&voicemaker->synthesizer, synthesizer);
+
+    return scope.Close(Undefined());
 }
 
 Handle<Value> VoiceMaker::GetErrorText(const Arguments& args) {
@@ -1329,14 +3049,38 @@ void VoiceMaker::Initialize(const Handle<Object>& target) {
     functionTemplate->InstanceTemplate()->SetInternalFieldCount(1);
     functionTemplate->SetClassName(String::NewSymbol("VoiceMaker"));
     NODE_SET_PROTOTYPE_METHOD(functionTemplate, "setDictionary", VoiceMaker::SetDictionary);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "setKanaFolding", VoiceMaker::SetKanaFolding);
     NODE_SET_PROTOTYPE_METHOD(functionTemplate, "loadDictionary", VoiceMaker::LoadDictionary);
     NODE_SET_PROTOTYPE_METHOD(functionTemplate, "saveDictionary", VoiceMaker::SaveDictionary);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "reloadDictionary", VoiceMaker::ReloadDictionary);
     NODE_SET_PROTOTYPE_METHOD(functionTemplate, "addPreferredWord", VoiceMaker::AddPreferredWord);
     NODE_SET_PROTOTYPE_METHOD(functionTemplate, "delPreferredWord", VoiceMaker::DelPreferredWord);
     NODE_SET_PROTOTYPE_METHOD(functionTemplate, "addFilterWord", VoiceMaker::AddFilterWord);
     NODE_SET_PROTOTYPE_METHOD(functionTemplate, "delFilterWord", VoiceMaker::DelFilterWord);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "registerVoice", VoiceMaker::RegisterVoice);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "unregisterVoice", VoiceMaker::UnregisterVoice);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "reloadVoice", VoiceMaker::ReloadVoice);
     NODE_SET_PROTOTYPE_METHOD(functionTemplate, "convert", VoiceMaker::Convert);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "convertAsync", VoiceMaker::ConvertAsync);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "convertWave", VoiceMaker::ConvertWave);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "convertWaveAsync", VoiceMaker::ConvertWaveAsync);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "convertStream", VoiceMaker::ConvertStream);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "convertWaveStream", VoiceMaker::ConvertWaveStream);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "convertBatch", VoiceMaker::ConvertBatch);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "convertWaveBatch", VoiceMaker::ConvertWaveBatch);
     NODE_SET_PROTOTYPE_METHOD(functionTemplate, "getErrorText", VoiceMaker::GetErrorText);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "getStats", VoiceMaker::GetStats);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "setTrace", VoiceMaker::SetTrace);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "traceRequest", VoiceMaker::TraceRequest);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "getTrace", VoiceMaker::GetTrace);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "setSlowLog", VoiceMaker::SetSlowLog);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "getSlowLog", VoiceMaker::GetSlowLog);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "writeSlowLog", VoiceMaker::WriteSlowLog);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "setSynthesizer", VoiceMaker::SetSynthesizer);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "setCacheSize", VoiceMaker::SetCacheSize);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "setReadingCacheSize", VoiceMaker::SetReadingCacheSize);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "getCacheStats", VoiceMaker::GetCacheStats);
+    NODE_SET_PROTOTYPE_METHOD(functionTemplate, "setSharedCache", VoiceMaker::SetSharedCache);
     target->Set(String::New("VoiceMaker"), functionTemplate->GetFunction());
 }
 
@@ -0,0 +1,519 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mecab.h>
+#include <string>
+#include <vector>
+#include "dictionary.h"
+#include "arena.h"
+#include "reading.h"
+#include "stats.h"
+#include "textscan.h"
+
+using namespace std;
+using namespace voicemaker;
+
+// allocations are counted by replacing malloc of glibc
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+static unsigned long long allocCount = 0;
+
+void *malloc(size_t size) {
+    allocCount++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocCount++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocCount++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+namespace {
+
+// words added before each publish in add_* stages, bulk edits must stay linear
+const int BULK_WORDS = 8192;
+
+struct Line {
+    string text;
+    string preText;
+    // numbers replaced by placeholders
+    string taggerText;
+    mecab_lattice_t *lattice;
+    // numbers of line and filtered tokens, input of fixup
+    TokenStream *tokens;
+};
+
+struct Result {
+    const char *name;
+    unsigned long long calls;
+    unsigned long long elapsed;
+    unsigned long long bytes;
+    unsigned long long allocs;
+};
+
+class Bench {
+public:
+    int Load(const char *corpusPath, const char *preferredPath, const char *filterPath);
+    int Run(vector<Result> *results, int rounds);
+
+    Bench();
+    ~Bench();
+private:
+    Dictionary dictionary;
+    DictionarySnapshot *snapshot;
+    mecab_model_t *model;
+    mecab_t *tagger;
+    vector<Line> lines;
+
+    void Begin(Result *result, const char *name);
+    void End(Result *result, unsigned long long start, unsigned long long allocs);
+    int Prepare();
+    int AddWords(Result *result, int rounds, int dictType);
+};
+
+Bench::Bench() {
+    snapshot = NULL;
+    model = NULL;
+    tagger = NULL;
+}
+
+Bench::~Bench() {
+    int i;
+
+    for (i = 0; i < (int)lines.size(); i++) {
+        if (lines[i].lattice) {
+            mecab_lattice_destroy(lines[i].lattice);
+        }
+        delete lines[i].tokens;
+    }
+    if (tagger) {
+        mecab_destroy(tagger);
+    }
+    if (model) {
+        mecab_model_destroy(model);
+    }
+    if (snapshot) {
+        snapshot->Unref();
+    }
+}
+
+int Bench::Load(const char *corpusPath, const char *preferredPath, const char *filterPath) {
+    char buffer[4096];
+    FILE *fp;
+    int argc = 1;
+    char *argv[] = { (char *)"voicemaker_bench" };
+
+    if (dictionary.SetDictionaryPath(preferredPath, filterPath) ||
+        dictionary.LoadDictionary() ||
+        dictionary.Acquire(&snapshot)) {
+        return 1;
+    }
+    if ((fp = fopen(corpusPath, "r")) == NULL) {
+        return 2;
+    }
+    while (fgets(buffer, sizeof(buffer), fp)) {
+        Line line;
+        int length = strlen(buffer);
+        while (length > 0 && (buffer[length - 1] == '\n' || buffer[length - 1] == '\r')) {
+            length--;
+        }
+        if (length == 0) {
+            continue;
+        }
+        line.text.assign(buffer, length);
+        line.lattice = NULL;
+        line.tokens = NULL;
+        lines.push_back(line);
+    }
+    fclose(fp);
+    if (lines.empty()) {
+        return 2;
+    }
+    model = mecab_model_new(argc, argv);
+    if (model == NULL || (tagger = mecab_model_new_tagger(model)) == NULL) {
+        return 3;
+    }
+
+    return Prepare();
+}
+
+int Bench::Prepare() {
+    ConvertArena *arena;
+    ConvertArena::Buffer *preText;
+    ConvertArena::Buffer *taggerText;
+    ConvertArena::Buffer *swapText;
+    const char *pre;
+    int preTextLen;
+    int taggerTextLen;
+    int i;
+
+    if ((arena = ConvertArena::Get()) == NULL) {
+        return 4;
+    }
+    preText = arena->GetBuffer(ConvertArena::PRE_TEXT);
+    taggerText = arena->GetBuffer(ConvertArena::TAGGER_TEXT);
+    swapText = arena->GetBuffer(ConvertArena::SWAP_TEXT);
+    // inputs of each stage are made once, out of measurement
+    for (i = 0; i < (int)lines.size(); i++) {
+        Line &line = lines[i];
+        if (ReadingConverter::Preprocess(&pre, &preTextLen, &preText->data, &preText->capacity, line.text.data(), line.text.size())) {
+            return 4;
+        }
+        line.preText.assign(pre, preTextLen);
+        // numbers point into preText of line
+        line.tokens = new TokenStream();
+        if (ReadingConverter::ScanNumbers(&taggerText->data, &taggerText->capacity, &taggerTextLen, line.tokens, line.preText.data(), line.preText.size())) {
+            return 4;
+        }
+        line.taggerText.assign(taggerText->data, taggerTextLen - 1);
+        line.lattice = mecab_model_new_lattice(model);
+        if (line.lattice == NULL) {
+            return 3;
+        }
+        mecab_lattice_set_sentence(line.lattice, line.taggerText.c_str());
+        if (!mecab_parse_lattice(tagger, line.lattice)) {
+            return 3;
+        }
+        if (ReadingConverter::ReadTokens(line.tokens, mecab_lattice_get_bos_node(line.lattice), snapshot, NULL) ||
+            ReadingConverter::FilterTokens(line.tokens, &swapText->data, &swapText->capacity, snapshot, arena->GetReplaceBuffer())) {
+            return 4;
+        }
+    }
+
+    return 0;
+}
+
+void Bench::Begin(Result *result, const char *name) {
+    result->name = name;
+    result->calls = 0;
+    result->bytes = 0;
+    result->elapsed = 0;
+    result->allocs = 0;
+}
+
+void Bench::End(Result *result, unsigned long long start, unsigned long long allocs) {
+    result->elapsed = ConvertStats::Now() - start;
+    result->allocs = allocCount - allocs;
+}
+
+int Bench::AddWords(Result *result, int rounds, int dictType) {
+    DictionarySnapshot *added;
+    char src[32];
+    int srcLen;
+    int round;
+    int i;
+
+    // words are added to empty dictionary and published once by Acquire
+    for (round = 0; round < rounds; round++) {
+        Dictionary bulk;
+        for (i = 0; i < BULK_WORDS; i++) {
+            srcLen = snprintf(src, sizeof(src), "bench%d", i);
+            if (bulk.AddWordPair(src, srcLen, "ベンチ", strlen("ベンチ"), dictType)) {
+                return 1;
+            }
+            result->bytes += srcLen;
+            result->calls++;
+        }
+        if (bulk.Acquire(&added)) {
+            return 1;
+        }
+        added->Unref();
+    }
+
+    return 0;
+}
+
+int Bench::Run(vector<Result> *results, int rounds) {
+    Result result;
+    unsigned long long start;
+    unsigned long long allocs;
+    mecab_lattice_t *lattice;
+    vector<unsigned char> wave;
+    // buffers of stages are reused like ConvertText, grown in first round
+    ConvertArena *arena = ConvertArena::Get();
+    ConvertArena::Buffer *buffer;
+    TokenStream *stream;
+    unsigned long long callStart;
+    unsigned long long callAllocs;
+    const char *pre;
+    char *out;
+    int outLen;
+    int round;
+    int i;
+
+    if (arena == NULL) {
+        return 1;
+    }
+
+    buffer = arena->GetBuffer(ConvertArena::PRE_TEXT);
+    Begin(&result, "preprocess");
+    allocs = allocCount;
+    start = ConvertStats::Now();
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < (int)lines.size(); i++) {
+            if (ReadingConverter::Preprocess(&pre, &outLen, &buffer->data, &buffer->capacity, lines[i].text.data(), lines[i].text.size())) {
+                return 1;
+            }
+            result.bytes += lines[i].text.size();
+            result.calls++;
+        }
+    }
+    End(&result, start, allocs);
+    results->push_back(result);
+
+    buffer = arena->GetBuffer(ConvertArena::TAGGER_TEXT);
+    stream = arena->GetTokenStream();
+    Begin(&result, "numbers");
+    allocs = allocCount;
+    start = ConvertStats::Now();
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < (int)lines.size(); i++) {
+            if (ReadingConverter::ScanNumbers(&buffer->data, &buffer->capacity, &outLen, stream, lines[i].preText.data(), lines[i].preText.size())) {
+                return 1;
+            }
+            result.bytes += lines[i].preText.size();
+            result.calls++;
+        }
+    }
+    End(&result, start, allocs);
+    results->push_back(result);
+
+    if ((lattice = mecab_model_new_lattice(model)) == NULL) {
+        return 1;
+    }
+    Begin(&result, "tagging");
+    allocs = allocCount;
+    start = ConvertStats::Now();
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < (int)lines.size(); i++) {
+            mecab_lattice_set_sentence(lattice, lines[i].taggerText.c_str());
+            if (!mecab_parse_lattice(tagger, lattice)) {
+                mecab_lattice_destroy(lattice);
+                return 1;
+            }
+            result.bytes += lines[i].taggerText.size();
+            result.calls++;
+        }
+    }
+    End(&result, start, allocs);
+    results->push_back(result);
+    mecab_lattice_destroy(lattice);
+
+    Begin(&result, "get_dst_word");
+    allocs = allocCount;
+    start = ConvertStats::Now();
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < (int)lines.size(); i++) {
+            const mecab_node_t *node = mecab_lattice_get_bos_node(lines[i].lattice);
+            const char *dst;
+            int dstLen;
+            for (; node; node = node->next) {
+                snapshot->GetDstWord(node->surface, node->length, &dst, &dstLen);
+                result.bytes += node->length;
+                result.calls++;
+            }
+        }
+    }
+    End(&result, start, allocs);
+    results->push_back(result);
+
+    // numbers of line are given to stream out of measurement
+    Begin(&result, "read_nodes");
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < (int)lines.size(); i++) {
+            stream->numbers = lines[i].tokens->numbers;
+            callAllocs = allocCount;
+            callStart = ConvertStats::Now();
+            if (ReadingConverter::ReadTokens(stream, mecab_lattice_get_bos_node(lines[i].lattice), snapshot, NULL)) {
+                return 1;
+            }
+            result.elapsed += ConvertStats::Now() - callStart;
+            result.allocs += allocCount - callAllocs;
+            result.bytes += lines[i].taggerText.size();
+            result.calls++;
+        }
+    }
+    results->push_back(result);
+
+    // filter rewrites tokens, so they are read again out of measurement
+    buffer = arena->GetBuffer(ConvertArena::SWAP_TEXT);
+    Begin(&result, "filter");
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < (int)lines.size(); i++) {
+            stream->numbers = lines[i].tokens->numbers;
+            if (ReadingConverter::ReadTokens(stream, mecab_lattice_get_bos_node(lines[i].lattice), snapshot, NULL)) {
+                return 1;
+            }
+            result.bytes += stream->readingsLen;
+            callAllocs = allocCount;
+            callStart = ConvertStats::Now();
+            if (ReadingConverter::FilterTokens(stream, &buffer->data, &buffer->capacity, snapshot, arena->GetReplaceBuffer())) {
+                return 1;
+            }
+            result.elapsed += ConvertStats::Now() - callStart;
+            result.allocs += allocCount - callAllocs;
+            result.calls++;
+        }
+    }
+    results->push_back(result);
+
+    buffer = arena->GetBuffer(ConvertArena::READING_TEXT);
+    Begin(&result, "fixup");
+    allocs = allocCount;
+    start = ConvertStats::Now();
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < (int)lines.size(); i++) {
+            if (ReadingConverter::WriteReading(&buffer->data, &buffer->capacity, &outLen, lines[i].tokens)) {
+                return 1;
+            }
+            result.bytes += outLen;
+            result.calls++;
+        }
+    }
+    End(&result, start, allocs);
+    results->push_back(result);
+
+    // about 2 seconds of 8kHz 16bit wave, as made from a line of corpus
+    wave.resize(32000);
+    for (i = 0; i < (int)wave.size(); i++) {
+        wave[i] = (unsigned char)(i * 2654435761U >> 24);
+    }
+    Begin(&result, "base64");
+    allocs = allocCount;
+    start = ConvertStats::Now();
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < (int)lines.size(); i++) {
+            if (ReadingConverter::Base64Encode(&out, &outLen, &wave[0], wave.size())) {
+                return 1;
+            }
+            free(out);
+            result.bytes += wave.size();
+            result.calls++;
+        }
+    }
+    End(&result, start, allocs);
+    results->push_back(result);
+
+    Begin(&result, "add_preferred");
+    allocs = allocCount;
+    start = ConvertStats::Now();
+    if (AddWords(&result, rounds, Dictionary::PREFERRED)) {
+        return 1;
+    }
+    End(&result, start, allocs);
+    results->push_back(result);
+
+    Begin(&result, "add_filter");
+    allocs = allocCount;
+    start = ConvertStats::Now();
+    if (AddWords(&result, rounds, Dictionary::FILTER)) {
+        return 1;
+    }
+    End(&result, start, allocs);
+    results->push_back(result);
+
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Bench bench;
+    vector<Result> results;
+    const char *error;
+    int rounds = 100;
+    int tabular = 0;
+    int option;
+    int result;
+    int i;
+
+    while ((option = getopt(argc, argv, "n:s:t")) != -1) {
+        switch (option) {
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 's':
+            // scanner of preprocess, slower ones are compared with default
+            for (i = TextScanner::AVX2; i >= TextScanner::SCALAR; i--) {
+                if (strcmp(optarg, TextScanner::GetLevelName(i)) == 0) {
+                    break;
+                }
+            }
+            if (TextScanner::Select(i)) {
+                fprintf(stderr, "scanner %s is not supported.\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            tabular = 1;
+            break;
+        default:
+            rounds = 0;
+            break;
+        }
+    }
+    if (rounds < 1 || argc - optind != 3) {
+        fprintf(stderr, "usage: %s [-n rounds] [-s scalar|sse2|avx2] [-t] <corpus> <preferred dictionary> <filter dictionary>\n", argv[0]);
+        return 1;
+    }
+    if ((result = bench.Load(argv[optind], argv[optind + 1], argv[optind + 2]))) {
+        switch (result) {
+        case 1:
+            error = "failed in load dictionary.";
+            break;
+        case 2:
+            error = "failed in read corpus.";
+            break;
+        case 3:
+            error = "failed in parse corpus by mecab.";
+            break;
+        case 4:
+            error = "failed in convert corpus.";
+            break;
+        default:
+            error = "preferred error";
+            break;
+        }
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+    if (bench.Run(&results, rounds)) {
+        fprintf(stderr, "failed in run benchmark.\n");
+        return 1;
+    }
+    // tab separated values are for comparing releases by scripts
+    if (tabular) {
+        printf("stage\tcalls\tns_per_call\tbytes_per_sec\tallocs_per_call\n");
+    } else {
+        printf("scanner: %s\n", TextScanner::GetLevelName(TextScanner::GetLevel()));
+        printf("%-14s %10s %12s %12s %12s\n", "stage", "calls", "ns/call", "MB/s", "allocs/call");
+    }
+    for (i = 0; i < (int)results.size(); i++) {
+        const Result &r = results[i];
+        double nsPerCall = r.calls ? (double)r.elapsed / r.calls : 0;
+        double bytesPerSec = r.elapsed ? r.bytes * 1e9 / r.elapsed : 0;
+        double allocsPerCall = r.calls ? (double)r.allocs / r.calls : 0;
+        if (tabular) {
+            printf("%s\t%llu\t%.1f\t%.0f\t%.2f\n", r.name, r.calls, nsPerCall, bytesPerSec, allocsPerCall);
+        } else {
+            printf("%-14s %10llu %12.1f %12.2f %12.2f\n", r.name, r.calls, nsPerCall, bytesPerSec / 1e6, allocsPerCall);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "dictionary.h"
+
+using namespace voicemaker;
+
+int main(int argc, char *argv[]) {
+    Dictionary dictionary;
+    const char *error;
+    int usage = 0;
+    int option;
+    int result;
+
+    while ((option = getopt(argc, argv, "k")) != -1) {
+        switch (option) {
+        case 'k':
+            dictionary.SetKanaFolding(1);
+            break;
+        default:
+            usage = 1;
+            break;
+        }
+    }
+    if (usage || argc - optind != 3) {
+        fprintf(stderr, "usage: %s [-k] <preferred dictionary> <filter dictionary> <compiled dictionary>\n", argv[0]);
+        return 1;
+    }
+    if (dictionary.SetDictionaryPath(argv[optind], argv[optind + 1])) {
+        fprintf(stderr, "failed in set dictionary path.\n");
+        return 1;
+    }
+    if ((result = dictionary.LoadDictionary())) {
+        switch (result) {
+        case 1:
+            error = "failed in copy path of dictionary.";
+            break;
+        case 2:
+            error = "failed in open dictionary.";
+            break;
+        case 3:
+            error = "failed in set word.";
+            break;
+        default:
+            error = "preferred error";
+            break;
+        }
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+    if ((result = dictionary.SaveCompiledDictionary(argv[optind + 2]))) {
+        switch (result) {
+        case 1:
+            error = "failed in open dictionary.";
+            break;
+        case 3:
+            error = "failed in write dictionary.";
+            break;
+        default:
+            error = "preferred error";
+            break;
+        }
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+
+    return 0;
+}